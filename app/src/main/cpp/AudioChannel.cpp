@@ -1,12 +1,30 @@
 #include "AudioChannel.h"
+#include <time.h>
+
+// 每编码这么多秒的音频打印一次 CPU 消耗
+#define AUDIO_STATS_SECONDS 10
+
+static int64_t threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 AudioChannel::AudioChannel() {
     pthread_mutex_init(&mutexAudio, 0);
+    pthread_create(&pid_encode, nullptr, encodeTask, this);
 }
 
 AudioChannel::~AudioChannel() {
+    pcmRing.stop();
+    pthread_join(pid_encode, nullptr);
+    logStats();
     pthread_mutex_destroy(&mutexAudio);
-    DELETE(buffer);
+    delete[] frameBuf;
+    if (buffer) {
+        free(buffer); // malloc 分配的，不能 delete
+        buffer = nullptr;
+    }
     if (audioEncoder) {
         faacEncClose(audioEncoder);
         audioEncoder = nullptr;
@@ -16,19 +34,34 @@ AudioChannel::~AudioChannel() {
 void AudioChannel::initAudioEncoder(unsigned long sample_rate, unsigned int channels) {
     pthread_mutex_lock(&mutexAudio);
     this->mChannels = channels;
+    this->mSampleRate = sample_rate;
 
     /**
      * 44100 采样率
-     * 两个声道
+     * 声道数和采集一致（AudioChannel.java 是单声道）
      * 16bit 2个字节
      */
 
+    // 重新配置：关掉旧的编码器，下一帧之前要重发 sequence header
+    bool reconfigure = audioEncoder != nullptr;
+    if (audioEncoder) {
+        faacEncClose(audioEncoder);
+        audioEncoder = nullptr;
+    }
+    if (buffer) {
+        free(buffer);
+        buffer = nullptr;
+    }
+    seqHeaderLen = 0;
+    frameSamples.store(0, std::memory_order_release);
+
     /**
      * 第一步：打开faac编码器
      */
     audioEncoder = faacEncOpen(sample_rate, channels, &inputSamples, &maxOutputBytes);
     if (!audioEncoder) {
         LOGE("打开音频编码器失败");
+        pthread_mutex_unlock(&mutexAudio);
         return;
     }
 
@@ -56,6 +89,9 @@ void AudioChannel::initAudioEncoder(unsigned long sample_rate, unsigned int chan
     int ret = faacEncSetConfiguration(audioEncoder, config);
     if (!ret) {
         LOGE("音频编码器参数配置失败");
+        faacEncClose(audioEncoder);
+        audioEncoder = nullptr;
+        pthread_mutex_unlock(&mutexAudio);
         return;
     }
 
@@ -63,68 +99,149 @@ void AudioChannel::initAudioEncoder(unsigned long sample_rate, unsigned int chan
 
     // 输出缓冲区定义
     buffer = (unsigned char *) malloc(maxOutputBytes * sizeof(unsigned char));
-    pthread_mutex_unlock(&mutexAudio);
-}
-
-RTMPPacket *AudioChannel::getAudioSeqHeader() {
-    u_char *ppBuffer;
-    u_long len;
 
-    // 获取编码器的解码配置信息
-    faacEncGetDecoderSpecificInfo(audioEncoder, &ppBuffer, &len);
+    /**
+     * 第四步：AudioSpecificConfig 只取一次，序列化成 sequence header 的 body 缓存起来
+     */
+    u_char *ppBuffer = nullptr;
+    u_long len = 0;
+    faacEncGetDecoderSpecificInfo(audioEncoder, &ppBuffer, &len); // ppBuffer 是 faac malloc 的
+    if (ppBuffer && len <= sizeof(seqHeader) - 2) {
+        // AF == AAC编码器，44100采样率，位深16bit，双声道
+        // AE == AAC编码器，44100采样率，位深16bit，单声道
+        seqHeader[0] = mChannels == 1 ? 0xAE : 0xAF;
+        seqHeader[1] = 0x00; // 序列/头参数==0
+        memcpy(&seqHeader[2], ppBuffer, len); // 编码器的解码配置信息
+        seqHeaderLen = 2 + len;
+    } else {
+        LOGE("获取 AudioSpecificConfig 失败");
+    }
+    free(ppBuffer);
+    seqHeaderPending = reconfigure;
+    sampleClock.reset((int64_t) sample_rate * channels);
+    pendingCount = 0; // 旧编码器里没吐出来的帧随编码器一起丢了
 
-    RTMPPacket *packet = new RTMPPacket;
+    delete[] frameBuf;
+    frameBuf = new int16_t[inputSamples];
+    frameSamples.store(inputSamples, std::memory_order_release);
 
-    int body_size = 2 + len;
+    pthread_mutex_unlock(&mutexAudio);
+}
 
-    RTMPPacket_Alloc(packet, body_size);
+RTMPPacket *AudioChannel::getAudioSeqHeader() {
+    pthread_mutex_lock(&mutexAudio);
+    // 和最近的音频帧同一个时间戳，还没有音频帧就用当前时刻，推流线程再换成相对时间
+    RTMPPacket *packet = buildSeqHeader(hasAudioTime ? lastAudioTime : mediaMs(monotonicNs()));
+    pthread_mutex_unlock(&mutexAudio);
+    return packet;
+}
 
-    // AF == AAC编码器，44100采样率，位深16bit，双声道
-    // AE == AAC编码器，44100采样率，位深16bit，单声道
-    packet->m_body[0] = 0xAF; // 双声道
-    if (mChannels == 1) {
-        packet->m_body[0] = 0xAE; // 单声道
+RTMPPacket *AudioChannel::buildSeqHeader(uint32_t time) {
+    if (!seqHeaderLen) {
+        return nullptr;
     }
 
-    // 序列/头参数==0
-    packet->m_body[1] = 0x00;
-
-    // 编码器的解码配置信息
-    memcpy(&packet->m_body[0], ppBuffer, strlen((char *) ppBuffer));
+    // 缓存的 body 原样放进池化包，发送完包会被回收，所以每次拷一份（只有几个字节）
+    RTMPPacket *packet = PacketPool::obtain(seqHeaderLen);
+    memcpy(packet->m_body, seqHeader, seqHeaderLen);
 
     packet->m_packetType = RTMP_PACKET_TYPE_AUDIO; // 包类型，音频
-    packet->m_nBodySize = body_size;
+    packet->m_nBodySize = seqHeaderLen;
     packet->m_nChannel = 0x11; // 通道ID，随便写一个，注意：不要写的和rtmp.c(里面的m_nChannel有冲突 4301行)
-    packet->m_nTimeStamp = 0; // 头一般都是没有时间戳
+    packet->m_nTimeStamp = time; // 和后面的音频帧对齐，时间戳不回退
     packet->m_hasAbsTimestamp = 0; // 一般都不用
     packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
 
+    seqHeadersSent++;
     return packet;
 }
 
-void AudioChannel::encodeData(int32_t *data) {
-    pthread_mutex_lock(&mutexAudio);
+void AudioChannel::encodeData(int16_t *pcm, int samples, int64_t captureNs) {
+    // 在 AudioRecord 线程上只做一次拷贝进环，编码再慢也不会阻塞采集
+    if (samples > 0) {
+        // 丢掉的样本不计数，采集时刻和样本数对不上的部分由 SampleClock 重新对齐
+        size_t n = pcmRing.write(pcm, samples);
+        uint64_t written = writtenSamples.fetch_add(n, std::memory_order_relaxed) + n;
+        sampleClock.observe(written, captureNs);
+    }
+}
+
+void *AudioChannel::encodeTask(void *args) {
+    AudioChannel *channel = static_cast<AudioChannel *>(args);
+    PcmRing &ring = channel->pcmRing;
+
+    for (;;) {
+        unsigned long n = channel->frameSamples.load(std::memory_order_acquire);
+        if (!ring.waitFor(n ? n : 1)) {
+            break;
+        }
+        if (!n) { // 编码器还没打开，数据没法用
+            size_t skipped = ring.available();
+            ring.consume(skipped);
+            channel->consumedSamples += skipped;
+            continue;
+        }
+
+        pthread_mutex_lock(&channel->mutexAudio);
+        // 等待期间编码器可能重新配置过，一帧的大小变了就重新等
+        if (channel->audioEncoder && channel->inputSamples == n) {
+            int64_t cpuStart = threadCpuNs();
+            uint32_t time = mediaMs(channel->sampleClock.timeOf(channel->consumedSamples));
+            channel->encodeFrame(ring.peek(n, channel->frameBuf), time);
+            ring.consume(n);
+            channel->consumedSamples += n;
+            channel->encodeCpuNs += threadCpuNs() - cpuStart;
+
+            // 统计：每秒音频消耗多少 CPU
+            uint64_t window = (uint64_t) channel->mSampleRate * channel->mChannels * AUDIO_STATS_SECONDS;
+            uint64_t before = channel->encodedSamples;
+            channel->encodedSamples += n;
+            if (window && channel->encodedSamples / window != before / window) {
+                channel->logStats();
+            }
+        }
+        pthread_mutex_unlock(&channel->mutexAudio);
+    }
+    return nullptr;
+}
+
+void AudioChannel::encodeFrame(const int16_t *pcm, uint32_t time) {
     /**
      * 1，上面的初始化好的faac编码器
-     * 2，数据（无符号的事情）
+     * 2，数据：FAAC_INPUT_16BIT 时 faac 按 short 读取，直接把 PCM 交给它，不再扩成 int32
      * 3，上面的初始化好的样本数
      * 4，接收成果的 输出 缓冲区
      * 5，接收成果的 输出 缓冲区 大小
      * ret:返回编码后数据字节长度
      */
     int byteLen = faacEncEncode(audioEncoder,
-                                data,
+                                reinterpret_cast<int32_t *>(const_cast<int16_t *>(pcm)),
                                 inputSamples,
                                 buffer,
                                 maxOutputBytes);
 
-    if (byteLen > 0) {
-        audioCallback(getAudioSeqHeader());
-        RTMPPacket *packet = new RTMPPacket;
+    // 输入帧的时间排队，每吐出一个 AAC 帧取最早的一个；队列满说明编码器一直不出帧，丢掉最早的
+    if (pendingCount == DELAY_FRAMES) {
+        pendingHead = (pendingHead + 1) % DELAY_FRAMES;
+        pendingCount--;
+    }
+    pendingTimes[(pendingHead + pendingCount) % DELAY_FRAMES] = time;
+    pendingCount++;
 
+    if (byteLen > 0) {
+        uint32_t frameTime = pendingTimes[pendingHead];
+        pendingHead = (pendingHead + 1) % DELAY_FRAMES;
+        pendingCount--;
+        lastAudioTime = frameTime;
+        hasAudioTime = true;
+
+        if (seqHeaderPending) { // 编码器重新配置过，解码端需要新的 AudioSpecificConfig
+            seqHeaderPending = false;
+            audioCallback(buildSeqHeader(frameTime));
+        }
         int body_size = 2 + byteLen;
 
-        RTMPPacket_Alloc(packet, body_size);
+        RTMPPacket *packet = PacketPool::obtain(body_size);
 
         // AF == AAC编码器，44100采样率，位深16bit，双声道
         // AE == AAC编码器，44100采样率，位深16bit，单声道
@@ -141,14 +258,27 @@ void AudioChannel::encodeData(int32_t *data) {
         packet->m_packetType = RTMP_PACKET_TYPE_AUDIO;
         packet->m_nBodySize = body_size;
         packet->m_nChannel = 0x11; // 通道ID，随便写一个，注意：不要写的和rtmp.c(里面的m_nChannel有冲突 4301行)
-        packet->m_nTimeStamp = -1; // 帧数据有时间戳
+        packet->m_nTimeStamp = frameTime; // 采集时刻（毫秒），推流线程换成相对开始推流的时间戳
         packet->m_hasAbsTimestamp = 0; // 一般都不用
         packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
 
         // 把数据包放入队列
+        audioFrames++;
         audioCallback(packet);
     }
-    pthread_mutex_unlock(&mutexAudio);
+}
+
+void AudioChannel::logStats() {
+    if (!encodedSamples || !mSampleRate || !mChannels) {
+        return;
+    }
+    double seconds = (double) encodedSamples / mSampleRate / mChannels;
+    LOGE("音频编码 每秒音频 CPU:%.3fms 已编码:%.1fs AAC帧/秒:%.2f 音频消息/秒:%.2f "
+         "PCM环 丢弃样本:%llu 当前:%zu 峰值:%zu/%zu",
+         encodeCpuNs / 1e6 / seconds, seconds,
+         audioFrames / seconds, (audioFrames + seqHeadersSent) / seconds,
+         (unsigned long long) pcmRing.droppedSamples(), pcmRing.available(),
+         pcmRing.peakLevel(), pcmRing.capacity());
 }
 
 /**
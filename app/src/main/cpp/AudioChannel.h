@@ -6,6 +6,9 @@
 #include <rtmp.h>
 #include <cstring>
 #include "util.h"
+#include "packet_pool.h"
+#include "pcm_ring.h"
+#include "media_clock.h"
 #include <pthread.h>
 #include <malloc.h>
 
@@ -21,17 +24,57 @@ public:
 
     int getInputSamples();
 
-    void encodeData(int32_t *data);
+    /**
+     * pcm 是 16bit 交错 PCM，samples 是样本数（所有声道加起来）
+     * 只写进 PCM 环就返回，攒够 inputSamples 由编码线程交给 faac，环满时多出来的样本丢弃
+     * captureNs 是这块 PCM 读出来的时刻（CLOCK_MONOTONIC），AAC 帧的时间戳按样本数从它推算
+     */
+    void encodeData(int16_t *pcm, int samples, int64_t captureNs);
 
     void setAudioCallback(AudioCallback audioCallback);
 
+    /**
+     * AAC sequence header，body 在 initAudioEncoder 里序列化好，(重)连接时调用
+     */
     RTMPPacket *getAudioSeqHeader();
 
 private:
+    RTMPPacket *buildSeqHeader(uint32_t time); // 调用者持有 mutexAudio
+
+    void encodeFrame(const int16_t *pcm, uint32_t time); // 调用者持有 mutexAudio，time 是这帧第一个样本的采集时刻（毫秒）
+
+    static void *encodeTask(void *args);
+
+    void logStats();
+
+    PcmRing pcmRing; // AudioRecord 线程写，编码线程读
+    pthread_t pid_encode;
+    std::atomic<unsigned long> frameSamples{0}; // 编码器当前一帧的样本数，0 表示还没打开
+    int16_t *frameBuf = nullptr; // 一帧跨越环尾时拼接用
+    std::atomic<uint64_t> writtenSamples{0}; // 写进 PCM 环的样本总数，AudioRecord 线程写
+    uint64_t consumedSamples = 0; // 从 PCM 环取走的样本总数，编码线程读写
+    SampleClock sampleClock; // 样本序号 -> 采集时刻
+
+    // faac 有编码延迟，前几帧输入没有输出，输出的 AAC 帧对应更早的输入帧，按输入顺序排队
+    static const int DELAY_FRAMES = 8;
+    uint32_t pendingTimes[DELAY_FRAMES];
+    int pendingHead = 0;
+    int pendingCount = 0;
+    uint32_t lastAudioTime = 0; // 最近一个 AAC 帧的时间戳
+    bool hasAudioTime = false;
+
     pthread_mutex_t mutexAudio;
     unsigned long inputSamples; // faac 输入的样本数
     unsigned long maxOutputBytes; // faac 编码器最大能输出的字节数
     unsigned int mChannels = 2; // 通道数
+    unsigned long mSampleRate = 44100; // 采样率
+    uint64_t encodedSamples = 0; // 已编码的样本数（所有声道加起来）
+    int64_t encodeCpuNs = 0; // 编码消耗的线程 CPU 时间
+    unsigned char seqHeader[2 + 62]; // 序列化好的 sequence header body：2 字节 tag 头 + AudioSpecificConfig
+    int seqHeaderLen = 0;
+    bool seqHeaderPending = false; // 编码器重新配置后，下一帧之前要重发
+    uint64_t audioFrames = 0; // 发出的 AAC 帧数
+    uint64_t seqHeadersSent = 0; // 发出的 sequence header 数
     unsigned char *buffer = nullptr; // 编码后的输出 buffer
     faacEncHandle audioEncoder = nullptr; // 音频编码器
     AudioCallback audioCallback{};
@@ -1,13 +1,142 @@
 #include "VideoChannel.h"
+#include "yuv_convert.h"
+#include "nal_sink.h"
+#include "media_clock.h"
+#include <unistd.h>
+
+// 切片线程数的上限，切片越多压缩效率越低
+#define MAX_SLICE_THREADS 4
+
+// 编码线程每处理这么多帧打印一次统计
+#define VIDEO_STATS_FRAMES 300
+
+static bool isSlice(int type) {
+    return type == NAL_SLICE || type == NAL_SLICE_IDR;
+}
+
+// 放进访问单元 tag 的 NAL：SPS/PPS 走 AVC sequence header，AUD/填充数据不需要
+static bool inAccessUnit(int type) {
+    return type != NAL_SPS && type != NAL_PPS && type != NAL_AUD && type != NAL_FILLER;
+}
+
+// 写 FLV 视频 tag 头（5 字节）和 RTMPPacket 的公共字段
+// dts 是 x264 输出的解码时间（单调时钟毫秒），cts 是显示时间减解码时间
+static void finishVideoPacket(RTMPPacket *packet, int body_size, bool keyFrame, uint32_t dts,
+                              int32_t cts) {
+    // 区分关键帧 和 非关键帧
+    packet->m_body[0] = 0x27; // 普通帧 非关键帧
+    if (keyFrame) {
+        packet->m_body[0] = 0x17; // 关键帧
+    }
+
+    packet->m_body[1] = 0x01; // 如果是1 帧类型（关键帧 非关键帧）， 如果是0一定是 sps pps
+    packet->m_body[2] = (cts >> 16) & 0xFF; // composition time，24 位有符号
+    packet->m_body[3] = (cts >> 8) & 0xFF;
+    packet->m_body[4] = cts & 0xFF;
+
+    packet->m_packetType = RTMP_PACKET_TYPE_VIDEO; // 包类型，是视频类型
+    packet->m_nBodySize = body_size; // 设置好 关键帧 或 普通帧 的总大小
+    packet->m_nChannel = 0x10; // 注意：不要写的和rtmp.c(里面的m_nChannel有冲突 4301行)
+    packet->m_nTimeStamp = dts; // 推流线程换成相对开始推流的时间戳
+    packet->m_hasAbsTimestamp = 0;
+    packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
+}
 
 VideoChannel::VideoChannel() {
     pthread_mutex_init(&mutex, 0);
+    pthread_create(&pid_encode, nullptr, encodeTask, this);
 }
 
 VideoChannel::~VideoChannel() {
+    frameQueue.stop();
+    pthread_join(pid_encode, nullptr);
+    logEncodeStats();
     pthread_mutex_destroy(&mutex);
 }
 
+void VideoChannel::pushFrame(const uint8_t *data, int size) {
+    frameQueue.push(data, size);
+}
+
+void VideoChannel::requestKeyFrame() {
+    mForceKeyFrame.store(true);
+}
+
+void VideoChannel::setBitrate(int kbps) {
+    pthread_mutex_lock(&mutex);
+    if (!videoEncoder) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    x264_param_t param;
+    x264_encoder_parameters(videoEncoder, &param);
+    param.rc.i_bitrate = kbps;
+    param.rc.i_vbv_max_bitrate = kbps * 1.2; // 和 initVideoEncoder 保持一样的比例
+    param.rc.i_vbv_buffer_size = kbps;
+    if (x264_encoder_reconfig(videoEncoder, &param) < 0) {
+        LOGE("x264 重新配置码率失败:%dkbps", kbps);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+int VideoChannel::getBitrate() {
+    return mBitrate / 1000;
+}
+
+void VideoChannel::setFrameDecimation(int factor) {
+    frameQueue.setDecimation(factor);
+}
+
+void VideoChannel::setDropPolicy(FrameQueue::DropPolicy policy, int threshold) {
+    frameQueue.setPolicy(policy, threshold);
+}
+
+void *VideoChannel::encodeTask(void *args) {
+    VideoChannel *channel = static_cast<VideoChannel *>(args);
+    FrameQueue::Frame *frame;
+    while ((frame = channel->frameQueue.pop())) {
+        int64_t start = monotonicNs();
+        int64_t pushNs = frame->pushNs;
+        bool encoded = false;
+        pthread_mutex_lock(&channel->mutex);
+        // 编码器重新初始化之前入队的帧，大小可能已经不对了
+        if (frame->generation == channel->mFrameGeneration) {
+            channel->encodeData(reinterpret_cast<signed char *>(frame->data), pushNs);
+            encoded = true;
+        }
+        pthread_mutex_unlock(&channel->mutex);
+        channel->frameQueue.release(frame);
+        if (!encoded) {
+            continue;
+        }
+
+        int64_t end = monotonicNs();
+        channel->mEncodedFrames++;
+        channel->mEncodeNs += end - start;
+        channel->mQueueWaitNs += start - pushNs;
+        if (end - start > channel->mMaxEncodeNs) {
+            channel->mMaxEncodeNs = end - start;
+        }
+        if (channel->mEncodedFrames % VIDEO_STATS_FRAMES == 0) {
+            channel->logEncodeStats();
+        }
+    }
+    return nullptr;
+}
+
+void VideoChannel::logEncodeStats() {
+    if (!mEncodedFrames) {
+        return;
+    }
+    FrameQueue::Stats stats = frameQueue.getStats();
+    LOGE("视频编码 帧数:%llu 平均耗时:%.2fms 最长:%.2fms 平均排队:%.2fms 积压:%d 峰值:%d "
+         "丢弃:%llu 降帧跳过:%llu 每%d帧取1",
+         (unsigned long long) mEncodedFrames, mEncodeNs / 1e6 / mEncodedFrames, mMaxEncodeNs / 1e6,
+         mQueueWaitNs / 1e6 / mEncodedFrames, stats.depth, stats.maxDepth,
+         (unsigned long long) stats.dropped, (unsigned long long) stats.skipped,
+         stats.skipFactor ? stats.skipFactor : 1);
+}
+
 void VideoChannel::initVideoEncoder(int width, int height, int fps, int bitrate) {
     // 防止编码器多次创建 互斥锁
     pthread_mutex_lock(&mutex);
@@ -18,35 +147,51 @@ void VideoChannel::initVideoEncoder(int width, int height, int fps, int bitrate)
     mBitrate = bitrate;
 
     y_len = width * height;
-    uv_len = y_len / 4;
+    // 4:2:0 每 2x2 个像素一组色度，奇数宽高向上取整
+    uv_len = ((width + 1) / 2) * ((height + 1) / 2);
 
     // 防止重复初始化
     if (videoEncoder) {
         x264_encoder_close(videoEncoder);
         videoEncoder = nullptr;
     }
+    logOutputStats();
     if (pic_in) {
-        x264_picture_clean(pic_in);
+        if (pic_y) { // 只有 I420 模式的平面是 x264_picture_alloc 分配的
+            pic_in->img.plane[0] = pic_y;
+            x264_picture_clean(pic_in);
+            pic_y = nullptr;
+        }
         DELETE(pic_in)
     }
 
+    // x264 的 4:2:0 输入要求宽高都是偶数，奇数尺寸不开编码器，帧全部丢弃
+    if ((width | height) & 1) {
+        LOGE("x264 不支持奇数尺寸 %dx%d", width, height);
+        mFrameGeneration = frameQueue.configure(0);
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
     x264_param_t param;
 
     // 设置编码器属性
-    x264_param_default_preset(&param, "ultrafast", "zerolatency");
+    x264_param_default_preset(&param, "ultrafast", mZeroLatency ? "zerolatency" : nullptr);
 
     // 编码规格：https://wikipedia.tw.wjbk.site/wiki/H.264
     param.i_level_idc = 32; // 3.2 中等偏上的规格  自动用 码率，模糊程度，分辨率
 
-    param.i_csp = X264_CSP_I420;
+    // NV21 由 x264 内部（带汇编优化）拆分，省掉我们自己的一遍转换
+    param.i_csp = mInputMode == INPUT_NV21 ? X264_CSP_NV21 : X264_CSP_I420;
     param.i_width = width;
     param.i_height = height;
 
     // 不能有B帧，如果有B帧会影响编码、解码效率
     param.i_bframe = 0;
 
-    // 码率控制方式。CQP(恒定质量)，CRF(恒定码率)，ABR(平均码率)
-    param.rc.i_rc_method = X264_RC_CRF;
+    // 码率控制方式。CQP(恒定量化参数)，CRF(恒定质量)，ABR(平均码率)
+    // 推流时码率控制会随时改目标码率，CRF 不看 i_bitrate，只能用 ABR；x264_encoder_reconfig 不能切换方式
+    param.rc.i_rc_method = X264_RC_ABR;
 
     // 设置码率
     param.rc.i_bitrate = bitrate / 1000;
@@ -76,36 +221,119 @@ void VideoChannel::initVideoEncoder(int width, int height, int fps, int bitrate)
     // 是否复制sps和pps放在每个关键帧的前面 该参数设置是让每个关键帧(I帧)都附带sps/pps。
     param.b_repeat_headers = 1;
 
-    // 并行编码线程数
-    param.i_threads = 1;
+    // 并行编码线程数，按在线核心数决定
+    int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+    ThreadMode threadMode = mThreadMode;
+    if (threadMode == THREAD_AUTO) {
+        // 帧级多线程每多一个线程就多缓冲一帧，zerolatency 下用切片多线程
+        threadMode = mZeroLatency ? THREAD_SLICED : THREAD_FRAME;
+    }
+    int threads = mThreads > 0 ? mThreads : cores;
+    if (threadMode == THREAD_SLICED) {
+        if (!mThreads && threads > MAX_SLICE_THREADS) {
+            threads = MAX_SLICE_THREADS;
+        }
+        // 每个切片至少一行宏块
+        int mbRows = (height + 15) / 16;
+        if (threads > mbRows) {
+            threads = mbRows;
+        }
+    }
+    param.i_threads = threads;
+    param.b_sliced_threads = threadMode == THREAD_SLICED && threads > 1;
+    if (mSyncLookahead >= 0) {
+        param.i_sync_lookahead = mSyncLookahead;
+    } else {
+        // zerolatency 不允许 lookahead 缓冲帧
+        param.i_sync_lookahead = mZeroLatency ? 0 : X264_SYNC_LOOKAHEAD_AUTO;
+    }
 
-    x264_param_apply_profile(&param, "baseline");
+    // NAL 前面放 4 字节长度（AVCC），FLV 里直接用，不用再去起始码
+    param.b_annexb = 0;
 
-    pic_in = new x264_picture_t;
-    x264_picture_alloc(pic_in, param.i_csp, param.i_width, param.i_height);
+    // 帧级多线程不支持 nalu_process，其他情况让 x264 把 NAL 直接写进池化包的 body
+    mNalSink = !(param.i_threads > 1 && !param.b_sliced_threads)
+               && param.i_threads + 4 <= MAX_FRAME_NALS;
+    param.nalu_process = mNalSink ? NalSink::onNal : nullptr;
+
+    x264_param_apply_profile(&param, "baseline");
 
     videoEncoder = x264_encoder_open(&param);
-    if (videoEncoder) {
-        LOGE("x264编码器打开成功");
+    if (!videoEncoder && param.i_csp == X264_CSP_NV21) {
+        LOGE("x264 不接受 NV21 输入，退回 I420");
+        param.i_csp = X264_CSP_I420;
+        videoEncoder = x264_encoder_open(&param);
+    }
+    if (!videoEncoder) {
+        LOGE("x264编码器打开失败");
+        mFrameGeneration = frameQueue.configure(0);
+        pthread_mutex_unlock(&mutex);
+        return;
     }
+    LOGE("x264编码器打开成功 核心数:%d 线程数:%d 切片线程:%d sync_lookahead:%d 原地输出:%d",
+         cores, param.i_threads, param.b_sliced_threads, param.i_sync_lookahead, mNalSink);
+    mCsp = param.i_csp;
+    mKeyint = param.i_keyint_max;
+    mFramesSinceKey = 0;
+    memset(mPeak, 0, sizeof(mPeak));
+    memset(mPeakPrev, 0, sizeof(mPeakPrev));
+
+    pic_in = new x264_picture_t;
+    if (mCsp == X264_CSP_NV21) {
+        // 两个平面都直接指向相机数据，不需要分配
+        x264_picture_init(pic_in);
+        pic_in->img.i_csp = X264_CSP_NV21;
+        pic_in->img.i_plane = 2;
+        pic_in->img.i_stride[0] = width;
+        pic_in->img.i_stride[1] = width; // VU 交错，一行色度 width 个字节
+    } else {
+        x264_picture_alloc(pic_in, param.i_csp, param.i_width, param.i_height);
+        pic_y = pic_in->img.plane[0];
+    }
+    pic_in->opaque = &nalSink; // nalu_process 回调拿到的 opaque
+
+    // NV21 一帧 = Y + VU，之前排队的帧作废
+    mFrameGeneration = frameQueue.configure(y_len + uv_len * 2);
 
     pthread_mutex_unlock(&mutex);
 }
 
-void VideoChannel::encodeData(signed char *data) {
-    pthread_mutex_lock(&mutex);
-
-    // 把 nv21 的y分量转成 i420 的y分量
-    memcpy(pic_in->img.plane[0], data, y_len);
+void VideoChannel::encodeData(signed char *data, int64_t captureNs) {
+    // 编码线程调用，已经持有 mutex
+    if (!videoEncoder) {
+        return;
+    }
 
-    for (int i = 0; i < uv_len; ++i) {
-        // u 数据
-        // data + y_len + i * 2 + 1 : 移动指针取 data(nv21) 中 u 的数据
-        *(pic_in->img.plane[1] + i) = *(data + y_len + i * 2 + 1);
+    // nv21 和 i420 的y分量排列相同，x264_encoder_encode 会同步拷贝输入图像，
+    // 所以 Y 平面直接指向相机数据，不再 memcpy
+    pic_in->img.plane[0] = reinterpret_cast<uint8_t *>(data);
+
+    if (mCsp == X264_CSP_NV21) {
+        // VU 交错平面原样交给 x264
+        pic_in->img.plane[1] = reinterpret_cast<uint8_t *>(data) + y_len;
+    } else {
+        // nv21 的 VU 交错排列，拆成 i420 的 U、V 两个平面（NEON/SSE2 向量化）
+        deinterleaveVU(reinterpret_cast<uint8_t *>(data) + y_len,
+                       pic_in->img.plane[1], pic_in->img.plane[2], uv_len);
+    }
 
-        // v 数据
-        // data + y_len + i * 2 ： 移动指针取 data(nv21) 中 v 的数据
-        *(pic_in->img.plane[2] + i) = *(data + y_len + i * 2);
+    // 预测这一帧是不是关键帧（ultrafast 没有场景切换检测，关键帧按 keyint 出现），按同类帧的峰值给 body 容量
+    // pts 用采集时刻（毫秒），x264 原样带到输出帧上；两帧落在同一毫秒时往后挪，保证严格递增
+    int64_t pts = captureNs / 1000000;
+    if (pts <= mLastPts) {
+        pts = mLastPts + 1;
+    }
+    mLastPts = pts;
+    pic_in->i_pts = pts;
+
+    bool forceKey = mForceKeyFrame.exchange(false);
+    pic_in->i_type = forceKey ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    bool predictKey = forceKey || mFramesSinceKey == 0 || mFramesSinceKey >= mKeyint;
+    if (mNalSink) {
+        nalSink.begin(predictCapacity(predictKey), 5);
     }
 
     x264_nal_t *nal = nullptr; // 通过H.264编码得到NAL数组
@@ -121,7 +349,7 @@ void VideoChannel::encodeData(signed char *data) {
                                   &pic_out);
     if (ret < 0) { // 返回值：x264_encoder_encode函数 返回返回的 NAL 中的字节数。如果没有返回 NAL 单元，则在错误时返回负数和零。
         LOGE("x264编码失败");
-        pthread_mutex_unlock(&mutex); // 编码失败解锁，否则有概率性造成死锁了
+        nalSink.end();
         return;
     }
 
@@ -129,33 +357,44 @@ void VideoChannel::encodeData(signed char *data) {
     int sps_len, pps_len; // sps 和 pps 的长度
     uint8_t sps[100]; // 用于接收 sps 的数组定义
     uint8_t pps[100]; // 用于接收 pps 的数组定义
-    pic_in->i_pts += 1; // pts显示的时间（+=1 目的是每次都累加下去）， dts编码的时间
+    // 输出帧可能是之前输入的（帧线程、lookahead 有延迟），时间戳要用 pic_out 的
+    mOutDts = (uint32_t) pic_out.i_dts; // dts 解码的时间，pts 显示的时间
+    mOutCts = (int32_t) (pic_out.i_pts - pic_out.i_dts);
+
+    if (mNalSink) {
+        // 回调模式下 x264_encoder_encode 返回的 NAL 无效，用回调记录下来的
+        nal = nalSink.nals();
+        pi_nal = nalSink.count();
+    }
 
     for (int i = 0; i < pi_nal; ++i) {
         if (nal[i].i_type == NAL_SPS) {
-            sps_len = nal[i].i_payload - 4; // 去掉起始码
+            sps_len = nal[i].i_payload - 4; // 去掉 4 字节长度前缀
             memcpy(sps, nal[i].p_payload + 4, sps_len); // 由于上面减了4，所以+4挪动这里的位置开始
         } else if (nal[i].i_type == NAL_PPS) {
-            pps_len = nal[i].i_payload - 4; // 去掉起始码
+            pps_len = nal[i].i_payload - 4; // 去掉 4 字节长度前缀
             memcpy(pps, nal[i].p_payload + 4, pps_len); // 由于上面减了4，所以+4挪动这里的位置开始
 
             // sps + pps
             sendSpsPps(sps, pps, sps_len, pps_len); // pps是跟在sps后面的，这里拿到的pps表示前面的sps肯定拿到了
-        } else {
-            // 发送 I帧 P帧
-            sendFrame(nal[i].i_type, nal[i].i_payload, nal[i].p_payload);
         }
     }
 
-    pthread_mutex_unlock(&mutex);
+    // 发送 I帧 P帧：一次编码输出的其余 NAL（SEI、所有切片）合并成一个 FLV 视频 tag
+    if (mNalSink) {
+        sendSinkFrame(pic_out.b_keyframe);
+    } else {
+        sendFrame(nal, pi_nal);
+    }
+    if (ret > 0) {
+        mFramesSinceKey = pic_out.b_keyframe ? 1 : mFramesSinceKey + 1;
+    }
 }
 
 void VideoChannel::sendSpsPps(uint8_t *sps, uint8_t *pps, int sps_len, int pps_len) {
     int body_size = 5 + 8 + sps_len + 3 + pps_len;
 
-    RTMPPacket *packet = new RTMPPacket;
-
-    RTMPPacket_Alloc(packet, body_size);
+    RTMPPacket *packet = PacketPool::obtain(body_size);
 
     int i = 0;
     packet->m_body[i++] = 0x17;
@@ -196,7 +435,7 @@ void VideoChannel::sendSpsPps(uint8_t *sps, uint8_t *pps, int sps_len, int pps_l
     packet->m_packetType = RTMP_PACKET_TYPE_VIDEO;
     packet->m_nBodySize = body_size; // 设置好 sps+pps的总大小
     packet->m_nChannel = 0x10; // 通道ID，随便写一个，注意：不要写的和rtmp.c(里面的m_nChannel有冲突 4301行)
-    packet->m_nTimeStamp = 0; // sps pps 包 没有时间戳
+    packet->m_nTimeStamp = mOutDts; // 和紧跟着的关键帧同一个时间戳，时间戳不回退
     packet->m_hasAbsTimestamp = 0;
     packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
 
@@ -208,49 +447,113 @@ void VideoChannel::setVideoCallback(VideoCallback callback) {
     this->videoCallback = callback;
 }
 
-void VideoChannel::sendFrame(int type, int payload, uint8_t *pPayload) {
-    // 去掉起始码 00 00 00 01 或者 00 00 01
-    if (pPayload[2] == 0x00) { // 00 00 00 01
-        pPayload += 4; // 例如：共10个，挪动4个后，还剩6个
-        // 保证 我们的长度是和上的数据对应，也要是6个，所以-= 4
-        payload -= 4;
-    } else if (pPayload[2] == 0x01) { // 00 00 01
-        pPayload += 3; // 例如：共10个，挪动3个后，还剩7个
-        // 保证长度是和上的数据对应，也要是7个，所以-= 3
-        payload -= 3;
-    }
+void VideoChannel::setInputMode(InputMode mode) {
+    pthread_mutex_lock(&mutex);
+    mInputMode = mode;
+    pthread_mutex_unlock(&mutex);
+}
 
-    int body_size = 5 + 4 + payload;
+void VideoChannel::setThreadMode(ThreadMode mode, int threads, int syncLookahead) {
+    pthread_mutex_lock(&mutex);
+    mThreadMode = mode;
+    mThreads = threads;
+    mSyncLookahead = syncLookahead;
+    pthread_mutex_unlock(&mutex);
+}
 
-    RTMPPacket *packet = new RTMPPacket;
+void VideoChannel::setZeroLatency(bool zeroLatency) {
+    pthread_mutex_lock(&mutex);
+    mZeroLatency = zeroLatency;
+    pthread_mutex_unlock(&mutex);
+}
 
-    RTMPPacket_Alloc(packet, body_size);
+void VideoChannel::sendFrame(x264_nal_t *nals, int count) {
+    // 先算出整个访问单元的大小，b_annexb = 0 时每个 NAL 已经是 4 字节长度开头
+    int body_size = 5;
+    bool keyFrame = false;
+    bool hasSlice = false;
+    for (int n = 0; n < count; ++n) {
+        if (!inAccessUnit(nals[n].i_type)) {
+            continue;
+        }
+        body_size += nals[n].i_payload;
+        if (isSlice(nals[n].i_type)) {
+            hasSlice = true;
+        }
+        if (nals[n].i_type == NAL_SLICE_IDR) {
+            keyFrame = true;
+        }
+    }
+    if (!hasSlice) { // 没有图像数据（编码器还在缓冲，或者只有 SPS/PPS），不发只带 SEI 的 tag
+        return;
+    }
 
-    // 区分关键帧 和 非关键帧
-    packet->m_body[0] = 0x27; // 普通帧 非关键帧
-    if (type == NAL_SLICE_IDR) {
-        packet->m_body[0] = 0x17; // 关键帧
+    RTMPPacket *packet = PacketPool::obtain(body_size);
+
+    int i = 5;
+    for (int n = 0; n < count; ++n) {
+        if (!inAccessUnit(nals[n].i_type)) {
+            continue;
+        }
+        memcpy(&packet->m_body[i], nals[n].p_payload, nals[n].i_payload); // 拷贝H264的数据
+        i += nals[n].i_payload;
     }
 
-    packet->m_body[1] = 0x01; // 如果是1 帧类型（关键帧 非关键帧）， 如果是0一定是 sps pps
-    packet->m_body[2] = 0x00;
-    packet->m_body[3] = 0x00;
-    packet->m_body[4] = 0x00;
+    finishVideoPacket(packet, body_size, keyFrame, mOutDts, mOutCts);
 
-    packet->m_body[5] = (payload >> 24) & 0xFF;
-    packet->m_body[6] = (payload >> 16) & 0xFF;
-    packet->m_body[7] = (payload >> 8) & 0xFF;
-    packet->m_body[8] = payload & 0xFF;
+    // 把最终的 帧类型 RTMPPacket 存入队列
+    mCopiedFrames++;
+    videoCallback(packet);
+}
 
-    memcpy(&packet->m_body[9], pPayload, payload); // 拷贝H264的裸数据
+void VideoChannel::sendSinkFrame(bool keyFrame) {
+    int required = nalSink.required();
+    if (required <= 5) { // 编码器还在缓冲，没有输出
+        nalSink.end();
+        return;
+    }
 
-    packet->m_packetType = RTMP_PACKET_TYPE_VIDEO; // 包类型，是视频类型
-    packet->m_nBodySize = body_size; // 设置好 关键帧 或 普通帧 的总大小
-    packet->m_nChannel = 0x10; // 注意：不要写的和rtmp.c(里面的m_nChannel有冲突 4301行)
-    packet->m_nTimeStamp = -1; // 帧数据有时间戳
-    packet->m_hasAbsTimestamp = 0;
-    packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
+    // 记录同类帧需要的容量（x264 写每个 NAL 前要求留出余量），峰值按 GOP 滚动，码率降下来以后容量也跟着降
+    int need = required * 3 / 2 + 1024;
+    if (keyFrame) {
+        mPeakPrev[0] = mPeak[0];
+        mPeak[0] = 0;
+        mPeakPrev[1] = mPeak[1];
+        mPeak[1] = need;
+    } else if (need > mPeak[0]) {
+        mPeak[0] = need;
+    }
 
-    // 把最终的 帧类型 RTMPPacket 存入队列
+    if (!nalSink.inPlace()) {
+        // 切片乱序完成，或者预测的容量不够，按解码顺序拷贝拼装
+        sendFrame(nalSink.nals(), nalSink.count());
+        nalSink.end();
+        return;
+    }
+
+    // 所有 NAL 都已经按顺序写在 body 里，补上 tag 头就能发送
+    RTMPPacket *packet = nalSink.takePacket();
+    finishVideoPacket(packet, nalSink.bodySize(), keyFrame, mOutDts, mOutCts);
+    nalSink.end();
+    mInPlaceFrames++;
     videoCallback(packet);
-}
\ No newline at end of file
+}
+
+int VideoChannel::predictCapacity(bool keyFrame) {
+    int i = keyFrame ? 1 : 0;
+    int peak = mPeak[i] > mPeakPrev[i] ? mPeak[i] : mPeakPrev[i];
+    if (!peak) {
+        // 还没有统计，按一秒码率估计，关键帧再翻倍
+        peak = mBitrate / 8 / (mFps > 0 ? mFps : 1) * (keyFrame ? 8 : 2) + 4096;
+    }
+    return peak;
+}
+
+void VideoChannel::logOutputStats() {
+    if (mInPlaceFrames || mCopiedFrames) {
+        LOGE("x264 输出 原地:%llu 拷贝:%llu", (unsigned long long) mInPlaceFrames,
+             (unsigned long long) mCopiedFrames);
+    }
+    mInPlaceFrames = 0;
+    mCopiedFrames = 0;
+}
@@ -2,10 +2,14 @@
 #define MYRTMP_VIDEOCHANNEL_H
 
 #include <pthread.h>
+#include <atomic>
 #include <string.h>
 #include <x264.h>
 #include <rtmp.h>
 #include "util.h"
+#include "packet_pool.h"
+#include "nal_sink.h"
+#include "frame_queue.h"
 
 class VideoChannel {
 public:
@@ -13,6 +17,19 @@ public:
     ~VideoChannel();
 
     typedef void (*VideoCallback)(RTMPPacket *packet);
+
+    // 输入模式：NV21 原样交给 x264，或者先拆成 I420 再交给 x264（旧路径，兜底用）
+    enum InputMode {
+        INPUT_NV21 = 0,
+        INPUT_I420 = 1
+    };
+
+    // 并行编码方式：AUTO 按 zerolatency 选择，FRAME 帧级多线程，SLICED 切片多线程（不增加延迟）
+    enum ThreadMode {
+        THREAD_AUTO = 0,
+        THREAD_FRAME = 1,
+        THREAD_SLICED = 2
+    };
 private:
     pthread_mutex_t mutex;
     int mWidth;
@@ -23,18 +40,81 @@ private:
     int uv_len; // uv分量的长度
     x264_t *videoEncoder = 0; // x264编码器
     x264_picture_t *pic_in = 0;
+    uint8_t *pic_y = 0; // x264_picture_alloc 分配的 Y 平面，编码时 plane[0] 直接指向相机数据，清理前要还原
+    InputMode mInputMode = INPUT_NV21; // 期望的输入模式
+    int mCsp = X264_CSP_I420; // 编码器实际打开的输入格式
+    ThreadMode mThreadMode = THREAD_AUTO; // 期望的并行编码方式
+    int mThreads = 0; // 编码线程数，0 表示按在线核心数决定
+    int mSyncLookahead = -1; // 线程化 lookahead 的缓冲帧数，-1 表示自动
+    bool mZeroLatency = true; // 是否使用 zerolatency 调优
+    NalSink nalSink; // x264 通过 nalu_process 把 NAL 直接写进池化包
+    bool mNalSink = false; // 编码器是否打开了 nalu_process
+    int mKeyint = 0;
+    int mFramesSinceKey = 0; // 距离上一个关键帧的帧数，用来预测下一帧的类型
+    int mPeak[2] = {}; // 当前 GOP 内 普通帧/关键帧 需要的 body 容量峰值
+    int mPeakPrev[2] = {}; // 上一个 GOP 的峰值
+    uint64_t mInPlaceFrames = 0; // 直接在 x264 输出的包里发送的帧数
+    uint64_t mCopiedFrames = 0; // 拷贝拼装的帧数
+    FrameQueue frameQueue; // 相机回调线程和编码线程之间的原始帧队列
+    pthread_t pid_encode;
+    int mFrameGeneration = 0; // 当前编码器对应的帧队列 generation
+    std::atomic<bool> mForceKeyFrame{false}; // 发送端积压丢帧后请求关键帧
+    uint64_t mEncodedFrames = 0; // 编码线程处理过的帧数
+    int64_t mEncodeNs = 0; // 累计编码耗时
+    int64_t mMaxEncodeNs = 0; // 单帧最长编码耗时
+    int64_t mQueueWaitNs = 0; // 累计排队时间
+    int64_t mLastPts = -1; // 上一帧输入的 pts（毫秒）
+    uint32_t mOutDts = 0; // 当前输出帧的 dts（单调时钟毫秒，截断成 32 位）
+    int32_t mOutCts = 0; // 当前输出帧的 pts - dts
     VideoCallback videoCallback;
 
 public:
     void initVideoEncoder(int width, int height, int fps, int bitrate);
 
-    void encodeData(signed char *data);
+    /**
+     * 相机回调线程调用：拷贝一帧进队列就返回，编码在编码线程里做
+     */
+    void pushFrame(const uint8_t *data, int size);
+
+    // 积压超过 threshold 帧时的策略：丢最老的帧或者降低接收帧率
+    void setDropPolicy(FrameQueue::DropPolicy policy, int threshold);
+
+    // 编码线程调用，调用者持有 mutex，captureNs 是采集时刻（CLOCK_MONOTONIC）
+    void encodeData(signed char *data, int64_t captureNs);
+
+    void requestKeyFrame(); // 任意线程调用，下一帧强制编码成 IDR
+
+    // 码率控制：不重建编码器，用 x264_encoder_reconfig 改码率和 VBV（kbps）
+    void setBitrate(int kbps);
+
+    int getBitrate(); // initVideoEncoder 配置的码率 kbps
+
+    void setFrameDecimation(int factor); // 每 factor 帧编码一帧
 
     void sendSpsPps(uint8_t sps[100], uint8_t pps[100], int sps_len, int pps_len);
 
     void setVideoCallback(void (*callback)(RTMPPacket *));
 
-    void sendFrame(int type, int payload, uint8_t *payload1);
+    void setInputMode(InputMode mode); // 下一次 initVideoEncoder 生效
+
+    // threads 为 0 按在线核心数，syncLookahead 为 -1 自动，下一次 initVideoEncoder 生效
+    void setThreadMode(ThreadMode mode, int threads = 0, int syncLookahead = -1);
+
+    void setZeroLatency(bool zeroLatency); // 下一次 initVideoEncoder 生效
+
+    // 把一次 x264_encoder_encode 输出的 NAL 打包成一个 AVCC 格式的 FLV 视频 tag（跳过 SPS/PPS）
+    void sendFrame(x264_nal_t *nals, int count);
+
+private:
+    static void *encodeTask(void *args);
+
+    void logEncodeStats();
+
+    void sendSinkFrame(bool keyFrame);
+
+    int predictCapacity(bool keyFrame);
+
+    void logOutputStats();
 };
 
 #endif
@@ -0,0 +1,90 @@
+#include "abr_controller.h"
+
+// 积压超过这个媒体时长认为拥塞
+#define CONGESTED_QUEUE_MS 500
+// socket 缓冲里的字节超过这么多毫秒的吞吐量认为拥塞
+#define CONGESTED_SOCKET_MS 300
+// 连续这么多个周期不拥塞才往上探
+#define PROBE_INTERVALS 3
+// 降帧率最多到每几帧取一帧
+#define MAX_DECIMATION 4
+
+AbrController::AbrController(int maxBitrate, int audioBitrate)
+        : maxBitrate(maxBitrate), minBitrate(maxBitrate / 4), audioBitrate(audioBitrate),
+          target(maxBitrate) {
+    if (minBitrate < 100) {
+        minBitrate = maxBitrate < 100 ? maxBitrate : 100;
+    }
+    stats.minBitrate = target;
+}
+
+AbrController::Decision AbrController::update(const Sample &sample) {
+    Decision decision = {};
+    stats.samples++;
+
+    int throughput = sample.intervalMs ? (int) (sample.sentBytes * 8 / sample.intervalMs) : 0; // kbps
+    // 吞吐量有限时，socket 缓冲里积压的字节换算成时间
+    uint32_t socketMs = throughput > 0 ? (uint32_t) ((uint64_t) sample.socketQueued * 8 / throughput) : 0;
+    bool congested = sample.queuedMs > CONGESTED_QUEUE_MS
+                     || (throughput > 0 && socketMs > CONGESTED_SOCKET_MS);
+
+    int oldTarget = target;
+    int oldDecimation = decimation;
+
+    if (congested) {
+        clearIntervals = 0;
+        // 乘性减：降到当前的 70%，同时不超过实测吞吐量扣掉音频后的 90%
+        int next = target * 7 / 10;
+        int measured = (throughput - audioBitrate) * 9 / 10;
+        if (throughput > 0 && measured < next) {
+            next = measured;
+        }
+        if (next < minBitrate) {
+            next = minBitrate;
+            // 码率已经到底还拥塞，再降帧率
+            if (target == minBitrate && decimation < MAX_DECIMATION) {
+                decimation *= 2;
+            }
+        }
+        target = next;
+    } else if (++clearIntervals >= PROBE_INTERVALS) {
+        clearIntervals = 0;
+        if (decimation > 1) {
+            decimation /= 2; // 先恢复帧率再升码率
+        } else {
+            // 加性增：每次 +8%，至少 50kbps
+            int step = target * 8 / 100;
+            target += step < 50 ? 50 : step;
+            if (target > maxBitrate) {
+                target = maxBitrate;
+            }
+        }
+    }
+
+    if (target < oldTarget) {
+        stats.decreases++;
+    } else if (target > oldTarget) {
+        stats.increases++;
+    }
+    if (decimation != oldDecimation) {
+        stats.fpsSteps++;
+    }
+    if (target < stats.minBitrate) {
+        stats.minBitrate = target;
+    }
+
+    decision.bitrate = target;
+    decision.decimation = decimation;
+    decision.changed = target != oldTarget || decimation != oldDecimation;
+    decision.throughput = throughput;
+    decision.congested = congested;
+    return decision;
+}
+
+int AbrController::bitrate() {
+    return target;
+}
+
+AbrController::Stats AbrController::getStats() {
+    return stats;
+}
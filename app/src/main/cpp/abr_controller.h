@@ -0,0 +1,59 @@
+#ifndef MYRTMP_ABR_CONTROLLER_H
+#define MYRTMP_ABR_CONTROLLER_H
+
+#include <stdint.h>
+
+/**
+ * 自适应码率控制（AIMD）
+ * 推流线程每个周期喂一次采样：发送队列积压、socket 发送缓冲里没发出去的字节、这个周期实际发出的字节
+ * 不碰 socket 也不碰编码器，只给出决定，所以可以离线用吞吐量曲线回放测试
+ */
+class AbrController {
+public:
+    struct Sample {
+        uint32_t intervalMs; // 距离上一次采样的时间
+        uint32_t queuedMs; // 发送调度器里积压的媒体时长
+        uint32_t socketQueued; // SIOCOUTQ：内核发送缓冲里还没被确认的字节
+        uint64_t sentBytes; // 这个周期写进 socket 的字节
+        uint32_t rttMs; // TCP_INFO 的 rtt，只用于日志，取不到是 0
+    };
+
+    struct Decision {
+        int bitrate; // 目标视频码率 kbps
+        int decimation; // 每几帧编码一帧，1 表示不降帧率
+        bool changed; // 和上一次相比有变化，需要重新配置编码器
+        int throughput; // 这个周期测得的吞吐量 kbps
+        bool congested;
+    };
+
+    struct Stats {
+        uint64_t samples;
+        uint64_t decreases; // 降码率次数
+        uint64_t increases; // 升码率次数
+        uint64_t fpsSteps; // 帧率档位变化次数
+        int minBitrate; // 实际到达过的最低码率
+    };
+
+    /**
+     * maxBitrate 是配置的码率（kbps），最低降到 maxBitrate / 4
+     * audioBitrate 是音频大概占用的带宽，算视频可用带宽时扣掉
+     */
+    AbrController(int maxBitrate, int audioBitrate = 64);
+
+    Decision update(const Sample &sample);
+
+    int bitrate();
+
+    Stats getStats();
+
+private:
+    int maxBitrate;
+    int minBitrate;
+    int audioBitrate;
+    int target;
+    int decimation = 1;
+    int clearIntervals = 0; // 连续没有拥塞的周期数
+    Stats stats = {};
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "frame_queue.h"
+#include "media_clock.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 降帧率时最多每几帧接收一帧
+#define MAX_SKIP_FACTOR 4
+
+FrameQueue::FrameQueue(int capacity) : capacity(capacity), threshold(capacity - 1) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&cond, 0);
+    ready = new Frame *[capacity];
+    freeList = new Frame *[capacity + 2];
+    slots = new Frame[capacity + 2];
+    for (int i = 0; i < capacity + 2; ++i) {
+        slots[i].data = nullptr;
+        slots[i].size = 0;
+        slots[i].generation = 0;
+        freeList[freeCount++] = &slots[i];
+    }
+}
+
+FrameQueue::~FrameQueue() {
+    for (int i = 0; i < capacity + 2; ++i) {
+        free(slots[i].data);
+    }
+    delete[] slots;
+    delete[] freeList;
+    delete[] ready;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+int FrameQueue::configure(int size) {
+    pthread_mutex_lock(&mutex);
+    frameSize = size;
+    generation++;
+    while (count) {
+        putFree(ready[head]);
+        head = (head + 1) % capacity;
+        count--;
+    }
+    stats.depth = 0;
+    skipFactor = 1;
+    int gen = generation;
+    pthread_mutex_unlock(&mutex);
+    return gen;
+}
+
+void FrameQueue::setPolicy(DropPolicy dropPolicy, int dropThreshold) {
+    pthread_mutex_lock(&mutex);
+    policy = dropPolicy;
+    threshold = dropThreshold < 1 ? 1 : dropThreshold;
+    skipFactor = 1;
+    pthread_mutex_unlock(&mutex);
+}
+
+void FrameQueue::setDecimation(int factor) {
+    pthread_mutex_lock(&mutex);
+    decimation = factor < 1 ? 1 : factor;
+    pthread_mutex_unlock(&mutex);
+}
+
+bool FrameQueue::push(const uint8_t *data, int size) {
+    pthread_mutex_lock(&mutex);
+    if (stopped || !frameSize || size < frameSize) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    if (policy == REDUCE_FPS) {
+        if (count >= threshold && skipFactor < MAX_SKIP_FACTOR) {
+            skipFactor *= 2;
+        } else if (count == 0 && skipFactor > 1) {
+            skipFactor /= 2;
+        }
+    }
+    // 外部（码率控制）要求的降帧和积压引起的降帧取大的
+    int factor = skipFactor > decimation ? skipFactor : decimation;
+    stats.skipFactor = factor;
+    if (factor > 1 && sequence++ % factor) {
+        stats.skipped++;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    Frame *frame = takeFree();
+    if (!frame) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    int gen = generation;
+    int need = frameSize;
+    pthread_mutex_unlock(&mutex);
+
+    // 拷贝在锁外做，编码线程 pop/release 不会被一帧的拷贝挡住
+    if (frame->size != need) {
+        free(frame->data);
+        frame->data = static_cast<uint8_t *>(malloc(need));
+        frame->size = frame->data ? need : 0;
+    }
+    if (frame->data) {
+        memcpy(frame->data, data, need);
+    }
+    frame->generation = gen;
+    frame->pushNs = monotonicNs();
+
+    pthread_mutex_lock(&mutex);
+    if (!frame->data || gen != generation || stopped) {
+        putFree(frame);
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    if (count == capacity) { // 满了，丢掉最老的一帧
+        putFree(ready[head]);
+        head = (head + 1) % capacity;
+        count--;
+        stats.dropped++;
+    }
+    ready[(head + count) % capacity] = frame;
+    count++;
+    stats.pushed++;
+    stats.depth = count;
+    if (count > stats.maxDepth) {
+        stats.maxDepth = count;
+    }
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+FrameQueue::Frame *FrameQueue::pop() {
+    pthread_mutex_lock(&mutex);
+    while (!count && !stopped) {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    Frame *frame = nullptr;
+    if (count) {
+        frame = ready[head];
+        head = (head + 1) % capacity;
+        count--;
+        stats.depth = count;
+    }
+    pthread_mutex_unlock(&mutex);
+    return frame;
+}
+
+void FrameQueue::release(Frame *frame) {
+    if (!frame) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    putFree(frame);
+    pthread_mutex_unlock(&mutex);
+}
+
+void FrameQueue::stop() {
+    pthread_mutex_lock(&mutex);
+    stopped = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+FrameQueue::Stats FrameQueue::getStats() {
+    pthread_mutex_lock(&mutex);
+    Stats copy = stats;
+    pthread_mutex_unlock(&mutex);
+    return copy;
+}
+
+FrameQueue::Frame *FrameQueue::takeFree() {
+    // capacity 个排队 + 写入中 + 编码中，只有一个写入线程时这里一定还有空闲的
+    if (!freeCount) {
+        if (!count) {
+            return nullptr;
+        }
+        Frame *oldest = ready[head];
+        head = (head + 1) % capacity;
+        count--;
+        stats.dropped++;
+        return oldest;
+    }
+    return freeList[--freeCount];
+}
+
+void FrameQueue::putFree(Frame *frame) {
+    freeList[freeCount++] = frame;
+}
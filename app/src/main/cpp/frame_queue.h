@@ -0,0 +1,84 @@
+#ifndef MYRTMP_FRAME_QUEUE_H
+#define MYRTMP_FRAME_QUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * 待编码的原始视频帧队列（有界）
+ * 相机回调线程 push 拷一份进空闲槽位立即返回，视频编码线程 pop 出最老的一帧编码
+ * 积压超过阈值时按策略丢最老的帧，或者降低接收帧率
+ */
+class FrameQueue {
+public:
+    enum DropPolicy {
+        DROP_OLDEST = 0, // 队列满了覆盖最老的帧
+        REDUCE_FPS = 1 // 积压超过阈值时隔帧接收，积压消失后恢复，队列满了仍然丢最老的
+    };
+
+    struct Frame {
+        uint8_t *data;
+        int size; // data 的容量
+        int generation; // configure 的次数，帧大小变了以后旧帧作废
+        int64_t pushNs; // 入队时间（CLOCK_MONOTONIC），相机回调里入队，也作为采集时刻
+    };
+
+    struct Stats {
+        uint64_t pushed; // 进入队列的帧数
+        uint64_t dropped; // 队列满了被丢掉的最老帧数
+        uint64_t skipped; // 降帧率跳过的帧数
+        int depth; // 当前积压帧数
+        int maxDepth; // 积压峰值
+        int skipFactor; // 当前每几帧接收一帧
+    };
+
+    explicit FrameQueue(int capacity = 3);
+
+    ~FrameQueue();
+
+    // 帧大小变了（initVideoEncoder），积压的旧帧全部作废，返回新的 generation
+    int configure(int frameSize);
+
+    void setPolicy(DropPolicy policy, int threshold);
+
+    // 每 factor 帧只接收一帧（码率控制降帧率用），1 表示全部接收
+    void setDecimation(int factor);
+
+    // 拷贝一帧入队，返回 false 表示被跳过（没配置、大小不对、降帧率）
+    bool push(const uint8_t *data, int size);
+
+    // 阻塞直到有帧或者 stop，取到的帧用完必须 release
+    Frame *pop();
+
+    void release(Frame *frame);
+
+    void stop();
+
+    Stats getStats();
+
+private:
+    Frame *takeFree(); // 调用者持锁
+
+    void putFree(Frame *frame); // 调用者持锁
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int capacity;
+    Frame **ready; // 环形数组，最老的在 head
+    int head = 0;
+    int count = 0;
+    Frame **freeList; // 空闲槽位
+    int freeCount = 0;
+    Frame *slots; // 全部槽位：capacity 个排队 + 1 个写入中 + 1 个编码中
+    int frameSize = 0;
+    int generation = 0;
+    bool stopped = false;
+    DropPolicy policy = DROP_OLDEST;
+    int threshold; // REDUCE_FPS 开始降帧的积压帧数
+    int skipFactor = 1;
+    int decimation = 1;
+    uint64_t sequence = 0;
+    Stats stats = {};
+};
+
+#endif
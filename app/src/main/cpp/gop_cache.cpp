@@ -0,0 +1,145 @@
+#include "gop_cache.h"
+#include "packet_pool.h"
+#include <string.h>
+
+// 视频 tag 第一个字节高 4 位是帧类型：1 关键帧，2 普通帧；第二个字节 0 是 sequence header
+static bool isSequenceHeader(const RTMPPacket *packet) {
+    return packet->m_nBodySize >= 2 && packet->m_body[1] == 0x00;
+}
+
+static bool isKeyFrame(const RTMPPacket *packet) {
+    return (packet->m_body[0] & 0xF0) == 0x10;
+}
+
+GopCache::GopCache(int maxBytes) : maxBytes(maxBytes) {
+}
+
+GopCache::~GopCache() {
+    clear();
+}
+
+RTMPPacket *GopCache::copy(const RTMPPacket *packet) {
+    RTMPPacket *out = PacketPool::obtain(packet->m_nBodySize);
+    if (!out) {
+        return nullptr;
+    }
+    memcpy(out->m_body, packet->m_body, packet->m_nBodySize);
+    out->m_packetType = packet->m_packetType;
+    out->m_nBodySize = packet->m_nBodySize;
+    out->m_nChannel = packet->m_nChannel;
+    out->m_headerType = packet->m_headerType;
+    out->m_nTimeStamp = packet->m_nTimeStamp;
+    out->m_hasAbsTimestamp = packet->m_hasAbsTimestamp;
+    return out;
+}
+
+void GopCache::setHeader(RTMPPacket **header, const RTMPPacket *packet) {
+    if (*header) {
+        PacketPool::recycle(*header);
+    }
+    *header = copy(packet);
+}
+
+void GopCache::add(const RTMPPacket *packet) {
+    if (packet->m_nBodySize < 2) {
+        return;
+    }
+    if (packet->m_packetType == RTMP_PACKET_TYPE_AUDIO) {
+        if (isSequenceHeader(packet)) {
+            setHeader(&audioHeader, packet);
+        }
+        return;
+    }
+    if (packet->m_packetType != RTMP_PACKET_TYPE_VIDEO) {
+        return;
+    }
+    if (isSequenceHeader(packet)) {
+        setHeader(&videoHeader, packet);
+        return;
+    }
+
+    if (isKeyFrame(packet)) {
+        clearFrames(); // 新的 GOP 开始
+        frozen = false;
+    } else if (frozen) {
+        return;
+    }
+    if (stats.bytes + (int) packet->m_nBodySize > maxBytes) {
+        // 放不下整个 GOP，回放半个 GOP 没有意义
+        clearFrames();
+        frozen = true;
+        stats.overflows++;
+        return;
+    }
+    RTMPPacket *frame = copy(packet);
+    if (!frame) {
+        clearFrames();
+        frozen = true;
+        return;
+    }
+    frames.push_back(frame);
+    stats.bytes += packet->m_nBodySize;
+    stats.frames++;
+    stats.cachedFrames++;
+}
+
+void GopCache::freeze() {
+    frozen = true;
+}
+
+bool GopCache::replay(std::vector<RTMPPacket *> &out, uint32_t *keyFrameTime) {
+    bool gop = videoHeader && !frames.empty();
+    if (audioHeader) {
+        out.push_back(copy(audioHeader));
+    }
+    if (videoHeader) {
+        out.push_back(copy(videoHeader));
+    }
+    if (gop) {
+        *keyFrameTime = frames.front()->m_nTimeStamp;
+        for (RTMPPacket *frame : frames) {
+            out.push_back(copy(frame));
+        }
+    }
+    // 分配失败就整个不回放，缺帧的 GOP 解不出来
+    for (RTMPPacket *packet : out) {
+        if (!packet) {
+            for (RTMPPacket *p : out) {
+                PacketPool::recycle(p);
+            }
+            out.clear();
+            return false;
+        }
+    }
+    return gop;
+}
+
+bool GopCache::isFrozen() {
+    return frozen;
+}
+
+void GopCache::clearFrames() {
+    for (RTMPPacket *frame : frames) {
+        PacketPool::recycle(frame);
+    }
+    frames.clear();
+    stats.frames = 0;
+    stats.bytes = 0;
+}
+
+void GopCache::clear() {
+    clearFrames();
+    if (videoHeader) {
+        PacketPool::recycle(videoHeader);
+        videoHeader = nullptr;
+    }
+    if (audioHeader) {
+        PacketPool::recycle(audioHeader);
+        audioHeader = nullptr;
+    }
+    frozen = true;
+}
+
+GopCache::Stats GopCache::getStats() {
+    return stats;
+}
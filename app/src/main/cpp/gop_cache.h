@@ -0,0 +1,64 @@
+#ifndef MYRTMP_GOP_CACHE_H
+#define MYRTMP_GOP_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+#include <rtmp.h>
+
+/**
+ * 最近一个 GOP 的缓存，断线重连后先回放它，观众不用等下一个关键帧
+ * 保存最新的视频/音频 sequence header，以及最后一个关键帧和它后面的视频帧
+ * 只在推流线程里使用，包都是从 PacketPool 拷贝出来的，不占用发送中的包
+ */
+class GopCache {
+public:
+    struct Stats {
+        uint64_t cachedFrames; // 进过缓存的视频帧数
+        uint64_t overflows; // GOP 太大放不下，丢掉缓存的次数
+        int frames; // 当前缓存的视频帧数
+        int bytes; // 当前缓存的字节数
+    };
+
+    // maxBytes 是缓存的 GOP 的上限，超过就丢掉整个 GOP 等下一个关键帧
+    explicit GopCache(int maxBytes);
+
+    ~GopCache();
+
+    // 包还带着原始时间戳时调用，只拷贝需要缓存的包
+    void add(const RTMPPacket *packet);
+
+    /**
+     * 丢帧或断线之后调用：当前 GOP 后面的帧接不上了，缓存保持不变，
+     * 后面的非关键帧都不要，直到下一个关键帧开始新的 GOP
+     */
+    void freeze();
+
+    /**
+     * 按发送顺序拷贝出要回放的包：音频 header、视频 header、关键帧及后续帧
+     * 有可回放的 GOP 时返回 true 并给出关键帧的时间戳，否则只拷贝出 header
+     */
+    bool replay(std::vector<RTMPPacket *> &out, uint32_t *keyFrameTime);
+
+    // 缓存的 GOP 后面还有没缓存的帧，回放之后直播的非关键帧接不上
+    bool isFrozen();
+
+    void clear();
+
+    Stats getStats();
+
+private:
+    static RTMPPacket *copy(const RTMPPacket *packet);
+
+    void setHeader(RTMPPacket **header, const RTMPPacket *packet);
+
+    void clearFrames();
+
+    int maxBytes;
+    RTMPPacket *videoHeader = nullptr;
+    RTMPPacket *audioHeader = nullptr;
+    std::vector<RTMPPacket *> frames; // 第一个是关键帧
+    bool frozen = true; // 还没有关键帧，或者 GOP 已经断了
+    Stats stats = {};
+};
+
+#endif
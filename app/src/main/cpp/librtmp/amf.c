@@ -35,6 +35,16 @@
 static const AMFObjectProperty AMFProp_Invalid = { {0, 0}, AMF_INVALID };
 static const AVal AV_empty = { 0, 0 };
 
+/* the decoders below take an arena; NULL means plain heap allocations */
+static int AMF_DecodeIn(AMFObject *obj, const char *pBuffer, int nSize,
+			int bDecodeName, AMFArena *arena);
+static int AMF_DecodeArrayIn(AMFObject *obj, const char *pBuffer, int nSize,
+			     int nArrayLen, int bDecodeName, AMFArena *arena);
+static int AMF3_DecodeIn(AMFObject *obj, const char *pBuffer, int nSize,
+			 int bAMFData, AMFArena *arena);
+static int AMF_AddPropIn(AMFObject *obj, const AMFObjectProperty *prop,
+			 AMFArena *arena);
+
 /* Data is Big-Endian */
 unsigned short
 AMF_DecodeInt16(const char *data)
@@ -172,8 +182,7 @@ AMF_EncodeInt32(char *output, char *outend, int nVal)
 char *
 AMF_EncodeString(char *output, char *outend, const AVal *bv)
 {
-  if ((bv->av_len < 65536 && output + 1 + 2 + bv->av_len > outend) ||
-	output + 1 + 4 + bv->av_len > outend)
+  if (output + 1 + (bv->av_len < 65536 ? 2 : 4) + bv->av_len > outend)
     return NULL;
 
   if (bv->av_len < 65536)
@@ -361,10 +370,11 @@ AMFProp_Encode(AMFObjectProperty *prop, char *pBuffer, char *pBufEnd)
   if (prop->p_type == AMF_INVALID)
     return NULL;
 
-  if (prop->p_type != AMF_NULL && pBuffer + prop->p_name.av_len + 2 + 1 >= pBufEnd)
+  if (pBuffer + (prop->p_name.av_len ? 2 + prop->p_name.av_len : 0) + 1 > pBufEnd)
     return NULL;
 
-  if (prop->p_type != AMF_NULL && prop->p_name.av_len)
+  /* a NULL member of an object still needs its name */
+  if (prop->p_name.av_len)
     {
       *pBuffer++ = prop->p_name.av_len >> 8;
       *pBuffer++ = prop->p_name.av_len & 0xff;
@@ -387,7 +397,7 @@ AMFProp_Encode(AMFObjectProperty *prop, char *pBuffer, char *pBufEnd)
       break;
 
     case AMF_NULL:
-      if (pBuffer+1 >= pBufEnd)
+      if (pBuffer+1 > pBufEnd)
         return NULL;
       *pBuffer++ = AMF_NULL;
       break;
@@ -477,9 +487,9 @@ AMF3ReadString(const char *data, AVal *str)
   return len;
 }
 
-int
-AMF3Prop_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
-		int bDecodeName)
+static int
+AMF3Prop_DecodeIn(AMFObjectProperty *prop, const char *pBuffer, int nSize,
+		  int bDecodeName, AMFArena *arena)
 {
   int nOriginalSize = nSize;
   AMF3DataType type;
@@ -576,7 +586,8 @@ AMF3Prop_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF3_OBJECT:
       {
-	int nRes = AMF3_Decode(&prop->p_vu.p_object, pBuffer, nSize, TRUE);
+	int nRes = AMF3_DecodeIn(&prop->p_vu.p_object, pBuffer, nSize, TRUE,
+				 arena);
 	if (nRes == -1)
 	  return -1;
 	nSize -= nRes;
@@ -595,8 +606,15 @@ AMF3Prop_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
 }
 
 int
-AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
-	       int bDecodeName)
+AMF3Prop_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
+		int bDecodeName)
+{
+  return AMF3Prop_DecodeIn(prop, pBuffer, nSize, bDecodeName, NULL);
+}
+
+static int
+AMFProp_DecodeIn(AMFObjectProperty *prop, const char *pBuffer, int nSize,
+		 int bDecodeName, AMFArena *arena)
 {
   int nOriginalSize = nSize;
   int nRes;
@@ -658,8 +676,11 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       break;
     case AMF_STRING:
       {
-	unsigned short nStringSize = AMF_DecodeInt16(pBuffer);
+	unsigned short nStringSize;
 
+	if (nSize < 2)
+	  return -1;
+	nStringSize = AMF_DecodeInt16(pBuffer);
 	if (nSize < (long)nStringSize + 2)
 	  return -1;
 	AMF_DecodeString(pBuffer, &prop->p_vu.p_aval);
@@ -668,7 +689,8 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF_OBJECT:
       {
-	int nRes = AMF_Decode(&prop->p_vu.p_object, pBuffer, nSize, TRUE);
+	int nRes = AMF_DecodeIn(&prop->p_vu.p_object, pBuffer, nSize, TRUE,
+				arena);
 	if (nRes == -1)
 	  return -1;
 	nSize -= nRes;
@@ -693,10 +715,13 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF_ECMA_ARRAY:
       {
+	if (nSize < 4)
+	  return -1;
 	nSize -= 4;
 
 	/* next comes the rest, mixed array has a final 0x000009 mark and names, so its an object */
-	nRes = AMF_Decode(&prop->p_vu.p_object, pBuffer + 4, nSize, TRUE);
+	nRes = AMF_DecodeIn(&prop->p_vu.p_object, pBuffer + 4, nSize, TRUE,
+			    arena);
 	if (nRes == -1)
 	  return -1;
 	nSize -= nRes;
@@ -710,11 +735,15 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF_STRICT_ARRAY:
       {
-	unsigned int nArrayLen = AMF_DecodeInt32(pBuffer);
+	unsigned int nArrayLen;
+
+	if (nSize < 4)
+	  return -1;
+	nArrayLen = AMF_DecodeInt32(pBuffer);
 	nSize -= 4;
 
-	nRes = AMF_DecodeArray(&prop->p_vu.p_object, pBuffer + 4, nSize,
-				   nArrayLen, FALSE);
+	nRes = AMF_DecodeArrayIn(&prop->p_vu.p_object, pBuffer + 4, nSize,
+				 nArrayLen, FALSE, arena);
 	if (nRes == -1)
 	  return -1;
 	nSize -= nRes;
@@ -736,7 +765,11 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF_LONG_STRING:
       {
-	unsigned int nStringSize = AMF_DecodeInt32(pBuffer);
+	unsigned int nStringSize;
+
+	if (nSize < 4)
+	  return -1;
+	nStringSize = AMF_DecodeInt32(pBuffer);
 	if (nSize < (long)nStringSize + 4)
 	  return -1;
 	AMF_DecodeLongString(pBuffer, &prop->p_vu.p_aval);
@@ -764,7 +797,8 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
       }
     case AMF_AVMPLUS:
       {
-	int nRes = AMF3_Decode(&prop->p_vu.p_object, pBuffer, nSize, TRUE);
+	int nRes = AMF3_DecodeIn(&prop->p_vu.p_object, pBuffer, nSize, TRUE,
+				 arena);
 	if (nRes == -1)
 	  return -1;
 	nSize -= nRes;
@@ -780,6 +814,13 @@ AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
   return nOriginalSize - nSize;
 }
 
+int
+AMFProp_Decode(AMFObjectProperty *prop, const char *pBuffer, int nSize,
+	       int bDecodeName)
+{
+  return AMFProp_DecodeIn(prop, pBuffer, nSize, bDecodeName, NULL);
+}
+
 void
 AMFProp_Dump(AMFObjectProperty *prop)
 {
@@ -864,7 +905,7 @@ AMF_Encode(AMFObject *obj, char *pBuffer, char *pBufEnd)
 {
   int i;
 
-  if (pBuffer+4 >= pBufEnd)
+  if (pBuffer+4 > pBufEnd)
     return NULL;
 
   *pBuffer++ = AMF_OBJECT;
@@ -884,7 +925,7 @@ AMF_Encode(AMFObject *obj, char *pBuffer, char *pBufEnd)
 	}
     }
 
-  if (pBuffer + 3 >= pBufEnd)
+  if (pBuffer + 3 > pBufEnd)
     return NULL;			/* no room for the end marker */
 
   pBuffer = AMF_EncodeInt24(pBuffer, pBufEnd, AMF_OBJECT_END);
@@ -893,8 +934,50 @@ AMF_Encode(AMFObject *obj, char *pBuffer, char *pBufEnd)
 }
 
 int
-AMF_DecodeArray(AMFObject *obj, const char *pBuffer, int nSize,
-		int nArrayLen, int bDecodeName)
+AMF_EncodedSize(const AMFObject *obj)
+{
+  int i, nSize = 1 + 3;		/* type and end marker */
+
+  for (i = 0; i < obj->o_num; i++)
+    {
+      int nRes = AMFProp_EncodedSize(&obj->o_props[i]);
+      if (nRes == -1)
+	return -1;
+      nSize += nRes;
+    }
+  return nSize;
+}
+
+int
+AMFProp_EncodedSize(const AMFObjectProperty *prop)
+{
+  int nSize = 0, nRes;
+
+  if (prop->p_name.av_len)
+    nSize = 2 + prop->p_name.av_len;
+
+  switch (prop->p_type)
+    {
+    case AMF_NUMBER:
+      return nSize + 1 + 8;
+    case AMF_BOOLEAN:
+      return nSize + 1 + 1;
+    case AMF_STRING:
+      return nSize + (prop->p_vu.p_aval.av_len < 65536 ? 1 + 2 : 1 + 4) +
+	prop->p_vu.p_aval.av_len;
+    case AMF_NULL:
+      return nSize + 1;
+    case AMF_OBJECT:
+      nRes = AMF_EncodedSize(&prop->p_vu.p_object);
+      return nRes == -1 ? -1 : nSize + nRes;
+    default:
+      return -1;
+    }
+}
+
+static int
+AMF_DecodeArrayIn(AMFObject *obj, const char *pBuffer, int nSize,
+		  int nArrayLen, int bDecodeName, AMFArena *arena)
 {
   int nOriginalSize = nSize;
   int bError = FALSE;
@@ -907,24 +990,36 @@ AMF_DecodeArray(AMFObject *obj, const char *pBuffer, int nSize,
       int nRes;
       nArrayLen--;
 
-      nRes = AMFProp_Decode(&prop, pBuffer, nSize, bDecodeName);
-      if (nRes == -1)
-	bError = TRUE;
-      else
+      nRes = AMFProp_DecodeIn(&prop, pBuffer, nSize, bDecodeName, arena);
+      if (nRes == -1 || !AMF_AddPropIn(obj, &prop, arena))
 	{
-	  nSize -= nRes;
-	  pBuffer += nRes;
-	  AMF_AddProp(obj, &prop);
+	  /* the count comes from the wire, don't spin on a bogus one */
+	  bError = TRUE;
+	  break;
 	}
+      nSize -= nRes;
+      pBuffer += nRes;
     }
   if (bError)
-    return -1;
+    {
+      if (!arena)
+	AMF_Reset(obj);
+      return -1;
+    }
 
   return nOriginalSize - nSize;
 }
 
 int
-AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
+AMF_DecodeArray(AMFObject *obj, const char *pBuffer, int nSize,
+		int nArrayLen, int bDecodeName)
+{
+  return AMF_DecodeArrayIn(obj, pBuffer, nSize, nArrayLen, bDecodeName, NULL);
+}
+
+static int
+AMF3_DecodeIn(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData,
+	      AMFArena *arena)
 {
   int nOriginalSize = nSize;
   int32_t ref;
@@ -968,12 +1063,13 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
       else
 	{
 	  int32_t classExtRef = (classRef >> 1);
-	  int i;
+	  int i, nMembers;
 
 	  cd.cd_externalizable = (classExtRef & 0x1) == 1;
 	  cd.cd_dynamic = ((classExtRef >> 1) & 0x1) == 1;
 
-	  cd.cd_num = classExtRef >> 2;
+	  /* AMF3CD_AddProp counts cd_num up from 0 */
+	  nMembers = classExtRef >> 2;
 
 	  /* class name */
 
@@ -986,9 +1082,9 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
 	  RTMP_Log(RTMP_LOGDEBUG,
 	      "Class name: %s, externalizable: %d, dynamic: %d, classMembers: %d",
 	      cd.cd_name.av_val, cd.cd_externalizable, cd.cd_dynamic,
-	      cd.cd_num);
+	      nMembers);
 
-	  for (i = 0; i < cd.cd_num; i++)
+	  for (i = 0; i < nMembers; i++)
 	    {
 	      AVal memberName;
 	      len = AMF3ReadString(pBuffer, &memberName);
@@ -1008,7 +1104,7 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
 
 	  RTMP_Log(RTMP_LOGDEBUG, "Externalizable, TODO check");
 
-	  nRes = AMF3Prop_Decode(&prop, pBuffer, nSize, FALSE);
+	  nRes = AMF3Prop_DecodeIn(&prop, pBuffer, nSize, FALSE, arena);
 	  if (nRes == -1)
 	    RTMP_Log(RTMP_LOGDEBUG, "%s, failed to decode AMF3 property!",
 		__FUNCTION__);
@@ -1019,20 +1115,20 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
 	    }
 
 	  AMFProp_SetName(&prop, &name);
-	  AMF_AddProp(obj, &prop);
+	  AMF_AddPropIn(obj, &prop, arena);
 	}
       else
 	{
 	  int nRes, i;
 	  for (i = 0; i < cd.cd_num; i++)	/* non-dynamic */
 	    {
-	      nRes = AMF3Prop_Decode(&prop, pBuffer, nSize, FALSE);
+	      nRes = AMF3Prop_DecodeIn(&prop, pBuffer, nSize, FALSE, arena);
 	      if (nRes == -1)
 		RTMP_Log(RTMP_LOGDEBUG, "%s, failed to decode AMF3 property!",
 		    __FUNCTION__);
 
 	      AMFProp_SetName(&prop, AMF3CD_GetProp(&cd, i));
-	      AMF_AddProp(obj, &prop);
+	      AMF_AddPropIn(obj, &prop, arena);
 
 	      pBuffer += nRes;
 	      nSize -= nRes;
@@ -1043,8 +1139,8 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
 
 	      do
 		{
-		  nRes = AMF3Prop_Decode(&prop, pBuffer, nSize, TRUE);
-		  AMF_AddProp(obj, &prop);
+		  nRes = AMF3Prop_DecodeIn(&prop, pBuffer, nSize, TRUE, arena);
+		  AMF_AddPropIn(obj, &prop, arena);
 
 		  pBuffer += nRes;
 		  nSize -= nRes;
@@ -1054,13 +1150,22 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
 	      while (len > 0);
 	    }
 	}
+      /* member names point into pBuffer, only the table is ours */
+      free(cd.cd_props);
       RTMP_Log(RTMP_LOGDEBUG, "class object!");
     }
   return nOriginalSize - nSize;
 }
 
 int
-AMF_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bDecodeName)
+AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
+{
+  return AMF3_DecodeIn(obj, pBuffer, nSize, bAMFData, NULL);
+}
+
+static int
+AMF_DecodeIn(AMFObject *obj, const char *pBuffer, int nSize, int bDecodeName,
+	     AMFArena *arena)
 {
   int nOriginalSize = nSize;
   int bError = FALSE;		/* if there is an error while decoding - try to at least find the end mark AMF_OBJECT_END */
@@ -1088,23 +1193,224 @@ AMF_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bDecodeName)
 	  continue;
 	}
 
-      nRes = AMFProp_Decode(&prop, pBuffer, nSize, bDecodeName);
+      nRes = AMFProp_DecodeIn(&prop, pBuffer, nSize, bDecodeName, arena);
       if (nRes == -1)
 	bError = TRUE;
       else
 	{
 	  nSize -= nRes;
 	  pBuffer += nRes;
-	  AMF_AddProp(obj, &prop);
+	  if (!AMF_AddPropIn(obj, &prop, arena))
+	    {
+	      if (prop.p_type == AMF_OBJECT && !arena)
+		AMF_Reset(&prop.p_vu.p_object);
+	      bError = TRUE;
+	      break;
+	    }
 	}
     }
 
+  /* callers only reset what decoded fine, so don't leave a partial tree */
   if (bError)
-    return -1;
+    {
+      if (!arena)
+	AMF_Reset(obj);
+      return -1;
+    }
+
+  return nOriginalSize - nSize;
+}
+
+int
+AMF_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bDecodeName)
+{
+  return AMF_DecodeIn(obj, pBuffer, nSize, bDecodeName, NULL);
+}
+
+int
+AMF_DecodeArena(AMFObject *obj, const char *pBuffer, int nSize,
+		int bDecodeName, AMFArena *arena)
+{
+  return AMF_DecodeIn(obj, pBuffer, nSize, bDecodeName, arena);
+}
+
+/* object members up to and including the end marker */
+static int
+AMF_SkipMembers(const char *pBuffer, int nSize)
+{
+  int nOriginalSize = nSize;
 
+  while (nSize > 0)
+    {
+      int nRes;
+
+      if (nSize >= 3 && AMF_DecodeInt24(pBuffer) == AMF_OBJECT_END)
+	return nOriginalSize - nSize + 3;
+
+      nRes = AMFProp_Skip(pBuffer, nSize, TRUE);
+      if (nRes == -1)
+	return -1;
+      nSize -= nRes;
+      pBuffer += nRes;
+    }
+  /* AMF_Decode also accepts an object cut short by the end of data */
   return nOriginalSize - nSize;
 }
 
+int
+AMFProp_Skip(const char *pBuffer, int nSize, int bDecodeName)
+{
+  int nOriginalSize = nSize;
+  unsigned int nLen = 0;
+  int nRes;
+
+  if (nSize <= 0 || !pBuffer)
+    return -1;
+
+  if (bDecodeName)
+    {
+      if (nSize < 4)
+	return -1;
+      nLen = AMF_DecodeInt16(pBuffer);
+      if (nLen > (unsigned int)nSize - 2)
+	return -1;
+      nSize -= 2 + nLen;
+      pBuffer += 2 + nLen;
+    }
+
+  if (nSize == 0)
+    return -1;
+  nSize--;
+
+  switch (*pBuffer++)
+    {
+    case AMF_NUMBER:
+      nLen = 8;
+      break;
+    case AMF_BOOLEAN:
+      nLen = 1;
+      break;
+    case AMF_STRING:
+      if (nSize < 2)
+	return -1;
+      nLen = 2 + AMF_DecodeInt16(pBuffer);
+      break;
+    case AMF_NULL:
+    case AMF_UNDEFINED:
+    case AMF_UNSUPPORTED:
+      nLen = 0;
+      break;
+    case AMF_DATE:
+      nLen = 10;
+      break;
+    case AMF_LONG_STRING:
+      if (nSize < 4)
+	return -1;
+      nLen = AMF_DecodeInt32(pBuffer);
+      if (nLen > (unsigned int)nSize - 4)
+	return -1;
+      nLen += 4;
+      break;
+    case AMF_ECMA_ARRAY:
+      if (nSize < 4)
+	return -1;
+      nSize -= 4;
+      pBuffer += 4;
+      /* FALLTHRU */
+    case AMF_OBJECT:
+      nRes = AMF_SkipMembers(pBuffer, nSize);
+      if (nRes == -1)
+	return -1;
+      nLen = nRes;
+      break;
+    case AMF_STRICT_ARRAY:
+      {
+	unsigned int nArrayLen;
+
+	if (nSize < 4)
+	  return -1;
+	nArrayLen = AMF_DecodeInt32(pBuffer);
+	nSize -= 4;
+	pBuffer += 4;
+	while (nArrayLen--)
+	  {
+	    nRes = AMFProp_Skip(pBuffer, nSize, FALSE);
+	    if (nRes == -1)
+	      return -1;
+	    nSize -= nRes;
+	    pBuffer += nRes;
+	  }
+	break;
+      }
+    default:
+      /* references, AMF3 and the reserved types can't be skipped */
+      return -1;
+    }
+
+  if (nLen > (unsigned int)nSize)
+    return -1;
+  return nOriginalSize - nSize + nLen;
+}
+
+int
+AMF_Lookup(const char *pBuffer, int nSize, int nIndex, const AVal *name,
+	   AMFObjectProperty *prop, AMFArena *arena)
+{
+  int nRes;
+
+  while (nIndex-- > 0)
+    {
+      nRes = AMFProp_Skip(pBuffer, nSize, FALSE);
+      if (nRes == -1)
+	goto notfound;
+      nSize -= nRes;
+      pBuffer += nRes;
+    }
+
+  if (!name)
+    {
+      if (AMFProp_DecodeIn(prop, pBuffer, nSize, FALSE, arena) == -1)
+	goto notfound;
+      return TRUE;
+    }
+
+  if (nSize >= 1 && *pBuffer == AMF_OBJECT)
+    {
+      nSize--;
+      pBuffer++;
+    }
+  else if (nSize >= 5 && *pBuffer == AMF_ECMA_ARRAY)
+    {
+      nSize -= 5;
+      pBuffer += 5;
+    }
+  else
+    goto notfound;
+
+  /* compare names in place, decode only the member asked for */
+  while (nSize >= 3 && AMF_DecodeInt24(pBuffer) != AMF_OBJECT_END)
+    {
+      int nNameSize = AMF_DecodeInt16(pBuffer);
+
+      if (nNameSize == name->av_len && nNameSize <= nSize - 2
+	  && !memcmp(pBuffer + 2, name->av_val, nNameSize))
+	{
+	  if (AMFProp_DecodeIn(prop, pBuffer, nSize, TRUE, arena) == -1)
+	    break;
+	  return TRUE;
+	}
+      nRes = AMFProp_Skip(pBuffer, nSize, TRUE);
+      if (nRes == -1)
+	break;
+      nSize -= nRes;
+      pBuffer += nRes;
+    }
+
+notfound:
+  *prop = AMFProp_Invalid;
+  return FALSE;
+}
+
 void
 AMF_AddProp(AMFObject *obj, const AMFObjectProperty *prop)
 {
@@ -1114,6 +1420,51 @@ AMF_AddProp(AMFObject *obj, const AMFObjectProperty *prop)
   obj->o_props[obj->o_num++] = *prop;
 }
 
+/* Arena tables hold 4, 8, 16, ... entries, so the capacity follows from
+ * o_num. A table that still ends at the top of the block is extended in
+ * place, which is the usual case since nested objects are finished
+ * before their parent gets its next member.
+ */
+#define AMF_ARENA_MINPROPS	4
+
+static int
+AMF_AddPropIn(AMFObject *obj, const AMFObjectProperty *prop, AMFArena *arena)
+{
+  int n = obj->o_num;
+
+  if (!arena)
+    {
+      if (!(n & 0x0f))
+	{
+	  AMFObjectProperty *props =
+	    realloc(obj->o_props, (n + 16) * sizeof(AMFObjectProperty));
+	  if (!props)
+	    return FALSE;
+	  obj->o_props = props;
+	}
+    }
+  else if (n == 0 || (n >= AMF_ARENA_MINPROPS && !(n & (n - 1))))
+    {
+      int grow = (n ? n : AMF_ARENA_MINPROPS) * sizeof(AMFObjectProperty);
+      char *end = (char *)(obj->o_props + n);
+
+      if (n && end == arena->a_buf + arena->a_used
+	  && arena->a_used + grow <= arena->a_size)
+	arena->a_used += grow;
+      else
+	{
+	  AMFObjectProperty *props = AMFArena_Alloc(arena, n ? 2 * grow : grow);
+	  if (!props)
+	    return FALSE;
+	  if (n)
+	    memcpy(props, obj->o_props, n * sizeof(AMFObjectProperty));
+	  obj->o_props = props;
+	}
+    }
+  obj->o_props[obj->o_num++] = *prop;
+  return TRUE;
+}
+
 int
 AMF_CountProp(AMFObject *obj)
 {
@@ -1167,6 +1518,76 @@ AMF_Reset(AMFObject *obj)
 }
 
 
+/* AMFArena */
+
+#define AMF_ARENA_MIN	2048
+#define AMF_ARENA_ALIGN	(sizeof(double) - 1)
+
+void
+AMFArena_Init(AMFArena *arena)
+{
+  memset(arena, 0, sizeof(*arena));
+}
+
+void
+AMFArena_Reset(AMFArena *arena)
+{
+  while (arena->a_old)
+    {
+      void *next = *(void **)arena->a_old;
+      free(arena->a_old);
+      arena->a_old = next;
+    }
+  arena->a_used = 0;
+}
+
+void
+AMFArena_Free(AMFArena *arena)
+{
+  AMFArena_Reset(arena);
+  free(arena->a_buf);
+  AMFArena_Init(arena);
+}
+
+void *
+AMFArena_Alloc(AMFArena *arena, int size)
+{
+  /* the first word of every block is kept free for the chain link */
+  int used = arena->a_used ?
+    (int)((arena->a_used + AMF_ARENA_ALIGN) & ~AMF_ARENA_ALIGN) :
+    (int)sizeof(double);
+  void *ptr;
+
+  if (size < 0)
+    return NULL;
+  if (used + size > arena->a_size)
+    {
+      /* Earlier allocations are still in use, so park the current block
+       * until the next reset and carry on in one that is at least twice
+       * as big. The chain link sits in the first bytes of the old block.
+       */
+      int nsize = arena->a_size ? arena->a_size * 2 : AMF_ARENA_MIN;
+      char *nbuf;
+
+      while (nsize < size + (int)sizeof(double))
+	nsize *= 2;
+      nbuf = malloc(nsize);
+      if (!nbuf)
+	return NULL;
+      if (arena->a_buf)
+	{
+	  *(void **)arena->a_buf = arena->a_old;
+	  arena->a_old = arena->a_buf;
+	}
+      arena->a_buf = nbuf;
+      arena->a_size = nsize;
+      used = sizeof(double);
+    }
+  ptr = arena->a_buf + used;
+  arena->a_used = used + size;
+  return ptr;
+}
+
 /* AMF3ClassDefinition */
 
 void
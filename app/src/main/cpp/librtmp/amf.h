@@ -113,6 +113,47 @@ extern "C"
   void AMF_Dump(AMFObject * obj);
   void AMF_Reset(AMFObject * obj);
 
+  /* Bump allocator for decoded AMF trees. One block is reused for every
+   * message; if a message outgrows it the block is replaced by a larger
+   * one and the old ones are released on the next AMFArena_Reset, so a
+   * steady stream of similar messages settles on a single allocation.
+   * Objects decoded into an arena must not be passed to AMF_Reset or
+   * AMFProp_Reset, they all go away together with AMFArena_Reset.
+   */
+  typedef struct AMFArena
+  {
+    char *a_buf;
+    int a_size;
+    int a_used;
+    void *a_old;		/* outgrown blocks, freed on reset */
+  } AMFArena;
+
+  void AMFArena_Init(AMFArena * arena);
+  void AMFArena_Reset(AMFArena * arena);
+  void AMFArena_Free(AMFArena * arena);
+  void *AMFArena_Alloc(AMFArena * arena, int size);
+
+  int AMF_DecodeArena(AMFObject * obj, const char *pBuffer, int nSize,
+		      int bDecodeName, AMFArena * arena);
+
+  /* Walk encoded AMF0 without building a tree. AMFProp_Skip returns the
+   * encoded size of one value (or -1, also for AMF3 payloads).
+   * AMF_Lookup finds the nIndex'th value of a sequence such as an invoke
+   * body and, if name is set, the member of that object or ECMA array
+   * with this name. Only the value found is decoded; strings point into
+   * pBuffer and objects go to arena (the heap if arena is NULL).
+   * Returns FALSE and an AMF_INVALID prop if there is no such value.
+   */
+  int AMFProp_Skip(const char *pBuffer, int nSize, int bDecodeName);
+  int AMF_Lookup(const char *pBuffer, int nSize, int nIndex,
+		 const AVal * name, AMFObjectProperty * prop,
+		 AMFArena * arena);
+
+  /* exact number of bytes AMF_Encode / AMFProp_Encode will write, -1 if
+   * the value can't be encoded */
+  int AMF_EncodedSize(const AMFObject * obj);
+  int AMFProp_EncodedSize(const AMFObjectProperty * prop);
+
   void AMF_AddProp(AMFObject * obj, const AMFObjectProperty * prop);
   int AMF_CountProp(AMFObject * obj);
   AMFObjectProperty *AMF_GetProp(AMFObject * obj, const AVal * name,
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
@@ -49,6 +50,9 @@ static void rtmp_log_default(int level, const char *format, va_list vl)
 {
 	char str[MAX_PRINT_LEN]="";
 
+	if ( level > RTMP_debuglevel )
+		return;
+
 	vsnprintf(str, MAX_PRINT_LEN-1, format, vl);
 
 	/* Filter out 'no-name' */
@@ -57,16 +61,14 @@ static void rtmp_log_default(int level, const char *format, va_list vl)
 
 	if ( !fmsg ) fmsg = stderr;
 
-	if ( level <= RTMP_debuglevel ) {
-		if (neednl) {
-			putc('\n', fmsg);
-			neednl = 0;
-		}
-		fprintf(fmsg, "%s: %s\n", levels[level], str);
+	if (neednl) {
+		putc('\n', fmsg);
+		neednl = 0;
+	}
+	fprintf(fmsg, "%s: %s\n", levels[level], str);
 #ifdef _DEBUG
-		fflush(fmsg);
+	fflush(fmsg);
 #endif
-	}
 }
 
 void RTMP_LogSetOutput(FILE *file)
@@ -89,9 +91,14 @@ RTMP_LogLevel RTMP_LogGetLevel()
 	return RTMP_debuglevel;
 }
 
-void RTMP_Log(int level, const char *format, ...)
+/* Callbacks only see messages at or below the current level */
+void (RTMP_Log)(int level, const char *format, ...)
 {
 	va_list args;
+
+	if ( level > RTMP_debuglevel )
+		return;
+
 	va_start(args, format);
 	cb(level, format, args);
 	va_end(args);
@@ -218,3 +225,109 @@ void RTMP_LogStatus(const char *format, ...)
 	fflush(fmsg);
 	neednl = 1;
 }
+
+int RTMP_traceon = 1;
+
+static RTMP_TraceRecord traceRing[RTMP_TRACE_SIZE];
+static uint32_t traceHead;
+
+static const char *traceEvents[] = {
+  "", "CONNECT", "CLOSE", "SEND", "RECV", "CTRL", "CHUNKSIZE", "ACK", "BACKLOG"
+};
+
+static uint64_t trace_now(void)
+{
+#ifdef _WIN32
+	return (uint64_t)timeGetTime() * 1000000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void RTMP_TraceSetEnabled(int on)
+{
+	RTMP_traceon = on;
+}
+
+/* Claim a slot, mark it busy, fill it, then publish the sequence number.
+ * A writer lapped by RTMP_TRACE_SIZE others may leave a torn record;
+ * readers detect that through tr_seq and skip it.
+ */
+void RTMP_TraceAdd(int event, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	uint32_t seq = __atomic_add_fetch(&traceHead, 1, __ATOMIC_RELAXED);
+	RTMP_TraceRecord *rec = &traceRing[(seq - 1) & (RTMP_TRACE_SIZE - 1)];
+
+	__atomic_store_n(&rec->tr_seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->tr_ns = trace_now();
+	rec->tr_event = event;
+	rec->tr_arg[0] = a0;
+	rec->tr_arg[1] = a1;
+	rec->tr_arg[2] = a2;
+	rec->tr_arg[3] = a3;
+	__atomic_store_n(&rec->tr_seq, seq, __ATOMIC_RELEASE);
+}
+
+/* Copy up to max of the newest records into out, oldest first.
+ * Records still being written are left out.
+ */
+int RTMP_TraceSnapshot(RTMP_TraceRecord *out, int max)
+{
+	uint32_t head = __atomic_load_n(&traceHead, __ATOMIC_ACQUIRE);
+	uint32_t seq, n = 0;
+
+	if (max > RTMP_TRACE_SIZE)
+		max = RTMP_TRACE_SIZE;
+	seq = head > (uint32_t)max ? head - max + 1 : 1;
+
+	for (; seq && seq <= head; seq++)
+	  {
+	    const RTMP_TraceRecord *rec = &traceRing[(seq - 1) & (RTMP_TRACE_SIZE - 1)];
+
+	    if (__atomic_load_n(&rec->tr_seq, __ATOMIC_ACQUIRE) != seq)
+	      continue;
+	    out[n] = *rec;
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    if (__atomic_load_n(&rec->tr_seq, __ATOMIC_RELAXED) != seq)
+	      continue;
+	    out[n].tr_seq = seq;
+	    n++;
+	  }
+	return n;
+}
+
+int RTMP_TraceFormat(const RTMP_TraceRecord *rec, char *buf, int size)
+{
+	const char *name = rec->tr_event < RTMP_TRACE_MAX ? traceEvents[rec->tr_event] : "?";
+
+	return snprintf(buf, size, "%u %llu.%06u %s %u %u %u %u", rec->tr_seq,
+		(unsigned long long)(rec->tr_ns / 1000000000),
+		(unsigned)(rec->tr_ns % 1000000000 / 1000), name,
+		rec->tr_arg[0], rec->tr_arg[1], rec->tr_arg[2], rec->tr_arg[3]);
+}
+
+void RTMP_TraceDump(FILE *file, int max)
+{
+	RTMP_TraceRecord *recs;
+	char line[128];
+	int i, n;
+
+	if (max > RTMP_TRACE_SIZE)
+		max = RTMP_TRACE_SIZE;
+	recs = malloc(max * sizeof(RTMP_TraceRecord));
+	if (!recs)
+		return;
+	if ( !file ) file = fmsg ? fmsg : stderr;
+
+	n = RTMP_TraceSnapshot(recs, max);
+	for (i = 0; i < n; i++)
+	  {
+	    RTMP_TraceFormat(&recs[i], line, sizeof(line));
+	    fprintf(file, "TRACE: %s\n", line);
+	  }
+	fflush(file);
+	free(recs);
+}
@@ -56,6 +56,52 @@ void RTMP_LogHexString(int level, const uint8_t *data, unsigned long len);
 void RTMP_LogSetLevel(RTMP_LogLevel lvl);
 RTMP_LogLevel RTMP_LogGetLevel(void);
 
+/* Check the level before calling out, so filtered messages cost a compare
+ * instead of a vsnprintf. Call (RTMP_Log)(...) to bypass the macro.
+ */
+#define RTMP_LogEnabled(level)	((int)(level) <= (int)RTMP_debuglevel)
+#define RTMP_Log(level, ...) \
+  do { if (RTMP_LogEnabled(level)) (RTMP_Log)((level), __VA_ARGS__); } while (0)
+
+/* Binary trace ring: fixed-size records written lock-free by any thread,
+ * cheap enough to leave packet-level tracing on in production. The newest
+ * RTMP_TRACE_SIZE records are kept and can be dumped on demand.
+ */
+#ifndef RTMP_TRACE_SIZE
+#define RTMP_TRACE_SIZE	4096	/* power of two */
+#endif
+
+typedef enum
+{ RTMP_TRACE_CONNECT=1,	/* fd */
+  RTMP_TRACE_CLOSE,	/* fd, bytes in, bytes pending out */
+  RTMP_TRACE_SEND,	/* type, channel, size, timestamp */
+  RTMP_TRACE_RECV,	/* type, channel, size, timestamp */
+  RTMP_TRACE_CTRL,	/* control type, value */
+  RTMP_TRACE_CHUNKSIZE,	/* 0 in / 1 out, size */
+  RTMP_TRACE_ACK,	/* bytes in */
+  RTMP_TRACE_BACKLOG,	/* bytes written, bytes buffered, bytes pending */
+  RTMP_TRACE_MAX
+} RTMP_TraceEvent;
+
+typedef struct RTMP_TraceRecord
+{
+  uint64_t tr_ns;	/* CLOCK_MONOTONIC */
+  uint32_t tr_seq;	/* 1-based, 0 while being written */
+  uint32_t tr_event;
+  uint32_t tr_arg[4];
+} RTMP_TraceRecord;
+
+extern int RTMP_traceon;
+
+void RTMP_TraceAdd(int event, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+void RTMP_TraceSetEnabled(int on);
+int RTMP_TraceSnapshot(RTMP_TraceRecord *out, int max);
+int RTMP_TraceFormat(const RTMP_TraceRecord *rec, char *buf, int size);
+void RTMP_TraceDump(FILE *file, int max);
+
+#define RTMP_Trace(event, a0, a1, a2, a3) \
+  do { if (RTMP_traceon) RTMP_TraceAdd((event), (a0), (a1), (a2), (a3)); } while (0)
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,7 @@
  *  http://www.gnu.org/copyleft/lgpl.html
  */
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,16 @@
 #include "rtmp_sys.h"
 #include "log.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #ifdef CRYPTO
 #ifdef USE_POLARSSL
 #include <polarssl/havege.h>
@@ -46,6 +57,9 @@ TLS_CTX RTMP_TLS_ctx;
 #define RTMP_SIG_SIZE 1536
 #define RTMP_LARGE_HEADER_SIZE 12
 
+/* how long RTMP_Close waits for buffered output in non-blocking mode */
+#define RTMP_CLOSE_DRAIN_MS 1000
+
 static const int packetSize[] = { 12, 8, 4, 1 };
 
 int RTMP_ctrlC;
@@ -85,6 +99,10 @@ typedef enum {
   RTMPT_OPEN=0, RTMPT_SEND, RTMPT_IDLE, RTMPT_CLOSE
 } RTMPTCmd;
 
+typedef enum {
+  RTMPT_STATUS=0, RTMPT_HEADERS, RTMPT_BODY
+} RTMPTState;
+
 static int DumpMetaData(AMFObject *obj);
 static int HandShake(RTMP *r, int FP9HandShake);
 static int SocksNegotiate(RTMP *r);
@@ -101,6 +119,21 @@ static int SendBytesReceived(RTMP *r);
 static int SendBGHasStream(RTMP *r, double dId, AVal *playpath);
 #endif
 
+/* ids of the invoke methods we know, see InvokeMethods */
+enum
+{
+  INVOKE_connect, INVOKE_createStream, INVOKE_play, INVOKE_publish,
+  INVOKE__checkbw, INVOKE_set_playlist,	/* the RTMP_CALL_KINDS */
+  INVOKE__result, INVOKE_onBWDone, INVOKE_onFCSubscribe,
+  INVOKE_onFCUnsubscribe, INVOKE_ping, INVOKE__onbwcheck, INVOKE__onbwdone,
+  INVOKE__error, INVOKE_close, INVOKE_onStatus, INVOKE_playlist_ready,
+  INVOKE_COUNT
+};
+typedef char InvokeCallKindsCheck[INVOKE__result == RTMP_CALL_KINDS ? 1 : -1];
+
+static void InvokeIndexInit(void);
+static void InvokeIndexOnce(void);
+static int MethodId(const AVal *name);
 static int HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize);
 static int HandleMetadata(RTMP *r, char *body, unsigned int len);
 static void HandleChangeChunkSize(RTMP *r, const RTMPPacket *packet);
@@ -111,15 +144,28 @@ static void HandleServerBW(RTMP *r, const RTMPPacket *packet);
 static void HandleClientBW(RTMP *r, const RTMPPacket *packet);
 
 static int ReadN(RTMP *r, char *buffer, int n);
+static void BytesIn(RTMP *r, int n);
+static int ReadFromBuffer(RTMP *r);
+static int ChunkBuffered(RTMP *r, const RTMPPacket *packet);
+static int SockBuf_Capacity(const RTMPSockBuf *sb);
+#ifndef _WIN32
+static int RTMPSockBuf_FillDirect(RTMPSockBuf *sb, char *dst, int n, int *direct);
+#endif
 static int WriteN(RTMP *r, const char *buffer, int n);
+static int WriteV(RTMP *r, struct iovec *iov, int iovcnt);
+#ifdef __linux__
+static int SockBuf_SendPending(RTMP *r);
+static int SockBuf_WaitReadable(RTMPSockBuf *sb, int timeoutMs);
+#endif
 
 static void DecodeTEA(AVal *key, AVal *text);
 
 static int HTTP_Post(RTMP *r, RTMPTCmd cmd, const char *buf, int len);
 static int HTTP_read(RTMP *r, int fill);
-
-#ifndef _WIN32
-static int clk_tck;
+static int HTTP_Collect(RTMP *r, const char *buf, int len);
+static int HTTP_FlushOut(RTMP *r);
+#ifdef __linux__
+static int HTTP_Drain(RTMP *r);
 #endif
 
 #ifdef CRYPTO
@@ -134,9 +180,11 @@ RTMP_GetTime()
 #elif defined(_WIN32)
   return timeGetTime();
 #else
-  struct tms t;
-  if (!clk_tck) clk_tck = sysconf(_SC_CLK_TCK);
-  return times(&t) * 1000 / clk_tck;
+  /* CLOCK_MONOTONIC in ms, same clock the encoders stamp capture time with;
+   * times() only ticks at _SC_CLK_TCK (often 10ms) */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)ts.tv_sec * 1000 + (uint32_t)(ts.tv_nsec / 1000000);
 #endif
 }
 
@@ -189,6 +237,93 @@ RTMPPacket_Dump(RTMPPacket *p)
       p->m_nBodySize, p->m_body ? (unsigned char)p->m_body[0] : 0);
 }
 
+static int
+ChannelHash(int id, int size)
+{
+  return (int)(((uint32_t)id * 2654435761U) & (size - 1));
+}
+
+static int
+ChannelMapGrow(RTMP *r)
+{
+  int i, size = r->m_channelMapSize ? r->m_channelMapSize * 2 : 8;
+  RTMPChannelSlot *map = calloc(size, sizeof(RTMPChannelSlot));
+
+  if (!map)
+    return FALSE;
+  for (i = 0; i < r->m_channelMapSize; i++)
+    {
+      RTMPChannelSlot *s = &r->m_channelMap[i];
+      int h;
+
+      if (!s->cs_id)
+	continue;
+      for (h = ChannelHash(s->cs_id, size); map[h].cs_id; h = (h + 1) & (size - 1))
+	;
+      map[h] = *s;
+    }
+  free(r->m_channelMap);
+  r->m_channelMap = map;
+  r->m_channelMapSize = size;
+  return TRUE;
+}
+
+/* Per chunk stream state. Returns NULL if the channel is unknown and
+ * create is not set, or if it can't be allocated.
+ */
+static RTMPChannel *
+GetChannel(RTMP *r, int id, int create)
+{
+  int h;
+
+  if (id < RTMP_CHANNELS_LOW)
+    return &r->m_channels[id];
+
+  if (r->m_channelMapSize)
+    {
+      for (h = ChannelHash(id, r->m_channelMapSize); r->m_channelMap[h].cs_id;
+	   h = (h + 1) & (r->m_channelMapSize - 1))
+	{
+	  if (r->m_channelMap[h].cs_id == id)
+	    return &r->m_channelMap[h].cs_channel;
+	}
+    }
+  if (!create)
+    return NULL;
+
+  /* keep the load factor under 3/4 */
+  if ((r->m_channelMapUsed + 1) * 4 > r->m_channelMapSize * 3)
+    {
+      if (!ChannelMapGrow(r))
+	return NULL;
+    }
+  for (h = ChannelHash(id, r->m_channelMapSize); r->m_channelMap[h].cs_id;
+       h = (h + 1) & (r->m_channelMapSize - 1))
+    ;
+  r->m_channelMap[h].cs_id = id;
+  r->m_channelMapUsed++;
+  return &r->m_channelMap[h].cs_channel;
+}
+
+static int
+ChannelTimestamp(RTMP *r, int id)
+{
+  RTMPChannel *ch = GetChannel(r, id, FALSE);
+  return ch ? ch->ch_timestamp : 0;
+}
+
+static void
+FreeChannel(RTMPChannel *ch)
+{
+  if (ch->ch_in)
+    {
+      RTMPPacket_Free(ch->ch_in);
+      free(ch->ch_in);
+    }
+  free(ch->ch_out);
+  memset(ch, 0, sizeof(RTMPChannel));
+}
+
 int
 RTMP_LibVersion()
 {
@@ -235,6 +370,8 @@ RTMP_Alloc()
 void
 RTMP_Free(RTMP *r)
 {
+  free(r->m_sb.sb_rbuf);
+  AMFArena_Free(&r->m_amfArena);
   free(r);
 }
 
@@ -246,8 +383,11 @@ RTMP_Init(RTMP *r)
     RTMP_TLS_Init();
 #endif
 
+  InvokeIndexOnce();
+
   memset(r, 0, sizeof(RTMP));
   r->m_sb.sb_socket = -1;
+  r->m_sb.sb_epoll = -1;
   r->m_inChunkSize = RTMP_DEFAULT_CHUNKSIZE;
   r->m_outChunkSize = RTMP_DEFAULT_CHUNKSIZE;
   r->m_nBufferMS = 30000;
@@ -290,6 +430,239 @@ RTMP_IsTimedout(RTMP *r)
   return r->m_sb.sb_timedout;
 }
 
+int
+RTMP_SetNonBlocking(RTMP *r, int on, int limit)
+{
+#ifdef __linux__
+  int flags;
+
+  if (!RTMP_IsConnected(r))
+    return FALSE;
+  if (on && ((r->Link.protocol & (RTMP_FEATURE_HTTP | RTMP_FEATURE_ENC | RTMP_FEATURE_SSL))
+	     || r->m_sb.sb_ssl))
+    {
+      RTMP_Log(RTMP_LOGWARNING, "%s, not supported for %s", __FUNCTION__,
+	  RTMPProtocolStrings[r->Link.protocol & 7]);
+      return FALSE;
+    }
+  if (!on && r->m_sb.sb_outLen && !RTMP_Drain(r, r->Link.timeout * 1000))
+    return FALSE;
+
+  flags = fcntl(r->m_sb.sb_socket, F_GETFL, 0);
+  if (flags < 0
+      || fcntl(r->m_sb.sb_socket, F_SETFL,
+	       on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, fcntl failed: %d", __FUNCTION__, GetSockError());
+      return FALSE;
+    }
+  r->m_sb.sb_nonblock = on;
+  r->m_sb.sb_outLimit = limit > 0 ? limit : RTMP_OUT_LIMIT_DEFAULT;
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+int
+RTMP_Flush(RTMP *r)
+{
+  if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+      if (!RTMP_IsConnected(r))
+	return -1;
+      if (!HTTP_FlushOut(r))
+	{
+	  RTMP_Close(r);
+	  return -1;
+	}
+      return 0;
+    }
+#ifdef __linux__
+  if (!RTMP_IsConnected(r))
+    return -1;
+  if (!r->m_sb.sb_nonblock)
+    return 0;
+  return SockBuf_SendPending(r);
+#else
+  return RTMP_IsConnected(r) ? 0 : -1;
+#endif
+}
+
+int
+RTMP_Pending(RTMP *r)
+{
+  return r->m_sb.sb_outLen + r->m_httpOutLen;
+}
+
+uint64_t
+RTMP_BytesSent(RTMP *r)
+{
+  return r->m_sb.sb_bytesOut;
+}
+
+int
+RTMP_Writable(RTMP *r)
+{
+  return r->m_sb.sb_outLen < r->m_sb.sb_outLimit / 2 || !r->m_sb.sb_nonblock;
+}
+
+int
+RTMP_SendRoom(RTMP *r)
+{
+#ifdef __linux__
+  if (r->m_sb.sb_nonblock)
+    return r->m_sb.sb_outLimit - r->m_sb.sb_outLen;
+#endif
+  return INT_MAX;
+}
+
+/* largest header, and continuation chunk headers of up to 3 bytes */
+int
+RTMP_PacketSize(RTMP *r, const RTMPPacket *packet)
+{
+  int chunks = packet->m_nBodySize ? (packet->m_nBodySize - 1) / r->m_outChunkSize : 0;
+
+  return RTMP_MAX_HEADER_SIZE + packet->m_nBodySize + chunks * 3;
+}
+
+int
+RTMP_WaitWritable(RTMP *r, int timeoutMs)
+{
+#ifdef __linux__
+  RTMPSockBuf *sb = &r->m_sb;
+  struct epoll_event ev;
+#endif
+
+  if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+      /* RTMPT writes block, so only wait for the collected data to be due */
+      if (RTMP_IsConnected(r) && r->m_httpOutLen)
+	{
+	  int left = RTMPT_SEND_DELAY_MS - (int)(RTMP_GetTime() - r->m_httpOutTime);
+
+	  if (left > timeoutMs)
+	    {
+	      msleep(timeoutMs);
+	      return r->m_httpOutLen;
+	    }
+	  if (left > 0)
+	    msleep(left);
+	}
+      return RTMP_Flush(r);
+    }
+
+#ifdef __linux__
+  if (!RTMP_IsConnected(r))
+    return -1;
+  if (!sb->sb_nonblock || !sb->sb_outLen)
+    return 0;
+
+  if (sb->sb_epoll < 0)
+    {
+      sb->sb_epoll = epoll_create1(EPOLL_CLOEXEC);
+      if (sb->sb_epoll < 0)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, epoll_create1 failed: %d", __FUNCTION__, GetSockError());
+	  return -1;
+	}
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLOUT;
+      ev.data.fd = sb->sb_socket;
+      if (epoll_ctl(sb->sb_epoll, EPOLL_CTL_ADD, sb->sb_socket, &ev) < 0)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, epoll_ctl failed: %d", __FUNCTION__, GetSockError());
+	  close(sb->sb_epoll);
+	  sb->sb_epoll = -1;
+	  return -1;
+	}
+    }
+
+  /* errors and hangups are reported by the send that follows */
+  if (epoll_wait(sb->sb_epoll, &ev, 1, timeoutMs) < 0 && GetSockError() != EINTR)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, epoll_wait failed: %d", __FUNCTION__, GetSockError());
+      return -1;
+    }
+  return SockBuf_SendPending(r);
+#else
+  return RTMP_Flush(r);
+#endif
+}
+
+int
+RTMP_ReadAvailable(RTMP *r, RTMPPacket *packet)
+{
+#ifdef __linux__
+  if (!RTMP_IsConnected(r))
+    return FALSE;
+
+  while (1)
+    {
+      if (r->Link.protocol & RTMP_FEATURE_HTTP)
+	{
+	  if (HTTP_Drain(r) <= 0)
+	    return FALSE;
+	}
+      else if (!ReadFromBuffer(r))
+	{
+	  if (!r->m_sb.sb_size && SockBuf_WaitReadable(&r->m_sb, 0) <= 0)
+	    return FALSE;
+	}
+      else if (!ChunkBuffered(r, packet)
+	       && r->m_sb.sb_size < SockBuf_Capacity(&r->m_sb))
+	{
+	  /* Take what the socket has without blocking. A chunk that is
+	   * still incomplete stays buffered for the next call; only one
+	   * larger than the whole buffer is read with ReadN.
+	   */
+	  if (SockBuf_WaitReadable(&r->m_sb, 0) <= 0)
+	    return FALSE;
+	  r->m_sb.sb_timedout = FALSE;
+	  if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+	    {
+	      if (!r->m_sb.sb_timedout)
+		RTMP_Close(r);
+	      return FALSE;
+	    }
+	  if (!ChunkBuffered(r, packet)
+	      && r->m_sb.sb_size < SockBuf_Capacity(&r->m_sb))
+	    return FALSE;
+	}
+      if (!RTMP_ReadPacket(r, packet))
+	return FALSE;
+      if (RTMPPacket_IsReady(packet))
+	return TRUE;
+    }
+#else
+  return FALSE;
+#endif
+}
+
+void
+RTMP_SetStatusCallback(RTMP *r, RTMP_StatusCallback *cb, void *ctx)
+{
+  r->m_statusCb = cb;
+  r->m_statusCtx = ctx;
+}
+
+int
+RTMP_Drain(RTMP *r, int timeoutMs)
+{
+  uint32_t start = RTMP_GetTime();
+  int pending = RTMP_Flush(r);
+
+  while (pending > 0)
+    {
+      int left = timeoutMs - (int)(RTMP_GetTime() - start);
+
+      if (left <= 0)
+	break;
+      pending = RTMP_WaitWritable(r, left);
+    }
+  return pending == 0;
+}
+
 void
 RTMP_SetBufferMS(RTMP *r, int size)
 {
@@ -491,6 +864,8 @@ static struct urlopt {
   	"Buffer time in milliseconds" },
   { AVC("timeout"),   OFF(Link.timeout),       OPT_INT, 0,
   	"Session timeout in seconds" },
+  { AVC("chunksize"), OFF(m_reqChunkSize),     OPT_INT, 0,
+  	"Outbound chunk size to announce when publishing" },
   { {NULL,0}, 0, 0}
 };
 
@@ -876,8 +1251,14 @@ RTMP_Connect1(RTMP *r, RTMPPacket *cp)
       r->m_msgCounter = 1;
       r->m_clientID.av_val = NULL;
       r->m_clientID.av_len = 0;
-      HTTP_Post(r, RTMPT_OPEN, "", 1);
-      HTTP_read(r, 1);
+      r->m_httpState = RTMPT_STATUS;
+      if (HTTP_Post(r, RTMPT_OPEN, "", 1) < 0 || HTTP_read(r, 1) < 1
+	  || !r->m_clientID.av_val)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, RTMPT open failed", __FUNCTION__);
+	  RTMP_Close(r);
+	  return FALSE;
+	}
       r->m_msgCounter = 0;
     }
   RTMP_Log(RTMP_LOGDEBUG, "%s, ... connected, handshaking", __FUNCTION__);
@@ -924,6 +1305,7 @@ RTMP_Connect(RTMP *r, RTMPPacket *cp)
   if (!RTMP_Connect0(r, (struct sockaddr *)&service))
     return FALSE;
 
+  RTMP_Trace(RTMP_TRACE_CONNECT, r->m_sb.sb_socket, 0, 0, 0);
   r->m_bSendCounter = TRUE;
 
   return RTMP_Connect1(r, cp);
@@ -999,6 +1381,14 @@ RTMP_ConnectStream(RTMP *r, int seekTime)
 	}
     }
 
+  /* publishers announce a larger chunk size before any media goes out */
+  if (r->m_bPlaying && (r->Link.protocol & RTMP_FEATURE_WRITE)
+      && r->m_reqChunkSize > 0 && r->m_reqChunkSize != r->m_outChunkSize)
+    {
+      if (!RTMP_SendChunkSize(r, r->m_reqChunkSize))
+	return FALSE;
+    }
+
   return r->m_bPlaying;
 }
 
@@ -1083,7 +1473,7 @@ RTMP_GetNextMediaPacket(RTMP *r, RTMPPacket *packet)
   if (bHasMediaPacket)
     r->m_bPlaying = TRUE;
   else if (r->m_sb.sb_timedout && !r->m_pausing)
-    r->m_pauseStamp = r->m_channelTimestamp[r->m_mediaChannel];
+    r->m_pauseStamp = ChannelTimestamp(r, r->m_mediaChannel);
 
   return bHasMediaPacket;
 }
@@ -1253,7 +1643,7 @@ static int
 ReadN(RTMP *r, char *buffer, int n)
 {
   int nOriginalSize = n;
-  int avail;
+  int avail, direct;
   char *ptr;
 
   r->m_sb.sb_timedout = FALSE;
@@ -1266,22 +1656,38 @@ ReadN(RTMP *r, char *buffer, int n)
   while (n > 0)
     {
       int nBytes = 0, nRead;
+      direct = 0;
       if (r->Link.protocol & RTMP_FEATURE_HTTP)
         {
 	  while (!r->m_resplen)
 	    {
-	      if (r->m_sb.sb_size < 144)
-	        {
-		  if (!r->m_unackd)
-		    HTTP_Post(r, RTMPT_IDLE, "", 1);
-		  if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+	      int ret = HTTP_read(r, 0);
+
+	      if (ret < 0)
+		{
+		  RTMP_Close(r);
+		  return 0;
+		}
+	      if (ret > 0)
+		continue;
+
+	      /* the reply may be waiting for what is still collected */
+	      if (r->m_httpOutLen)
+		{
+		  if (!HTTP_FlushOut(r))
 		    {
-		      if (!r->m_sb.sb_timedout)
-		        RTMP_Close(r);
+		      RTMP_Close(r);
 		      return 0;
 		    }
 		}
-	      HTTP_read(r, 0);
+	      else if (!r->m_unackd)
+		HTTP_Post(r, RTMPT_IDLE, "", 1);
+	      if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+		{
+		  if (!r->m_sb.sb_timedout)
+		    RTMP_Close(r);
+		  return 0;
+		}
 	    }
 	  if (r->m_resplen && !r->m_sb.sb_size)
 	    RTMPSockBuf_Fill(&r->m_sb);
@@ -1294,8 +1700,27 @@ ReadN(RTMP *r, char *buffer, int n)
           avail = r->m_sb.sb_size;
 	  if (avail == 0)
 	    {
-	      if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+	      int nFill;
+#ifndef _WIN32
+	      /* big reads land in place, the surplus goes to the buffer */
+	      if (n >= RTMP_DIRECT_READ_MIN && !r->m_sb.sb_ssl)
+		nFill = RTMPSockBuf_FillDirect(&r->m_sb, ptr, n, &direct);
+	      else
+#endif
+		nFill = RTMPSockBuf_Fill(&r->m_sb);
+	      if (nFill < 1)
 	        {
+#ifdef __linux__
+		  /* non-blocking socket in the middle of a chunk: wait for
+		   * the rest as long as a blocking read would have
+		   */
+		  if (r->m_sb.sb_timedout && r->m_sb.sb_nonblock
+		      && SockBuf_WaitReadable(&r->m_sb, r->Link.timeout * 1000) > 0)
+		    {
+		      r->m_sb.sb_timedout = FALSE;
+		      continue;
+		    }
+#endif
 	          if (!r->m_sb.sb_timedout)
 	            RTMP_Close(r);
 	          return 0;
@@ -1303,17 +1728,17 @@ ReadN(RTMP *r, char *buffer, int n)
 	      avail = r->m_sb.sb_size;
 	    }
 	}
-      nRead = ((n < avail) ? n : avail);
+      nRead = direct ? direct : ((n < avail) ? n : avail);
       if (nRead > 0)
 	{
-	  memcpy(ptr, r->m_sb.sb_start, nRead);
-	  r->m_sb.sb_start += nRead;
-	  r->m_sb.sb_size -= nRead;
+	  if (!direct)
+	    {
+	      memcpy(ptr, r->m_sb.sb_start, nRead);
+	      r->m_sb.sb_start += nRead;
+	      r->m_sb.sb_size -= nRead;
+	    }
 	  nBytes = nRead;
-	  r->m_nBytesIn += nRead;
-	  if (r->m_bSendCounter
-	      && r->m_nBytesIn > r->m_nBytesInSent + r->m_nClientBW / 2)
-	    SendBytesReceived(r);
+	  BytesIn(r, nRead);
 	}
       /*RTMP_Log(RTMP_LOGDEBUG, "%s: %d bytes\n", __FUNCTION__, nBytes); */
 #ifdef _DEBUG
@@ -1345,51 +1770,231 @@ ReadN(RTMP *r, char *buffer, int n)
   return nOriginalSize - n;
 }
 
-static int
-WriteN(RTMP *r, const char *buffer, int n)
+/* count bytes taken from the socket and acknowledge them when due */
+static void
+BytesIn(RTMP *r, int n)
 {
-  const char *ptr = buffer;
-#ifdef CRYPTO
-  char *encrypted = 0;
-  char buf[RTMP_BUFFER_CACHE_SIZE];
+  r->m_nBytesIn += n;
+  if (r->m_bSendCounter
+      && r->m_nBytesIn > r->m_nBytesInSent + r->m_nClientBW / 2)
+    SendBytesReceived(r);
+}
 
-  if (r->Link.rc4keyOut)
+#ifdef __linux__
+/* Keep bytes the socket did not take. They are sent before anything
+ * written later, so a chunk cut in the middle of a write resumes exactly
+ * where it stopped.
+ */
+static int
+SockBuf_Append(RTMPSockBuf *sb, const char *buf, int len)
+{
+  if (sb->sb_outStart + sb->sb_outLen + len > sb->sb_outSize)
     {
-      if (n > sizeof(buf))
-	encrypted = (char *)malloc(n);
-      else
-	encrypted = (char *)buf;
-      ptr = encrypted;
-      RC4_encrypt2(r->Link.rc4keyOut, n, buffer, ptr);
+      if (sb->sb_outStart)
+	{
+	  memmove(sb->sb_out, sb->sb_out + sb->sb_outStart, sb->sb_outLen);
+	  sb->sb_outStart = 0;
+	}
+      if (sb->sb_outLen + len > sb->sb_outSize)
+	{
+	  int size = sb->sb_outSize ? sb->sb_outSize : 64 * 1024;
+	  char *out;
+
+	  while (size < sb->sb_outLen + len)
+	    size *= 2;
+	  out = realloc(sb->sb_out, size);
+	  if (!out)
+	    return FALSE;
+	  sb->sb_out = out;
+	  sb->sb_outSize = size;
+	}
     }
-#endif
+  memcpy(sb->sb_out + sb->sb_outStart + sb->sb_outLen, buf, len);
+  sb->sb_outLen += len;
+  return TRUE;
+}
 
-  while (n > 0)
-    {
-      int nBytes;
+static int
+SockBuf_SendPending(RTMP *r)
+{
+  RTMPSockBuf *sb = &r->m_sb;
 
-      if (r->Link.protocol & RTMP_FEATURE_HTTP)
-        nBytes = HTTP_Post(r, RTMPT_SEND, ptr, n);
-      else
-        nBytes = RTMPSockBuf_Send(&r->m_sb, ptr, n);
-      /*RTMP_Log(RTMP_LOGDEBUG, "%s: %d\n", __FUNCTION__, nBytes); */
+  while (sb->sb_outLen > 0)
+    {
+      int nBytes = RTMPSockBuf_Send(sb, sb->sb_out + sb->sb_outStart, sb->sb_outLen);
 
       if (nBytes < 0)
 	{
 	  int sockerr = GetSockError();
-	  RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes)", __FUNCTION__,
-	      sockerr, n);
 
 	  if (sockerr == EINTR && !RTMP_ctrlC)
 	    continue;
+	  if (sockerr == EWOULDBLOCK || sockerr == EAGAIN)
+	    break;
 
+	  RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes pending)",
+	      __FUNCTION__, sockerr, sb->sb_outLen);
+	  /* nothing pending any more, RTMP_Close must not wait for it */
+	  sb->sb_outLen = 0;
+	  sb->sb_outStart = 0;
 	  RTMP_Close(r);
-	  n = 1;
-	  break;
+	  return -1;
 	}
+      sb->sb_outStart += nBytes;
+      sb->sb_outLen -= nBytes;
+    }
+  if (!sb->sb_outLen)
+    sb->sb_outStart = 0;
+  return sb->sb_outLen;
+}
 
-      if (nBytes == 0)
-	break;
+static int
+SockBuf_WaitReadable(RTMPSockBuf *sb, int timeoutMs)
+{
+  struct pollfd pfd;
+  int ret;
+
+  pfd.fd = sb->sb_socket;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  while ((ret = poll(&pfd, 1, timeoutMs)) < 0 && GetSockError() == EINTR && !RTMP_ctrlC)
+    ;
+  return ret;
+}
+
+/* Write without blocking. Anything already pending goes first, whatever
+ * the socket does not take now is appended behind it. If that would leave
+ * more than sb_outLimit bytes pending the connection is closed instead:
+ * the packet's channel state is already updated and a batch may span
+ * several writes, so it cannot be refused. Callers stay within
+ * RTMP_SendRoom to never get here.
+ */
+static int
+WriteVNonBlock(RTMP *r, struct iovec *iov, int iovcnt)
+{
+  RTMPSockBuf *sb = &r->m_sb;
+  ssize_t nBytes = 0, sent;
+  int i, buffered = 0;
+
+  if (sb->sb_outLen && SockBuf_SendPending(r) < 0)
+    return FALSE;
+
+  if (!sb->sb_outLen)
+    {
+      while ((nBytes = writev(sb->sb_socket, iov, iovcnt)) < 0)
+	{
+	  int sockerr = GetSockError();
+
+	  if (sockerr == EINTR && !RTMP_ctrlC)
+	    continue;
+	  if (sockerr == EWOULDBLOCK || sockerr == EAGAIN)
+	    {
+	      nBytes = 0;
+	      break;
+	    }
+
+	  RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d vectors)",
+	      __FUNCTION__, sockerr, iovcnt);
+	  RTMP_Close(r);
+	  return FALSE;
+	}
+    }
+
+  sent = nBytes;
+  sb->sb_bytesOut += nBytes;
+  for (i = 0; i < iovcnt; i++)
+    buffered += iov[i].iov_len;
+  buffered -= sent;
+  if (sb->sb_outLen + buffered > sb->sb_outLimit)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, %d pending bytes would exceed the limit of %d",
+	  __FUNCTION__, sb->sb_outLen + buffered, sb->sb_outLimit);
+      sb->sb_outLen = 0;
+      sb->sb_outStart = 0;
+      RTMP_Close(r);
+      return FALSE;
+    }
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (nBytes >= (ssize_t)iov[i].iov_len)
+	{
+	  nBytes -= iov[i].iov_len;
+	  continue;
+	}
+      if (!SockBuf_Append(sb, (char *)iov[i].iov_base + nBytes,
+			  iov[i].iov_len - nBytes))
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, failed to buffer %d pending bytes",
+	      __FUNCTION__, sb->sb_outLen);
+	  sb->sb_outLen = 0;
+	  sb->sb_outStart = 0;
+	  RTMP_Close(r);
+	  return FALSE;
+	}
+      nBytes = 0;
+    }
+  if (buffered)
+    RTMP_Trace(RTMP_TRACE_BACKLOG, sent, buffered, sb->sb_outLen, 0);
+  return TRUE;
+}
+#endif
+
+static int
+WriteN(RTMP *r, const char *buffer, int n)
+{
+  const char *ptr = buffer;
+#ifdef CRYPTO
+  char *encrypted = 0;
+  char buf[RTMP_BUFFER_CACHE_SIZE];
+
+  if (r->Link.rc4keyOut)
+    {
+      if (n > sizeof(buf))
+	encrypted = (char *)malloc(n);
+      else
+	encrypted = (char *)buf;
+      ptr = encrypted;
+      RC4_encrypt2(r->Link.rc4keyOut, n, buffer, ptr);
+    }
+#endif
+
+#ifdef __linux__
+  if (r->m_sb.sb_nonblock)
+    {
+      struct iovec iov;
+
+      iov.iov_base = (char *)ptr;
+      iov.iov_len = n;
+      return WriteVNonBlock(r, &iov, 1);
+    }
+#endif
+
+  while (n > 0)
+    {
+      int nBytes;
+
+      if (r->Link.protocol & RTMP_FEATURE_HTTP)
+        nBytes = HTTP_Collect(r, ptr, n);
+      else
+        nBytes = RTMPSockBuf_Send(&r->m_sb, ptr, n);
+      /*RTMP_Log(RTMP_LOGDEBUG, "%s: %d\n", __FUNCTION__, nBytes); */
+
+      if (nBytes < 0)
+	{
+	  int sockerr = GetSockError();
+	  RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes)", __FUNCTION__,
+	      sockerr, n);
+
+	  if (sockerr == EINTR && !RTMP_ctrlC)
+	    continue;
+
+	  RTMP_Close(r);
+	  n = 1;
+	  break;
+	}
+
+      if (nBytes == 0)
+	break;
 
       n -= nBytes;
       ptr += nBytes;
@@ -1403,6 +2008,82 @@ WriteN(RTMP *r, const char *buffer, int n)
   return n == 0;
 }
 
+/* Write a gather list in as few syscalls as possible. Transports that
+ * need to see contiguous data (HTTP tunnelling, RC4, TLS) fall back to
+ * WriteN, which preserves their byte ordering.
+ */
+static int
+WriteV(RTMP *r, struct iovec *iov, int iovcnt)
+{
+  int i;
+
+  if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+      /* collected into the next RTMPT request */
+      for (i = 0; i < iovcnt; i++)
+	if (!WriteN(r, iov[i].iov_base, iov[i].iov_len))
+	  return FALSE;
+      return TRUE;
+    }
+
+#ifdef __linux__
+  if (r->m_sb.sb_nonblock)
+    return WriteVNonBlock(r, iov, iovcnt);
+#endif
+
+#ifndef _WIN32
+#ifdef CRYPTO
+  if (!r->Link.rc4keyOut && !r->m_sb.sb_ssl)
+#endif
+    {
+      while (iovcnt > 0)
+	{
+	  ssize_t nBytes;
+
+#ifdef _DEBUG
+	  for (i = 0; i < iovcnt; i++)
+	    fwrite(iov[i].iov_base, 1, iov[i].iov_len, netstackdump);
+#endif
+	  nBytes = writev(r->m_sb.sb_socket, iov, iovcnt);
+	  if (nBytes < 0)
+	    {
+	      int sockerr = GetSockError();
+	      RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d vectors)",
+		  __FUNCTION__, sockerr, iovcnt);
+
+	      if (sockerr == EINTR && !RTMP_ctrlC)
+		continue;
+
+	      RTMP_Close(r);
+	      return FALSE;
+	    }
+	  if (nBytes == 0)
+	    return FALSE;
+	  r->m_sb.sb_bytesOut += nBytes;
+
+	  /* skip what went out, resume inside a partially sent vector */
+	  while (iovcnt > 0 && nBytes >= (ssize_t)iov->iov_len)
+	    {
+	      nBytes -= iov->iov_len;
+	      iov++;
+	      iovcnt--;
+	    }
+	  if (iovcnt > 0)
+	    {
+	      iov->iov_base = (char *)iov->iov_base + nBytes;
+	      iov->iov_len -= nBytes;
+	    }
+	}
+      return TRUE;
+    }
+#endif
+
+  for (i = 0; i < iovcnt; i++)
+    if (!WriteN(r, iov[i].iov_base, iov[i].iov_len))
+      return FALSE;
+  return TRUE;
+}
+
 #define SAVC(x)	static const AVal av_##x = AVC(#x)
 
 SAVC(app);
@@ -1520,7 +2201,20 @@ SendConnectPacket(RTMP *r, RTMPPacket *cp)
     }
   if (r->Link.extras.o_num)
     {
-      int i;
+      int i, nSize = 0;
+      for (i = 0; i < r->Link.extras.o_num; i++)
+	{
+	  int nRes = AMFProp_EncodedSize(&r->Link.extras.o_props[i]);
+	  if (nRes == -1)
+	    return FALSE;
+	  nSize += nRes;
+	}
+      if (nSize > pend - enc)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, connect options need %d bytes, only %d left",
+	      __FUNCTION__, nSize, (int)(pend - enc));
+	  return FALSE;
+	}
       for (i = 0; i < r->Link.extras.o_num; i++)
 	{
 	  enc = AMFProp_Encode(&r->Link.extras.o_props[i], enc, pend);
@@ -1813,7 +2507,7 @@ RTMP_SendPause(RTMP *r, int DoPause, int iTime)
 int RTMP_Pause(RTMP *r, int DoPause)
 {
   if (DoPause)
-    r->m_pauseStamp = r->m_channelTimestamp[r->m_mediaChannel];
+    r->m_pauseStamp = ChannelTimestamp(r, r->m_mediaChannel);
   return RTMP_SendPause(r, DoPause, r->m_pauseStamp);
 }
 
@@ -1868,6 +2562,47 @@ RTMP_SendServerBW(RTMP *r)
   return RTMP_SendPacket(r, &packet, FALSE);
 }
 
+int
+RTMP_SendChunkSize(RTMP *r, int chunkSize)
+{
+  RTMPPacket packet;
+  char pbuf[256], *pend = pbuf + sizeof(pbuf);
+
+  if (chunkSize < 1)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, invalid chunk size %d", __FUNCTION__,
+	  chunkSize);
+      return FALSE;
+    }
+  if (chunkSize > RTMP_MAX_CHUNKSIZE)
+    {
+      RTMP_Log(RTMP_LOGWARNING, "%s, chunk size %d clamped to %d",
+	  __FUNCTION__, chunkSize, RTMP_MAX_CHUNKSIZE);
+      chunkSize = RTMP_MAX_CHUNKSIZE;
+    }
+
+  packet.m_nChannel = 0x02;	/* control channel (invoke) */
+  packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+  packet.m_packetType = 0x01;	/* Set Chunk Size */
+  packet.m_nTimeStamp = 0;
+  packet.m_nInfoField2 = 0;
+  packet.m_hasAbsTimestamp = 0;
+  packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
+
+  packet.m_nBodySize = 4;
+
+  AMF_EncodeInt32(packet.m_body, pend, chunkSize);
+  if (!RTMP_SendPacket(r, &packet, FALSE))
+    return FALSE;
+
+  /* only takes effect once the peer has seen it */
+  r->m_outChunkSize = chunkSize;
+  RTMP_Trace(RTMP_TRACE_CHUNKSIZE, 1, chunkSize, 0, 0);
+  RTMP_Log(RTMP_LOGDEBUG, "%s, set outbound chunk size to %d", __FUNCTION__,
+      chunkSize);
+  return TRUE;
+}
+
 int
 RTMP_SendClientBW(RTMP *r)
 {
@@ -1907,6 +2642,7 @@ SendBytesReceived(RTMP *r)
 
   AMF_EncodeInt32(packet.m_body, pend, r->m_nBytesIn);	/* hard coded for now */
   r->m_nBytesInSent = r->m_nBytesIn;
+  RTMP_Trace(RTMP_TRACE_ACK, r->m_nBytesIn, 0, 0, 0);
 
   /*RTMP_Log(RTMP_LOGDEBUG, "Send bytes report. 0x%x (%d bytes)", (unsigned int)m_nBytesIn, m_nBytesIn); */
   return RTMP_SendPacket(r, &packet, FALSE);
@@ -2202,48 +2938,199 @@ RTMP_SendCtrl(RTMP *r, short nType, unsigned int nObject, unsigned int nTime)
   return RTMP_SendPacket(r, &packet, FALSE);
 }
 
-static void
-AV_erase(RTMP_METHOD *vals, int *num, int i, int freeit)
+/* Pending calls live in slots of m_methodCalls that never move, found
+ * by txn through m_callMap and, for the kinds we track, by name through
+ * the m_callOldest / m_callNewest lists. Queueing a call and matching its
+ * reply are O(1) however many calls are outstanding.
+ */
+static int
+CallMapGrow(RTMP *r)
 {
-  if (freeit)
-    free(vals[i].name.av_val);
-  (*num)--;
-  for (; i < *num; i++)
+  int i, size = r->m_callMapSize ? r->m_callMapSize * 2 : 16;
+  int *map = calloc(size, sizeof(int));
+
+  if (!map)
+    return FALSE;
+  for (i = 0; i < r->m_callMapSize; i++)
     {
-      vals[i] = vals[i + 1];
+      int s = r->m_callMap[i], h;
+
+      if (!s)
+	continue;
+      for (h = ChannelHash(r->m_methodCalls[s - 1].num, size); map[h];
+	   h = (h + 1) & (size - 1))
+	;
+      map[h] = s;
     }
-  vals[i].name.av_val = NULL;
-  vals[i].name.av_len = 0;
-  vals[i].num = 0;
+  free(r->m_callMap);
+  r->m_callMap = map;
+  r->m_callMapSize = size;
+  return TRUE;
 }
 
-void
-RTMP_DropRequest(RTMP *r, int i, int freeit)
+static int
+CallQueue(RTMP *r, const AVal *method, int txn)
+{
+  RTMP_METHOD *m;
+  char *name;
+  int s, h, kind;
+
+  if ((r->m_numCalls + 1) * 4 > r->m_callMapSize * 3 && !CallMapGrow(r))
+    return FALSE;
+  if (!r->m_callFree)
+    {
+      int i, n = r->m_callSlots ? r->m_callSlots * 2 : 16;
+      RTMP_METHOD *calls = realloc(r->m_methodCalls, n * sizeof(RTMP_METHOD));
+
+      if (!calls)
+	return FALSE;
+      memset(calls + r->m_callSlots, 0,
+	     (n - r->m_callSlots) * sizeof(RTMP_METHOD));
+      for (i = n; i > r->m_callSlots; i--)
+	{
+	  calls[i - 1].newer = r->m_callFree;
+	  r->m_callFree = i;
+	}
+      r->m_methodCalls = calls;
+      r->m_callSlots = n;
+    }
+  name = malloc(method->av_len + 1);
+  if (!name)
+    return FALSE;
+  memcpy(name, method->av_val, method->av_len);
+  name[method->av_len] = '\0';
+
+  s = r->m_callFree;
+  m = &r->m_methodCalls[s - 1];
+  r->m_callFree = m->newer;
+  m->name.av_val = name;
+  m->name.av_len = method->av_len;
+  m->num = txn;
+  m->older = m->newer = 0;
+
+  kind = MethodId(method);
+  if (kind < 0 || kind >= RTMP_CALL_KINDS)
+    kind = RTMP_CALL_KINDS;
+  m->kind = kind;
+  if (kind < RTMP_CALL_KINDS)
+    {
+      m->older = r->m_callNewest[kind];
+      if (m->older)
+	r->m_methodCalls[m->older - 1].newer = s;
+      else
+	r->m_callOldest[kind] = s;
+      r->m_callNewest[kind] = s;
+    }
+
+  for (h = ChannelHash(txn, r->m_callMapSize); r->m_callMap[h];
+       h = (h + 1) & (r->m_callMapSize - 1))
+    ;
+  r->m_callMap[h] = s;
+  r->m_numCalls++;
+  return TRUE;
+}
+
+/* slot of the pending call with this txn, -1 if there is none */
+static int
+CallFind(RTMP *r, int txn)
+{
+  int h;
+
+  if (!r->m_callMapSize)
+    return -1;
+  for (h = ChannelHash(txn, r->m_callMapSize); r->m_callMap[h];
+       h = (h + 1) & (r->m_callMapSize - 1))
+    {
+      if (r->m_methodCalls[r->m_callMap[h] - 1].num == txn)
+	return r->m_callMap[h] - 1;
+    }
+  return -1;
+}
+
+/* slot of the oldest pending call of this kind, -1 if there is none */
+static int
+CallOldest(RTMP *r, int kind)
 {
-  AV_erase(r->m_methodCalls, &r->m_numCalls, i, freeit);
+  return r->m_callOldest[kind] - 1;
 }
 
 static void
-AV_queue(RTMP_METHOD **vals, int *num, AVal *av, int txn)
+CallDrop(RTMP *r, int i, int freeit)
+{
+  RTMP_METHOD *m = &r->m_methodCalls[i];
+  int mask = r->m_callMapSize - 1;
+  int h, j;
+
+  if (!m->name.av_val)
+    return;
+
+  /* Remove from the txn map by shifting later entries of the probe
+   * chain back into the hole, unless their home slot lies cyclically
+   * between the hole and where they are now.
+   */
+  for (h = ChannelHash(m->num, r->m_callMapSize); r->m_callMap[h] != i + 1;
+       h = (h + 1) & mask)
+    ;
+  for (j = (h + 1) & mask; r->m_callMap[j]; j = (j + 1) & mask)
+    {
+      int k = ChannelHash(r->m_methodCalls[r->m_callMap[j] - 1].num,
+			  r->m_callMapSize);
+
+      if (h < j ? (k <= h || k > j) : (k <= h && k > j))
+	{
+	  r->m_callMap[h] = r->m_callMap[j];
+	  h = j;
+	}
+    }
+  r->m_callMap[h] = 0;
+
+  if (m->kind < RTMP_CALL_KINDS)
+    {
+      if (m->older)
+	r->m_methodCalls[m->older - 1].newer = m->newer;
+      else
+	r->m_callOldest[m->kind] = m->newer;
+      if (m->newer)
+	r->m_methodCalls[m->newer - 1].older = m->older;
+      else
+	r->m_callNewest[m->kind] = m->older;
+    }
+
+  if (freeit)
+    free(m->name.av_val);
+  m->name.av_val = NULL;
+  m->name.av_len = 0;
+  m->num = 0;
+  m->older = 0;
+  m->newer = r->m_callFree;
+  r->m_callFree = i + 1;
+  r->m_numCalls--;
+}
+
+void
+RTMP_DropRequest(RTMP *r, int i, int freeit)
 {
-  char *tmp;
-  if (!(*num & 0x0f))
-    *vals = realloc(*vals, (*num + 16) * sizeof(RTMP_METHOD));
-  tmp = malloc(av->av_len + 1);
-  memcpy(tmp, av->av_val, av->av_len);
-  tmp[av->av_len] = '\0';
-  (*vals)[*num].num = txn;
-  (*vals)[*num].name.av_len = av->av_len;
-  (*vals)[(*num)++].name.av_val = tmp;
+  if (i >= 0 && i < r->m_callSlots)
+    CallDrop(r, i, freeit);
 }
 
 static void
-AV_clear(RTMP_METHOD *vals, int num)
+CallClear(RTMP *r)
 {
   int i;
-  for (i = 0; i < num; i++)
-    free(vals[i].name.av_val);
-  free(vals);
+
+  for (i = 0; i < r->m_callSlots; i++)
+    free(r->m_methodCalls[i].name.av_val);
+  free(r->m_methodCalls);
+  free(r->m_callMap);
+  r->m_methodCalls = NULL;
+  r->m_numCalls = 0;
+  r->m_callSlots = 0;
+  r->m_callFree = 0;
+  r->m_callMap = NULL;
+  r->m_callMapSize = 0;
+  memset(r->m_callOldest, 0, sizeof(r->m_callOldest));
+  memset(r->m_callNewest, 0, sizeof(r->m_callNewest));
 }
 
 SAVC(onBWDone);
@@ -2255,6 +3142,7 @@ SAVC(_error);
 SAVC(close);
 SAVC(code);
 SAVC(level);
+SAVC(description);
 SAVC(onStatus);
 SAVC(playlist_ready);
 static const AVal av_NetStream_Failed = AVC("NetStream.Failed");
@@ -2271,239 +3159,446 @@ static const AVal av_NetStream_Pause_Notify = AVC("NetStream.Pause.Notify");
 static const AVal av_NetStream_Play_UnpublishNotify =
 AVC("NetStream.Play.UnpublishNotify");
 static const AVal av_NetStream_Publish_Start = AVC("NetStream.Publish.Start");
+static const AVal av_NetStream_Publish_BadName =
+AVC("NetStream.Publish.BadName");
+static const AVal av_NetConnection_Connect_Rejected =
+AVC("NetConnection.Connect.Rejected");
 
-/* Returns 0 for OK/Failed/error, 1 for 'Stop or Complete' */
-static int
-HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
+/* Start of the nIndex'th value of an invoke body, NULL if there is none.
+ * *len is updated to the bytes left from there on.
+ */
+static const char *
+InvokeArg(const char *body, int *len, int nIndex)
 {
-  AMFObject obj;
-  AVal method;
-  int txn;
-  int ret = 0, nRes;
-  if (body[0] != 0x02)		/* make sure it is a string method name we start with */
+  while (nIndex-- > 0)
     {
-      RTMP_Log(RTMP_LOGWARNING, "%s, Sanity failed. no string method in invoke packet",
-	  __FUNCTION__);
-      return 0;
+      int nRes = AMFProp_Skip(body, *len, FALSE);
+      if (nRes == -1)
+	return NULL;
+      body += nRes;
+      *len -= nRes;
     }
+  return *len > 0 ? body : NULL;
+}
 
-  nRes = AMF_Decode(&obj, body, nBodySize, FALSE);
-  if (nRes < 0)
-    {
-      RTMP_Log(RTMP_LOGERROR, "%s, error decoding invoke packet", __FUNCTION__);
-      return 0;
-    }
+static void
+GetStatusString(RTMP *r, const char *info, int len, const AVal *name,
+		AVal *out)
+{
+  AMFObjectProperty prop;
 
-  AMF_Dump(&obj);
-  AMFProp_GetString(AMF_GetProp(&obj, NULL, 0), &method);
-  txn = (int)AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 1));
-  RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%s>", __FUNCTION__, method.av_val);
+  if (AMF_Lookup(info, len, 0, name, &prop, &r->m_amfArena)
+      && AMFProp_GetType(&prop) == AMF_STRING)
+    AMFProp_GetString(&prop, out);
+  else
+    out->av_val = NULL, out->av_len = 0;
+}
 
-  if (AVMATCH(&method, &av__result))
-    {
-      AVal methodInvoked = {0};
-      int i;
+/* hand the info object of onStatus / _error to the status callback */
+static void
+NotifyStatus(RTMP *r, const char *info, int len, int fatal)
+{
+  AVal level, code, description;
 
-      for (i=0; i<r->m_numCalls; i++) {
-  	if (r->m_methodCalls[i].num == txn) {
-	  methodInvoked = r->m_methodCalls[i].name;
-	  AV_erase(r->m_methodCalls, &r->m_numCalls, i, FALSE);
-	  break;
-	}
-      }
-      if (!methodInvoked.av_val) {
-        RTMP_Log(RTMP_LOGDEBUG, "%s, received result id %d without matching request",
-	  __FUNCTION__, txn);
-	goto leave;
-      }
+  if (!r->m_statusCb || !info
+      || (*info != AMF_OBJECT && *info != AMF_ECMA_ARRAY))
+    return;
+  GetStatusString(r, info, len, &av_level, &level);
+  GetStatusString(r, info, len, &av_code, &code);
+  GetStatusString(r, info, len, &av_description, &description);
+  r->m_statusCb(r->m_statusCtx, &level, &code, &description, fatal);
+}
 
-      RTMP_Log(RTMP_LOGDEBUG, "%s, received result for method call <%s>", __FUNCTION__,
-	  methodInvoked.av_val);
+/* Invoke handlers, picked by method name from InvokeMethods. They get
+ * the whole body and the txn and return what HandleInvoke returns.
+ */
+typedef int (RTMPInvokeHandler)(RTMP *r, const char *body,
+				unsigned int nBodySize, int txn);
 
-      if (AVMATCH(&methodInvoked, &av_connect))
-	{
-	  if (r->Link.token.av_len)
-	    {
-	      AMFObjectProperty p;
-	      if (RTMP_FindFirstMatchingProperty(&obj, &av_secureToken, &p))
-		{
-		  DecodeTEA(&r->Link.token, &p.p_vu.p_aval);
-		  SendSecureTokenResponse(r, &p.p_vu.p_aval);
-		}
-	    }
-	  if (r->Link.protocol & RTMP_FEATURE_WRITE)
-	    {
-	      SendReleaseStream(r);
-	      SendFCPublish(r);
-	    }
-	  else
-	    {
-	      RTMP_SendServerBW(r);
-	      RTMP_SendCtrl(r, 3, 0, 300);
-	    }
-	  RTMP_SendCreateStream(r);
+static int
+InvokeResult(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  AMFObjectProperty prop;
+  AMFObject obj;
+  AVal methodInvoked;
+  int i = CallFind(r, txn), kind;
+
+  if (i < 0)
+    {
+      RTMP_Log(RTMP_LOGDEBUG, "%s, received result id %d without matching request",
+	  __FUNCTION__, txn);
+      return 0;
+    }
+  methodInvoked = r->m_methodCalls[i].name;
+  kind = r->m_methodCalls[i].kind;
+  CallDrop(r, i, FALSE);
+
+  RTMP_Log(RTMP_LOGDEBUG, "%s, received result for method call <%s>", __FUNCTION__,
+      methodInvoked.av_val);
 
-	  if (!(r->Link.protocol & RTMP_FEATURE_WRITE))
+  switch (kind)
+    {
+    case INVOKE_connect:
+      if (r->Link.token.av_len)
+	{
+	  AMFObjectProperty p;
+	  if (AMF_DecodeArena(&obj, body, nBodySize, FALSE,
+			      &r->m_amfArena) >= 0
+	      && RTMP_FindFirstMatchingProperty(&obj, &av_secureToken, &p))
 	    {
-	      /* Send the FCSubscribe if live stream or if subscribepath is set */
-	      if (r->Link.subscribepath.av_len)
-	        SendFCSubscribe(r, &r->Link.subscribepath);
-	      else if (r->Link.lFlags & RTMP_LF_LIVE)
-	        SendFCSubscribe(r, &r->Link.playpath);
+	      DecodeTEA(&r->Link.token, &p.p_vu.p_aval);
+	      SendSecureTokenResponse(r, &p.p_vu.p_aval);
 	    }
 	}
-      else if (AVMATCH(&methodInvoked, &av_createStream))
+      if (r->Link.protocol & RTMP_FEATURE_WRITE)
+	{
+	  SendReleaseStream(r);
+	  SendFCPublish(r);
+	}
+      else
 	{
-	  r->m_stream_id = (int)AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 3));
+	  RTMP_SendServerBW(r);
+	  RTMP_SendCtrl(r, 3, 0, 300);
+	}
+      RTMP_SendCreateStream(r);
 
-	  if (r->Link.protocol & RTMP_FEATURE_WRITE)
-	    {
-	      SendPublish(r);
-	    }
-	  else
-	    {
-	      if (r->Link.lFlags & RTMP_LF_PLST)
-	        SendPlaylist(r);
-	      SendPlay(r);
-	      RTMP_SendCtrl(r, 3, r->m_stream_id, r->m_nBufferMS);
-	    }
+      if (!(r->Link.protocol & RTMP_FEATURE_WRITE))
+	{
+	  /* Send the FCSubscribe if live stream or if subscribepath is set */
+	  if (r->Link.subscribepath.av_len)
+	    SendFCSubscribe(r, &r->Link.subscribepath);
+	  else if (r->Link.lFlags & RTMP_LF_LIVE)
+	    SendFCSubscribe(r, &r->Link.playpath);
 	}
-      else if (AVMATCH(&methodInvoked, &av_play) ||
-      	AVMATCH(&methodInvoked, &av_publish))
+      break;
+
+    case INVOKE_createStream:
+      AMF_Lookup(body, nBodySize, 3, NULL, &prop, &r->m_amfArena);
+      r->m_stream_id = (int)AMFProp_GetNumber(&prop);
+
+      if (r->Link.protocol & RTMP_FEATURE_WRITE)
+	{
+	  SendPublish(r);
+	}
+      else
 	{
-	  r->m_bPlaying = TRUE;
+	  if (r->Link.lFlags & RTMP_LF_PLST)
+	    SendPlaylist(r);
+	  SendPlay(r);
+	  RTMP_SendCtrl(r, 3, r->m_stream_id, r->m_nBufferMS);
 	}
-      free(methodInvoked.av_val);
+      break;
+
+    case INVOKE_play:
+    case INVOKE_publish:
+      r->m_bPlaying = TRUE;
+      break;
     }
-  else if (AVMATCH(&method, &av_onBWDone))
+  free(methodInvoked.av_val);
+  return 0;
+}
+
+/* forget the oldest pending call of a kind answered by something else */
+static void
+CallAnswered(RTMP *r, int kind)
+{
+  int i = CallOldest(r, kind);
+
+  if (i >= 0)
+    CallDrop(r, i, TRUE);
+}
+
+static int
+InvokeOnBWDone(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  if (!r->m_nBWCheckCounter)
+    SendCheckBW(r);
+  return 0;
+}
+
+static int
+InvokeOnFCUnsubscribe(RTMP *r, const char *body, unsigned int nBodySize,
+		      int txn)
+{
+  RTMP_Close(r);
+  return 1;
+}
+
+static int
+InvokePing(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  SendPong(r, txn);
+  return 0;
+}
+
+static int
+InvokeOnBWCheck(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  SendCheckBWResult(r, txn);
+  return 0;
+}
+
+static int
+InvokeOnBWCheckDone(RTMP *r, const char *body, unsigned int nBodySize,
+		    int txn)
+{
+  CallAnswered(r, INVOKE__checkbw);
+  return 0;
+}
+
+static int
+InvokeError(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  int len = nBodySize;
+  const char *info = InvokeArg(body, &len, 3);
+  int i = CallFind(r, txn), kind, fatal;
+
+  if (i < 0)
     {
-	  if (!r->m_nBWCheckCounter)
-        SendCheckBW(r);
+      RTMP_Log(RTMP_LOGWARNING, "rtmp server sent error for unknown id %d", txn);
+      NotifyStatus(r, info, len, FALSE);
+      return 0;
     }
-  else if (AVMATCH(&method, &av_onFCSubscribe))
+
+  /* Only a refused connect, createStream or publish ends the session.
+   * Some servers answer releaseStream or FCPublish with _error.
+   */
+  kind = r->m_methodCalls[i].kind;
+  fatal = kind == INVOKE_connect || kind == INVOKE_createStream
+    || kind == INVOKE_publish;
+  RTMP_Log(fatal ? RTMP_LOGERROR : RTMP_LOGWARNING,
+      "rtmp server sent error for <%s>", r->m_methodCalls[i].name.av_val);
+  CallDrop(r, i, TRUE);
+  NotifyStatus(r, info, len, fatal);
+  return 0;
+}
+
+static int
+InvokeClose(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  RTMP_Log(RTMP_LOGERROR, "rtmp server requested close");
+  RTMP_Close(r);
+  return 0;
+}
+
+static int
+InvokeOnStatus(RTMP *r, const char *body, unsigned int nBodySize, int txn)
+{
+  int len = nBodySize;
+  const char *info = InvokeArg(body, &len, 3);
+  AVal code;
+
+  if (info)
+    GetStatusString(r, info, len, &av_code, &code);
+  else
+    code.av_val = NULL, code.av_len = 0;
+
+  RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %.*s", __FUNCTION__,
+      code.av_len, code.av_val);
+  NotifyStatus(r, info, len, AVMATCH(&code, &av_NetStream_Publish_BadName)
+	       || AVMATCH(&code, &av_NetConnection_Connect_Rejected));
+  if (AVMATCH(&code, &av_NetStream_Failed)
+      || AVMATCH(&code, &av_NetStream_Play_Failed)
+      || AVMATCH(&code, &av_NetStream_Play_StreamNotFound)
+      || AVMATCH(&code, &av_NetConnection_Connect_InvalidApp))
     {
-      /* SendOnFCSubscribe(); */
+      r->m_stream_id = -1;
+      RTMP_Close(r);
+      RTMP_Log(RTMP_LOGERROR, "Closing connection: %.*s", code.av_len,
+	  code.av_val);
     }
-  else if (AVMATCH(&method, &av_onFCUnsubscribe))
+
+  else if (AVMATCH(&code, &av_NetStream_Play_Start))
     {
-      RTMP_Close(r);
-      ret = 1;
+      r->m_bPlaying = TRUE;
+      CallAnswered(r, INVOKE_play);
     }
-  else if (AVMATCH(&method, &av_ping))
+
+  else if (AVMATCH(&code, &av_NetStream_Publish_Start))
     {
-      SendPong(r, txn);
+      r->m_bPlaying = TRUE;
+      CallAnswered(r, INVOKE_publish);
     }
-  else if (AVMATCH(&method, &av__onbwcheck))
+
+  /* Return 1 if this is a Play.Complete or Play.Stop */
+  else if (AVMATCH(&code, &av_NetStream_Play_Complete)
+      || AVMATCH(&code, &av_NetStream_Play_Stop)
+      || AVMATCH(&code, &av_NetStream_Play_UnpublishNotify))
     {
-      SendCheckBWResult(r, txn);
+      RTMP_Close(r);
+      return 1;
     }
-  else if (AVMATCH(&method, &av__onbwdone))
+
+  else if (AVMATCH(&code, &av_NetStream_Seek_Notify))
     {
-      int i;
-      for (i = 0; i < r->m_numCalls; i++)
-	if (AVMATCH(&r->m_methodCalls[i].name, &av__checkbw))
-	  {
-	    AV_erase(r->m_methodCalls, &r->m_numCalls, i, TRUE);
-	    break;
-	  }
+      r->m_read.flags &= ~RTMP_READ_SEEKING;
     }
-  else if (AVMATCH(&method, &av__error))
+
+  else if (AVMATCH(&code, &av_NetStream_Pause_Notify))
     {
-      RTMP_Log(RTMP_LOGERROR, "rtmp server sent error");
+      if (r->m_pausing == 1 || r->m_pausing == 2)
+	{
+	  RTMP_SendPause(r, FALSE, r->m_pauseStamp);
+	  r->m_pausing = 3;
+	}
     }
-  else if (AVMATCH(&method, &av_close))
+  return 0;
+}
+
+static int
+InvokePlaylistReady(RTMP *r, const char *body, unsigned int nBodySize,
+		    int txn)
+{
+  CallAnswered(r, INVOKE_set_playlist);
+  return 0;
+}
+
+/* Indexed by the INVOKE_ ids. The first RTMP_CALL_KINDS are calls we
+ * make and keep per-name lists for, they have no handler as the server
+ * doesn't invoke them on us. onFCSubscribe is known but ignored.
+ */
+static const struct
+{
+  const AVal *name;
+  RTMPInvokeHandler *handler;
+} InvokeMethods[INVOKE_COUNT] = {
+  { &av_connect, NULL },
+  { &av_createStream, NULL },
+  { &av_play, NULL },
+  { &av_publish, NULL },
+  { &av__checkbw, NULL },
+  { &av_set_playlist, NULL },
+  { &av__result, InvokeResult },
+  { &av_onBWDone, InvokeOnBWDone },
+  { &av_onFCSubscribe, NULL },
+  { &av_onFCUnsubscribe, InvokeOnFCUnsubscribe },
+  { &av_ping, InvokePing },
+  { &av__onbwcheck, InvokeOnBWCheck },
+  { &av__onbwdone, InvokeOnBWCheckDone },
+  { &av__error, InvokeError },
+  { &av_close, InvokeClose },
+  { &av_onStatus, InvokeOnStatus },
+  { &av_playlist_ready, InvokePlaylistReady },
+};
+
+/* FNV-1a of the method names, open addressing over INVOKE_ id + 1 */
+#define INVOKE_INDEX_SIZE	64
+
+static uint32_t InvokeHashes[INVOKE_COUNT];
+static unsigned char InvokeIndex[INVOKE_INDEX_SIZE];
+
+static uint32_t
+MethodHash(const AVal *name)
+{
+  uint32_t h = 2166136261U;
+  int i;
+
+  for (i = 0; i < name->av_len; i++)
     {
-      RTMP_Log(RTMP_LOGERROR, "rtmp server requested close");
-      RTMP_Close(r);
+      h ^= (unsigned char)name->av_val[i];
+      h *= 16777619U;
     }
-  else if (AVMATCH(&method, &av_onStatus))
+  return h;
+}
+
+static void
+InvokeIndexInit(void)
+{
+  int i, k;
+
+  for (i = 0; i < INVOKE_COUNT; i++)
     {
-      AMFObject obj2;
-      AVal code, level;
-      AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &obj2);
-      AMFProp_GetString(AMF_GetProp(&obj2, &av_code, -1), &code);
-      AMFProp_GetString(AMF_GetProp(&obj2, &av_level, -1), &level);
+      InvokeHashes[i] = MethodHash(InvokeMethods[i].name);
+      for (k = InvokeHashes[i] & (INVOKE_INDEX_SIZE - 1); InvokeIndex[k];
+	   k = (k + 1) & (INVOKE_INDEX_SIZE - 1))
+	;
+      InvokeIndex[k] = i + 1;
+    }
+}
 
-      RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %s", __FUNCTION__, code.av_val);
-      if (AVMATCH(&code, &av_NetStream_Failed)
-	  || AVMATCH(&code, &av_NetStream_Play_Failed)
-	  || AVMATCH(&code, &av_NetStream_Play_StreamNotFound)
-	  || AVMATCH(&code, &av_NetConnection_Connect_InvalidApp))
-	{
-	  r->m_stream_id = -1;
-	  RTMP_Close(r);
-	  RTMP_Log(RTMP_LOGERROR, "Closing connection: %s", code.av_val);
-	}
+/* RTMP_Init may run on several threads at once (one RTMP each), the
+ * index is built by whichever gets there first */
+#ifdef _WIN32
+static INIT_ONCE InvokeIndexControl = INIT_ONCE_STATIC_INIT;
 
-      else if (AVMATCH(&code, &av_NetStream_Play_Start))
-	{
-	  int i;
-	  r->m_bPlaying = TRUE;
-	  for (i = 0; i < r->m_numCalls; i++)
-	    {
-	      if (AVMATCH(&r->m_methodCalls[i].name, &av_play))
-		{
-		  AV_erase(r->m_methodCalls, &r->m_numCalls, i, TRUE);
-		  break;
-		}
-	    }
-	}
+static BOOL CALLBACK
+InvokeIndexInitWin(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+  InvokeIndexInit();
+  return TRUE;
+}
 
-      else if (AVMATCH(&code, &av_NetStream_Publish_Start))
-	{
-	  int i;
-	  r->m_bPlaying = TRUE;
-	  for (i = 0; i < r->m_numCalls; i++)
-	    {
-	      if (AVMATCH(&r->m_methodCalls[i].name, &av_publish))
-		{
-		  AV_erase(r->m_methodCalls, &r->m_numCalls, i, TRUE);
-		  break;
-		}
-	    }
-	}
+static void
+InvokeIndexOnce(void)
+{
+  InitOnceExecuteOnce(&InvokeIndexControl, InvokeIndexInitWin, NULL, NULL);
+}
+#else
+static pthread_once_t InvokeIndexControl = PTHREAD_ONCE_INIT;
 
-      /* Return 1 if this is a Play.Complete or Play.Stop */
-      else if (AVMATCH(&code, &av_NetStream_Play_Complete)
-	  || AVMATCH(&code, &av_NetStream_Play_Stop)
-	  || AVMATCH(&code, &av_NetStream_Play_UnpublishNotify))
-	{
-	  RTMP_Close(r);
-	  ret = 1;
-	}
+static void
+InvokeIndexOnce(void)
+{
+  pthread_once(&InvokeIndexControl, InvokeIndexInit);
+}
+#endif
 
-      else if (AVMATCH(&code, &av_NetStream_Seek_Notify))
-        {
-	  r->m_read.flags &= ~RTMP_READ_SEEKING;
-	}
+/* INVOKE_ id of a method name, -1 if we don't know it */
+static int
+MethodId(const AVal *name)
+{
+  uint32_t h = MethodHash(name);
+  int k;
 
-      else if (AVMATCH(&code, &av_NetStream_Pause_Notify))
-        {
-	  if (r->m_pausing == 1 || r->m_pausing == 2)
-	  {
-	    RTMP_SendPause(r, FALSE, r->m_pauseStamp);
-	    r->m_pausing = 3;
-	  }
-	}
-    }
-  else if (AVMATCH(&method, &av_playlist_ready))
+  for (k = h & (INVOKE_INDEX_SIZE - 1); InvokeIndex[k];
+       k = (k + 1) & (INVOKE_INDEX_SIZE - 1))
     {
-      int i;
-      for (i = 0; i < r->m_numCalls; i++)
-        {
-          if (AVMATCH(&r->m_methodCalls[i].name, &av_set_playlist))
-	    {
-	      AV_erase(r->m_methodCalls, &r->m_numCalls, i, TRUE);
-	      break;
-	    }
-        }
+      int id = InvokeIndex[k] - 1;
+      if (InvokeHashes[id] == h && AVMATCH(InvokeMethods[id].name, name))
+	return id;
     }
-  else
+  return -1;
+}
+
+/* Returns 0 for OK/Failed/error, 1 for 'Stop or Complete' */
+static int
+HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
+{
+  AMFObject obj;
+  AMFObjectProperty prop;
+  AVal method;
+  int txn, id;
+  int ret = 0;
+  if (body[0] != 0x02)		/* make sure it is a string method name we start with */
     {
+      RTMP_Log(RTMP_LOGWARNING, "%s, Sanity failed. no string method in invoke packet",
+	  __FUNCTION__);
+      return 0;
+    }
 
+  /* Only the values a handler asks for are decoded (AMF_Lookup), the
+   * full tree is built for the debug dump and the secureToken search.
+   */
+  if (!AMF_Lookup(body, nBodySize, 0, NULL, &prop, &r->m_amfArena))
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, error decoding invoke packet", __FUNCTION__);
+      return 0;
     }
-leave:
-  AMF_Reset(&obj);
+  AMFProp_GetString(&prop, &method);
+  AMF_Lookup(body, nBodySize, 1, NULL, &prop, &r->m_amfArena);
+  txn = (int)AMFProp_GetNumber(&prop);
+
+  if (RTMP_LogEnabled(RTMP_LOGDEBUG)
+      && AMF_DecodeArena(&obj, body, nBodySize, FALSE, &r->m_amfArena) >= 0)
+    AMF_Dump(&obj);
+  RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%.*s>", __FUNCTION__,
+      method.av_len, method.av_val);
+
+  id = MethodId(&method);
+  if (id >= 0 && InvokeMethods[id].handler)
+    ret = InvokeMethods[id].handler(r, body, nBodySize, txn);
+
+  AMFArena_Reset(&r->m_amfArena);
   return ret;
 }
 
@@ -2623,14 +3718,16 @@ HandleMetadata(RTMP *r, char *body, unsigned int len)
   AVal metastring;
   int ret = FALSE;
 
-  int nRes = AMF_Decode(&obj, body, len, FALSE);
+  int nRes = AMF_DecodeArena(&obj, body, len, FALSE, &r->m_amfArena);
   if (nRes < 0)
     {
       RTMP_Log(RTMP_LOGERROR, "%s, error decoding meta data packet", __FUNCTION__);
+      AMFArena_Reset(&r->m_amfArena);
       return FALSE;
     }
 
-  AMF_Dump(&obj);
+  if (RTMP_LogEnabled(RTMP_LOGDEBUG))
+    AMF_Dump(&obj);
   AMFProp_GetString(AMF_GetProp(&obj, NULL, 0), &metastring);
 
   if (AVMATCH(&metastring, &av_onMetaData))
@@ -2651,7 +3748,7 @@ HandleMetadata(RTMP *r, char *body, unsigned int len)
         r->m_read.dataType |= 4;
       ret = TRUE;
     }
-  AMF_Reset(&obj);
+  AMFArena_Reset(&r->m_amfArena);
   return ret;
 }
 
@@ -2661,6 +3758,7 @@ HandleChangeChunkSize(RTMP *r, const RTMPPacket *packet)
   if (packet->m_nBodySize >= 4)
     {
       r->m_inChunkSize = AMF_DecodeInt32(packet->m_body);
+      RTMP_Trace(RTMP_TRACE_CHUNKSIZE, 0, r->m_inChunkSize, 0, 0);
       RTMP_Log(RTMP_LOGDEBUG, "%s, received: chunk size change to %d", __FUNCTION__,
 	  r->m_inChunkSize);
     }
@@ -2685,6 +3783,9 @@ HandleCtrl(RTMP *r, const RTMPPacket *packet)
     nType = AMF_DecodeInt16(packet->m_body);
   RTMP_Log(RTMP_LOGDEBUG, "%s, received ctrl. type: %d, len: %d", __FUNCTION__, nType,
       packet->m_nBodySize);
+  RTMP_Trace(RTMP_TRACE_CTRL, (uint16_t)nType,
+	     packet->m_nBodySize >= 6 ? AMF_DecodeInt32(packet->m_body + 2) : 0,
+	     0, 0);
   /*RTMP_LogHex(packet.m_body, packet.m_nBodySize); */
 
   if (packet->m_nBodySize >= 6)
@@ -2762,7 +3863,7 @@ HandleCtrl(RTMP *r, const RTMPPacket *packet)
 	    break;
 	  if (!r->m_pausing)
 	    {
-	      r->m_pauseStamp = r->m_channelTimestamp[r->m_mediaChannel];
+	      r->m_pauseStamp = ChannelTimestamp(r, r->m_mediaChannel);
 	      RTMP_SendPause(r, TRUE, r->m_pauseStamp);
 	      r->m_pausing = 1;
 	    }
@@ -2853,6 +3954,78 @@ EncodeInt32LE(char *output, int nVal)
   return 4;
 }
 
+/* Headers can be parsed straight out of the receive buffer unless the
+ * bytes there still need decrypting or are framed by HTTP.
+ */
+static int
+ReadFromBuffer(RTMP *r)
+{
+  if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    return FALSE;
+#ifdef CRYPTO
+  if (r->Link.rc4keyIn)
+    return FALSE;
+#endif
+  return TRUE;
+}
+
+/* Size of the chunk header at the front of the buffer, 0 if incomplete */
+static int
+PeekHeaderSize(const RTMPSockBuf *sb)
+{
+  const uint8_t *p = (const uint8_t *)sb->sb_start;
+  int size, nSize;
+
+  if (sb->sb_size < 1)
+    return 0;
+  size = 1;
+  if ((p[0] & 0x3f) == 0)
+    size = 2;
+  else if ((p[0] & 0x3f) == 1)
+    size = 3;
+  nSize = packetSize[p[0] >> 6] - 1;
+  if (sb->sb_size < size + nSize)
+    return 0;
+  if (nSize >= 3 && AMF_DecodeInt24((const char *)p + size) == 0xffffff)
+    nSize += 4;
+  size += nSize;
+  return sb->sb_size >= size ? size : 0;
+}
+
+/* TRUE once the next chunk, header and body, is completely buffered.
+ * Type 2 and 3 headers take the message length from the channel, the
+ * same way RTMP_ReadPacket does.
+ */
+static int
+ChunkBuffered(RTMP *r, const RTMPPacket *packet)
+{
+  const uint8_t *p = (const uint8_t *)r->m_sb.sb_start;
+  int hSize = PeekHeaderSize(&r->m_sb);
+  int basic = 1, id, left;
+
+  if (!hSize)
+    return FALSE;
+  id = p[0] & 0x3f;
+  if (id == 0)
+    id = p[1] + 64, basic = 2;
+  else if (id == 1)
+    id = (p[2] << 8) + p[1] + 64, basic = 3;
+
+  if ((p[0] >> 6) <= 1)
+    left = AMF_DecodeInt24((const char *)p + basic + 3);
+  else
+    {
+      RTMPChannel *channel = GetChannel(r, id, FALSE);
+
+      if (channel && channel->ch_in)
+	packet = channel->ch_in;
+      left = packet->m_nBodySize - packet->m_nBytesRead;
+    }
+  if (left > r->m_inChunkSize)
+    left = r->m_inChunkSize;
+  return r->m_sb.sb_size >= hSize + left;
+}
+
 int
 RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 {
@@ -2860,10 +4033,21 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
   char *header = (char *)hbuf;
   int nSize, hSize, nToRead, nChunk;
   int didAlloc = FALSE;
+  RTMPChannel *channel;
+  int fast = ReadFromBuffer(r);
+  int hBuffered = 0;
 
   RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d", __FUNCTION__, r->m_sb.sb_socket);
 
-  if (ReadN(r, (char *)hbuf, 1) == 0)
+  /* a header that is already buffered is taken in one go */
+  if (fast && (hBuffered = PeekHeaderSize(&r->m_sb)) > 0)
+    {
+      memcpy(hbuf, r->m_sb.sb_start, hBuffered);
+      r->m_sb.sb_start += hBuffered;
+      r->m_sb.sb_size -= hBuffered;
+      BytesIn(r, hBuffered);
+    }
+  else if (ReadN(r, (char *)hbuf, 1) == 0)
     {
       RTMP_Log(RTMP_LOGERROR, "%s, failed to read RTMP packet header", __FUNCTION__);
       return FALSE;
@@ -2874,7 +4058,7 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
   header++;
   if (packet->m_nChannel == 0)
     {
-      if (ReadN(r, (char *)&hbuf[1], 1) != 1)
+      if (!hBuffered && ReadN(r, (char *)&hbuf[1], 1) != 1)
 	{
 	  RTMP_Log(RTMP_LOGERROR, "%s, failed to read RTMP packet header 2nd byte",
 	      __FUNCTION__);
@@ -2887,7 +4071,7 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
   else if (packet->m_nChannel == 1)
     {
       int tmp;
-      if (ReadN(r, (char *)&hbuf[1], 2) != 2)
+      if (!hBuffered && ReadN(r, (char *)&hbuf[1], 2) != 2)
 	{
 	  RTMP_Log(RTMP_LOGERROR, "%s, failed to read RTMP packet header 3nd byte",
 	      __FUNCTION__);
@@ -2906,14 +4090,14 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 
   else if (nSize < RTMP_LARGE_HEADER_SIZE)
     {				/* using values from the last message of this channel */
-      if (r->m_vecChannelsIn[packet->m_nChannel])
-	memcpy(packet, r->m_vecChannelsIn[packet->m_nChannel],
-	       sizeof(RTMPPacket));
+      channel = GetChannel(r, packet->m_nChannel, FALSE);
+      if (channel && channel->ch_in)
+	memcpy(packet, channel->ch_in, sizeof(RTMPPacket));
     }
 
   nSize--;
 
-  if (nSize > 0 && ReadN(r, header, nSize) != nSize)
+  if (nSize > 0 && !hBuffered && ReadN(r, header, nSize) != nSize)
     {
       RTMP_Log(RTMP_LOGERROR, "%s, failed to read RTMP packet header. type: %x",
 	  __FUNCTION__, (unsigned int)hbuf[0]);
@@ -2944,7 +4128,7 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 	}
       if (packet->m_nTimeStamp == 0xffffff)
 	{
-	  if (ReadN(r, header + nSize, 4) != 4)
+	  if (!hBuffered && ReadN(r, header + nSize, 4) != 4)
 	    {
 	      RTMP_Log(RTMP_LOGERROR, "%s, failed to read extended timestamp",
 		  __FUNCTION__);
@@ -2993,24 +4177,62 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 
   packet->m_nBytesRead += nChunk;
 
+  /* Continuation chunks of this message that follow right behind in the
+   * buffer are appended in place instead of returning to the caller once
+   * per chunk. Only the 1-byte type 3 header is checked, and only chunks
+   * that have fully arrived are taken.
+   */
+  while (fast && !packet->m_chunk && !RTMPPacket_IsReady(packet)
+	 && packet->m_nChannel < 64 && r->m_sb.sb_size > 0
+	 && (uint8_t)r->m_sb.sb_start[0] == (0xc0 | packet->m_nChannel)
+	 && (r->m_sb.sb_size > r->m_inChunkSize
+	     || (uint32_t)r->m_sb.sb_size > packet->m_nBodySize - packet->m_nBytesRead))
+    {
+      r->m_sb.sb_start++;
+      r->m_sb.sb_size--;
+      BytesIn(r, 1);
+
+      nChunk = packet->m_nBodySize - packet->m_nBytesRead;
+      if (nChunk > r->m_inChunkSize)
+	nChunk = r->m_inChunkSize;
+      if (ReadN(r, packet->m_body + packet->m_nBytesRead, nChunk) != nChunk)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, failed to read RTMP packet body. len: %lu",
+	      __FUNCTION__, packet->m_nBodySize);
+	  return FALSE;
+	}
+      packet->m_nBytesRead += nChunk;
+    }
+
   /* keep the packet as ref for other packets on this channel */
-  if (!r->m_vecChannelsIn[packet->m_nChannel])
-    r->m_vecChannelsIn[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
-  memcpy(r->m_vecChannelsIn[packet->m_nChannel], packet, sizeof(RTMPPacket));
+  channel = GetChannel(r, packet->m_nChannel, TRUE);
+  if (channel && !channel->ch_in)
+    channel->ch_in = malloc(sizeof(RTMPPacket));
+  if (!channel || !channel->ch_in)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, failed to allocate channel %d", __FUNCTION__,
+	  packet->m_nChannel);
+      if (didAlloc)
+	RTMPPacket_Free(packet);
+      return FALSE;
+    }
+  memcpy(channel->ch_in, packet, sizeof(RTMPPacket));
 
   if (RTMPPacket_IsReady(packet))
     {
       /* make packet's timestamp absolute */
       if (!packet->m_hasAbsTimestamp)
-	packet->m_nTimeStamp += r->m_channelTimestamp[packet->m_nChannel];	/* timestamps seem to be always relative!! */
+	packet->m_nTimeStamp += channel->ch_timestamp;	/* timestamps seem to be always relative!! */
 
-      r->m_channelTimestamp[packet->m_nChannel] = packet->m_nTimeStamp;
+      channel->ch_timestamp = packet->m_nTimeStamp;
+      RTMP_Trace(RTMP_TRACE_RECV, packet->m_packetType, packet->m_nChannel,
+		 packet->m_nBodySize, packet->m_nTimeStamp);
 
       /* reset the data from the stored packet. we keep the header since we may use it later if a new packet for this channel */
       /* arrives and requests to re-use some info (small packet header) */
-      r->m_vecChannelsIn[packet->m_nChannel]->m_body = NULL;
-      r->m_vecChannelsIn[packet->m_nChannel]->m_nBytesRead = 0;
-      r->m_vecChannelsIn[packet->m_nChannel]->m_hasAbsTimestamp = FALSE;	/* can only be false if we reuse header */
+      channel->ch_in->m_body = NULL;
+      channel->ch_in->m_nBytesRead = 0;
+      channel->ch_in->m_hasAbsTimestamp = FALSE;	/* can only be false if we reuse header */
     }
   else
     {
@@ -3149,42 +4371,100 @@ SHandShake(RTMP *r)
 }
 #endif
 
-int
-RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
+/* Chunk headers are collected in w_hdr while bodies are referenced in
+ * place, so packet bodies are never modified and a whole batch of chunks
+ * leaves in a single writev().
+ */
+#define RTMP_IOV_MAX	256
+
+typedef struct RTMPChunkWriter
 {
-  int wrote;
-  char hbuf[RTMP_MAX_HEADER_SIZE];
+  int w_niov;
+  int w_hlen;
+  struct iovec w_iov[RTMP_IOV_MAX];
+  char w_hdr[RTMP_IOV_MAX / 2 * RTMP_MAX_HEADER_SIZE];
+} RTMPChunkWriter;
 
-  RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, r->m_sb.sb_socket,
-      chunk->c_chunkSize);
-  RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)chunk->c_header, chunk->c_headerSize);
-  if (chunk->c_chunkSize)
-    {
-      char *ptr = chunk->c_chunk - chunk->c_headerSize;
-      RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)chunk->c_chunk, chunk->c_chunkSize);
-      /* save header bytes we're about to overwrite */
-      memcpy(hbuf, ptr, chunk->c_headerSize);
-      memcpy(ptr, chunk->c_header, chunk->c_headerSize);
-      wrote = WriteN(r, ptr, chunk->c_headerSize + chunk->c_chunkSize);
-      memcpy(ptr, hbuf, chunk->c_headerSize);
-    }
-  else
-    wrote = WriteN(r, chunk->c_header, chunk->c_headerSize);
-  return wrote;
-}
+static int
+ChunkWriter_Flush(RTMP *r, RTMPChunkWriter *w)
+{
+  int ret = TRUE;
+
+  if (w->w_niov)
+    ret = WriteV(r, w->w_iov, w->w_niov);
+  w->w_niov = 0;
+  w->w_hlen = 0;
+  return ret;
+}
+
+static int
+ChunkWriter_Add(RTMP *r, RTMPChunkWriter *w, const char *header, int hSize,
+		const char *body, int bSize)
+{
+  if (w->w_niov + 2 > RTMP_IOV_MAX
+      || w->w_hlen + hSize > (int)sizeof(w->w_hdr))
+    {
+      if (!ChunkWriter_Flush(r, w))
+	return FALSE;
+    }
+
+  if (hSize)
+    {
+      char *hptr = w->w_hdr + w->w_hlen;
+
+      memcpy(hptr, header, hSize);
+      w->w_hlen += hSize;
+      w->w_iov[w->w_niov].iov_base = hptr;
+      w->w_iov[w->w_niov].iov_len = hSize;
+      w->w_niov++;
+    }
+  if (bSize)
+    {
+      w->w_iov[w->w_niov].iov_base = (char *)body;
+      w->w_iov[w->w_niov].iov_len = bSize;
+      w->w_niov++;
+    }
+  return TRUE;
+}
 
 int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
+{
+  RTMPChunkWriter w;
+
+  RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, r->m_sb.sb_socket,
+      chunk->c_chunkSize);
+  RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)chunk->c_header, chunk->c_headerSize);
+  if (chunk->c_chunkSize)
+    RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)chunk->c_chunk, chunk->c_chunkSize);
+
+  w.w_niov = 0;
+  w.w_hlen = 0;
+  ChunkWriter_Add(r, &w, chunk->c_header, chunk->c_headerSize,
+		  chunk->c_chunk, chunk->c_chunkSize);
+  return ChunkWriter_Flush(r, &w);
+}
+
+static int
+SendPacket(RTMP *r, RTMPChunkWriter *w, RTMPPacket *packet, int queue)
 {
-  const RTMPPacket *prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
+  RTMPChannel *channel = GetChannel(r, packet->m_nChannel, TRUE);
+  const RTMPPacket *prevPacket;
   uint32_t last = 0;
   int nSize;
   int hSize, cSize;
   char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
   uint32_t t;
-  char *buffer, *tbuf = NULL, *toff = NULL;
+  char *buffer;
   int nChunkSize;
-  int tlen;
+
+  if (!channel)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, failed to allocate channel %d", __FUNCTION__,
+	  packet->m_nChannel);
+      return FALSE;
+    }
+  prevPacket = channel->ch_out;
 
   if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
     {
@@ -3211,16 +4491,9 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
   hSize = nSize; cSize = 0;
   t = packet->m_nTimeStamp - last;
 
-  if (packet->m_body)
-    {
-      header = packet->m_body - nSize;
-      hend = packet->m_body;
-    }
-  else
-    {
-      header = hbuf + 6;
-      hend = hbuf + sizeof(hbuf);
-    }
+  /* the header is always built aside, never in front of the body */
+  header = hbuf + 6;
+  hend = hbuf + sizeof(hbuf);
 
   if (packet->m_nChannel > 319)
     cSize = 2;
@@ -3283,53 +4556,25 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
 
   RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, r->m_sb.sb_socket,
       nSize);
-  /* send all chunks in one HTTP request */
-  if (r->Link.protocol & RTMP_FEATURE_HTTP)
-    {
-      int chunks = (nSize+nChunkSize-1) / nChunkSize;
-      if (chunks > 1)
-        {
-	  tlen = chunks * (cSize + 1) + nSize + hSize;
-	  tbuf = malloc(tlen);
-	  if (!tbuf)
-	    return FALSE;
-	  toff = tbuf;
-	}
-    }
   while (nSize + hSize)
     {
-      int wrote;
-
       if (nSize < nChunkSize)
 	nChunkSize = nSize;
 
       RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)header, hSize);
       RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)buffer, nChunkSize);
-      if (tbuf)
-        {
-	  memcpy(toff, header, nChunkSize + hSize);
-	  toff += nChunkSize + hSize;
-	}
-      else
-        {
-	  wrote = WriteN(r, header, nChunkSize + hSize);
-	  if (!wrote)
-	    return FALSE;
-	}
+      if (!ChunkWriter_Add(r, w, header, hSize, buffer, nChunkSize))
+	return FALSE;
       nSize -= nChunkSize;
       buffer += nChunkSize;
       hSize = 0;
 
       if (nSize > 0)
 	{
-	  header = buffer - 1;
-	  hSize = 1;
-	  if (cSize)
-	    {
-	      header -= cSize;
-	      hSize += cSize;
-	    }
-	  *header = (0xc0 | c);
+	  /* continuation chunk: type 3 basic header only */
+	  header = hbuf;
+	  hSize = 1 + cSize;
+	  header[0] = (0xc0 | c);
 	  if (cSize)
 	    {
 	      int tmp = packet->m_nChannel - 64;
@@ -3339,14 +4584,9 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
 	    }
 	}
     }
-  if (tbuf)
-    {
-      int wrote = WriteN(r, tbuf, toff-tbuf);
-      free(tbuf);
-      tbuf = NULL;
-      if (!wrote)
-        return FALSE;
-    }
+
+  RTMP_Trace(RTMP_TRACE_SEND, packet->m_packetType, packet->m_nChannel,
+	     packet->m_nBodySize, packet->m_nTimeStamp);
 
   /* we invoked a remote method */
   if (packet->m_packetType == 0x14)
@@ -3361,13 +4601,87 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         int txn;
         ptr += 3 + method.av_len;
         txn = (int)AMF_DecodeNumber(ptr);
-	AV_queue(&r->m_methodCalls, &r->m_numCalls, &method, txn);
+	CallQueue(r, &method, txn);
       }
     }
 
-  if (!r->m_vecChannelsOut[packet->m_nChannel])
-    r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
-  memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+  if (!channel->ch_out)
+    channel->ch_out = malloc(sizeof(RTMPPacket));
+  if (channel->ch_out)
+    memcpy(channel->ch_out, packet, sizeof(RTMPPacket));
+  return TRUE;
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+  RTMPChunkWriter w;
+
+  w.w_niov = 0;
+  w.w_hlen = 0;
+  if (!SendPacket(r, &w, packet, queue))
+    return FALSE;
+  return ChunkWriter_Flush(r, &w);
+}
+
+/* Send several packets with as few writes as possible. Packets are
+ * chunked in order, so interleaving between channels is preserved.
+ */
+int
+RTMP_SendPackets(RTMP *r, RTMPPacket **packets, int n, int queue)
+{
+  RTMPChunkWriter w;
+  int i;
+
+  w.w_niov = 0;
+  w.w_hlen = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (!SendPacket(r, &w, packets[i], queue))
+	return FALSE;
+    }
+  return ChunkWriter_Flush(r, &w);
+}
+
+int
+RTMP_SendPacketsPaced(RTMP *r, RTMPPacket **packets, int n, int queue,
+		      int timeoutMs)
+{
+  uint32_t progress = RTMP_GetTime();
+  int i = 0, k, room, size, pending, left;
+
+  while (i < n)
+    {
+      room = RTMP_SendRoom(r);
+      for (k = i; k < n; k++)
+	{
+	  size = RTMP_PacketSize(r, packets[k]);
+	  if (size > room && (k > i || RTMP_Pending(r)))
+	    break;
+	  room -= size;
+	}
+      if (k > i)
+	{
+	  if (!RTMP_SendPackets(r, packets + i, k - i, queue))
+	    return FALSE;
+	  i = k;
+	  progress = RTMP_GetTime();
+	  continue;
+	}
+
+      pending = RTMP_Pending(r);
+      left = timeoutMs - (int)(RTMP_GetTime() - progress);
+      if (left <= 0)
+	{
+	  RTMP_Log(RTMP_LOGERROR, "%s, %d bytes pending for %d ms, %d packets not sent",
+	      __FUNCTION__, pending, timeoutMs, n - i);
+	  return FALSE;
+	}
+      if (RTMP_WaitWritable(r, left) < 0)
+	return FALSE;
+      if (RTMP_Pending(r) < pending)
+	progress = RTMP_GetTime();
+    }
   return TRUE;
 }
 
@@ -3394,19 +4708,28 @@ RTMP_Close(RTMP *r)
 	}
       if (r->m_clientID.av_val)
         {
+	  HTTP_FlushOut(r);
 	  HTTP_Post(r, RTMPT_CLOSE, "", 1);
 	  free(r->m_clientID.av_val);
 	  r->m_clientID.av_val = NULL;
 	  r->m_clientID.av_len = 0;
 	}
+      /* give the unpublish and whatever media is still buffered a chance */
+      if (r->m_sb.sb_nonblock && r->m_sb.sb_outLen)
+	RTMP_Drain(r, RTMP_CLOSE_DRAIN_MS);
+      RTMP_Trace(RTMP_TRACE_CLOSE, r->m_sb.sb_socket, r->m_nBytesIn,
+		 r->m_sb.sb_outLen, 0);
       RTMPSockBuf_Close(&r->m_sb);
     }
 
   r->m_stream_id = -1;
   r->m_sb.sb_socket = -1;
+  r->m_inChunkSize = RTMP_DEFAULT_CHUNKSIZE;
+  r->m_outChunkSize = RTMP_DEFAULT_CHUNKSIZE;
   r->m_nBWCheckCounter = 0;
   r->m_nBytesIn = 0;
   r->m_nBytesInSent = 0;
+  r->m_sb.sb_bytesOut = 0;
 
   if (r->m_read.flags & RTMP_READ_HEADER) {
     free(r->m_read.buf);
@@ -3422,31 +4745,41 @@ RTMP_Close(RTMP *r)
   r->m_write.m_nBytesRead = 0;
   RTMPPacket_Free(&r->m_write);
 
-  for (i = 0; i < RTMP_CHANNELS; i++)
+  for (i = 0; i < RTMP_CHANNELS_LOW; i++)
+    FreeChannel(&r->m_channels[i]);
+  for (i = 0; i < r->m_channelMapSize; i++)
     {
-      if (r->m_vecChannelsIn[i])
-	{
-	  RTMPPacket_Free(r->m_vecChannelsIn[i]);
-	  free(r->m_vecChannelsIn[i]);
-	  r->m_vecChannelsIn[i] = NULL;
-	}
-      if (r->m_vecChannelsOut[i])
-	{
-	  free(r->m_vecChannelsOut[i]);
-	  r->m_vecChannelsOut[i] = NULL;
-	}
+      if (r->m_channelMap[i].cs_id)
+	FreeChannel(&r->m_channelMap[i].cs_channel);
     }
-  AV_clear(r->m_methodCalls, r->m_numCalls);
-  r->m_methodCalls = NULL;
-  r->m_numCalls = 0;
+  free(r->m_channelMap);
+  r->m_channelMap = NULL;
+  r->m_channelMapSize = 0;
+  r->m_channelMapUsed = 0;
+  CallClear(r);
   r->m_numInvokes = 0;
 
   r->m_bPlaying = FALSE;
   r->m_sb.sb_size = 0;
+  r->m_sb.sb_nonblock = FALSE;
+  r->m_sb.sb_outStart = 0;
+  r->m_sb.sb_outLen = 0;
+  r->m_sb.sb_outSize = 0;
+  free(r->m_sb.sb_out);
+  r->m_sb.sb_out = NULL;
 
   r->m_msgCounter = 0;
   r->m_resplen = 0;
   r->m_unackd = 0;
+  r->m_httpState = RTMPT_STATUS;
+  r->m_httpLength = 0;
+  free(r->m_httpHeader.av_val);
+  r->m_httpHeader.av_val = NULL;
+  r->m_httpHeader.av_len = 0;
+  free(r->m_httpOut);
+  r->m_httpOut = NULL;
+  r->m_httpOutLen = 0;
+  r->m_httpOutSize = 0;
 
   free(r->Link.playpath0.av_val);
   r->Link.playpath0.av_val = NULL;
@@ -3477,17 +4810,36 @@ RTMP_Close(RTMP *r)
 #endif
 }
 
+static char *
+SockBuf_Base(RTMPSockBuf *sb)
+{
+  return sb->sb_rbuf ? sb->sb_rbuf : sb->sb_buf;
+}
+
+static int
+SockBuf_Capacity(const RTMPSockBuf *sb)
+{
+  return sb->sb_rbuf ? sb->sb_rbufSize : (int)sizeof(sb->sb_buf);
+}
+
 int
 RTMPSockBuf_Fill(RTMPSockBuf *sb)
 {
+  char *base = SockBuf_Base(sb);
   int nBytes;
 
   if (!sb->sb_size)
-    sb->sb_start = sb->sb_buf;
+    sb->sb_start = base;
+  else if (sb->sb_start + sb->sb_size == base + SockBuf_Capacity(sb))
+    {
+      /* no room behind the unread bytes, move them to the front */
+      memmove(base, sb->sb_start, sb->sb_size);
+      sb->sb_start = base;
+    }
 
   while (1)
     {
-      nBytes = sizeof(sb->sb_buf) - sb->sb_size - (sb->sb_start - sb->sb_buf);
+      nBytes = SockBuf_Capacity(sb) - sb->sb_size - (sb->sb_start - base);
 #if defined(CRYPTO) && !defined(NO_SSL)
       if (sb->sb_ssl)
 	{
@@ -3522,6 +4874,79 @@ RTMPSockBuf_Fill(RTMPSockBuf *sb)
   return nBytes;
 }
 
+#ifndef _WIN32
+/* Read for a caller that wants n bytes while nothing is buffered: one
+ * readv puts up to n bytes at dst and the surplus into the buffer.
+ * *direct is set to the bytes placed at dst; returns the total like
+ * RTMPSockBuf_Fill.
+ */
+static int
+RTMPSockBuf_FillDirect(RTMPSockBuf *sb, char *dst, int n, int *direct)
+{
+  struct iovec iov[2];
+  ssize_t nBytes;
+
+  sb->sb_start = SockBuf_Base(sb);
+  iov[0].iov_base = dst;
+  iov[0].iov_len = n;
+  iov[1].iov_base = sb->sb_start;
+  iov[1].iov_len = SockBuf_Capacity(sb);
+  *direct = 0;
+
+  while ((nBytes = readv(sb->sb_socket, iov, 2)) == -1)
+    {
+      int sockerr = GetSockError();
+      RTMP_Log(RTMP_LOGDEBUG, "%s, readv returned %d. GetSockError(): %d (%s)",
+	  __FUNCTION__, (int)nBytes, sockerr, strerror(sockerr));
+      if (sockerr == EINTR && !RTMP_ctrlC)
+	continue;
+
+      if (sockerr == EWOULDBLOCK || sockerr == EAGAIN)
+	{
+	  sb->sb_timedout = TRUE;
+	  return 0;
+	}
+      return -1;
+    }
+
+  if (nBytes > n)
+    {
+      *direct = n;
+      sb->sb_size = nBytes - n;
+    }
+  else
+    *direct = nBytes;
+  return nBytes;
+}
+#endif
+
+int
+RTMP_SetReceiveBuffer(RTMP *r, int size)
+{
+  RTMPSockBuf *sb = &r->m_sb;
+  char *buf = NULL;
+
+  if (size < (int)sizeof(sb->sb_buf))
+    size = sizeof(sb->sb_buf);
+  if (size < sb->sb_size)
+    return FALSE;
+  if (size > (int)sizeof(sb->sb_buf))
+    {
+      buf = malloc(size);
+      if (!buf)
+	return FALSE;
+    }
+
+  /* keep what has not been parsed yet; sb_buf itself may be the target */
+  if (sb->sb_size)
+    memmove(buf ? buf : sb->sb_buf, sb->sb_start, sb->sb_size);
+  free(sb->sb_rbuf);
+  sb->sb_rbuf = buf;
+  sb->sb_rbufSize = buf ? size : 0;
+  sb->sb_start = SockBuf_Base(sb);
+  return TRUE;
+}
+
 int
 RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
 {
@@ -3541,6 +4966,8 @@ RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
     {
       rc = send(sb->sb_socket, buf, len, 0);
     }
+  if (rc > 0)
+    sb->sb_bytesOut += rc;
   return rc;
 }
 
@@ -3554,6 +4981,13 @@ RTMPSockBuf_Close(RTMPSockBuf *sb)
       TLS_close(sb->sb_ssl);
       sb->sb_ssl = NULL;
     }
+#endif
+#ifdef __linux__
+  if (sb->sb_epoll >= 0)
+    {
+      close(sb->sb_epoll);
+      sb->sb_epoll = -1;
+    }
 #endif
   return closesocket(sb->sb_socket);
 }
@@ -3630,73 +5064,354 @@ DecodeTEA(AVal *key, AVal *text)
   free(out);
 }
 
+/* Write the whole list, header and body of a request in one writev */
+static int
+SockBuf_SendAll(RTMPSockBuf *sb, struct iovec *iov, int iovcnt)
+{
+  int i;
+
+#ifdef _DEBUG
+  for (i = 0; i < iovcnt; i++)
+    fwrite(iov[i].iov_base, 1, iov[i].iov_len, netstackdump);
+#endif
+
+#ifndef _WIN32
+  if (!sb->sb_ssl)
+    {
+      while (iovcnt > 0)
+	{
+	  ssize_t nBytes = writev(sb->sb_socket, iov, iovcnt);
+
+	  if (nBytes < 0)
+	    {
+	      if (GetSockError() == EINTR && !RTMP_ctrlC)
+		continue;
+	      return FALSE;
+	    }
+	  sb->sb_bytesOut += nBytes;
+	  while (iovcnt > 0 && nBytes >= (ssize_t)iov->iov_len)
+	    {
+	      nBytes -= iov->iov_len;
+	      iov++;
+	      iovcnt--;
+	    }
+	  if (iovcnt > 0)
+	    {
+	      iov->iov_base = (char *)iov->iov_base + nBytes;
+	      iov->iov_len -= nBytes;
+	    }
+	}
+      return TRUE;
+    }
+#endif
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      const char *ptr = iov[i].iov_base;
+      int len = iov[i].iov_len;
+
+      while (len > 0)
+	{
+	  int nBytes = RTMPSockBuf_Send(sb, ptr, len);
+
+	  if (nBytes < 0)
+	    {
+	      if (GetSockError() == EINTR && !RTMP_ctrlC)
+		continue;
+	      return FALSE;
+	    }
+	  ptr += nBytes;
+	  len -= nBytes;
+	}
+    }
+  return TRUE;
+}
+
+static char *
+PutDecimal(char *ptr, unsigned int val)
+{
+  char tmp[10];
+  int n = 0;
+
+  do
+    {
+      tmp[n++] = '0' + val % 10;
+      val /= 10;
+    }
+  while (val);
+  while (n)
+    *ptr++ = tmp[--n];
+  return ptr;
+}
+
+/* Everything after the URL only depends on the connection, so it is
+ * formatted once; each request adds the URL and the body length.
+ */
 static int
 HTTP_Post(RTMP *r, RTMPTCmd cmd, const char *buf, int len)
 {
-  char hbuf[512];
-  int hlen = snprintf(hbuf, sizeof(hbuf), "POST /%s%s/%d HTTP/1.1\r\n"
-    "Host: %.*s:%d\r\n"
-    "Accept: */*\r\n"
-    "User-Agent: Shockwave Flash\n"
-    "Connection: Keep-Alive\n"
-    "Cache-Control: no-cache\r\n"
-    "Content-type: application/x-fcs\r\n"
-    "Content-length: %d\r\n\r\n", RTMPT_cmds[cmd],
-    r->m_clientID.av_val ? r->m_clientID.av_val : "",
-    r->m_msgCounter, r->Link.hostname.av_len, r->Link.hostname.av_val,
-    r->Link.port, len);
-  RTMPSockBuf_Send(&r->m_sb, hbuf, hlen);
-  hlen = RTMPSockBuf_Send(&r->m_sb, buf, len);
+  char hbuf[512], *hptr = hbuf;
+  const char *name = RTMPT_cmds[cmd];
+  int nameLen = strlen(name);
+  int idLen = r->m_clientID.av_val ? r->m_clientID.av_len : 0;
+  struct iovec iov[2];
+
+  if (!r->m_httpHeader.av_val)
+    {
+      char tmp[sizeof(hbuf)];
+      int hlen = snprintf(tmp, sizeof(tmp), " HTTP/1.1\r\n"
+	"Host: %.*s:%d\r\n"
+	"Accept: */*\r\n"
+	"User-Agent: Shockwave Flash\n"
+	"Connection: Keep-Alive\n"
+	"Cache-Control: no-cache\r\n"
+	"Content-type: application/x-fcs\r\n"
+	"Content-length: ", r->Link.hostname.av_len, r->Link.hostname.av_val,
+	r->Link.port);
+
+      if (hlen < 0 || hlen >= (int)sizeof(tmp))
+	return -1;
+      r->m_httpHeader.av_val = malloc(hlen);
+      if (!r->m_httpHeader.av_val)
+	return -1;
+      memcpy(r->m_httpHeader.av_val, tmp, hlen);
+      r->m_httpHeader.av_len = hlen;
+    }
+
+  /* "POST /" cmd id "/" counter header length "\r\n\r\n" */
+  if (6 + nameLen + idLen + 1 + 10 + r->m_httpHeader.av_len + 10 + 4 > (int)sizeof(hbuf))
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, request header too long", __FUNCTION__);
+      return -1;
+    }
+  memcpy(hptr, "POST /", 6);
+  hptr += 6;
+  memcpy(hptr, name, nameLen);
+  hptr += nameLen;
+  memcpy(hptr, r->m_clientID.av_val, idLen);
+  hptr += idLen;
+  *hptr++ = '/';
+  hptr = PutDecimal(hptr, r->m_msgCounter);
+  memcpy(hptr, r->m_httpHeader.av_val, r->m_httpHeader.av_len);
+  hptr += r->m_httpHeader.av_len;
+  hptr = PutDecimal(hptr, len);
+  memcpy(hptr, "\r\n\r\n", 4);
+  hptr += 4;
+
+  iov[0].iov_base = hbuf;
+  iov[0].iov_len = hptr - hbuf;
+  iov[1].iov_base = (char *)buf;
+  iov[1].iov_len = len;
+  if (!SockBuf_SendAll(&r->m_sb, iov, len ? 2 : 1))
+    return -1;
   r->m_msgCounter++;
   r->m_unackd++;
-  return hlen;
+  return len;
 }
 
+/* Collect data for the next send request instead of one request per
+ * write; it goes out once due, see RTMPT_SEND_DELAY_MS.
+ */
 static int
-HTTP_read(RTMP *r, int fill)
+HTTP_Collect(RTMP *r, const char *buf, int len)
 {
-  char *ptr;
-  int hlen;
+  if (r->m_httpOutLen + len > r->m_httpOutSize)
+    {
+      int size = r->m_httpOutSize ? r->m_httpOutSize : RTMPT_SEND_MAX;
+      char *out;
 
-  if (fill)
-    RTMPSockBuf_Fill(&r->m_sb);
-  if (r->m_sb.sb_size < 144)
-    return -1;
-  if (strncmp(r->m_sb.sb_start, "HTTP/1.1 200 ", 13))
-    return -1;
-  ptr = strstr(r->m_sb.sb_start, "Content-Length:");
-  if (!ptr)
-    return -1;
-  hlen = atoi(ptr+16);
-  ptr = strstr(ptr, "\r\n\r\n");
-  if (!ptr)
+      while (size < r->m_httpOutLen + len)
+	size *= 2;
+      out = realloc(r->m_httpOut, size);
+      if (!out)
+	return -1;
+      r->m_httpOut = out;
+      r->m_httpOutSize = size;
+    }
+  if (!r->m_httpOutLen)
+    r->m_httpOutTime = RTMP_GetTime();
+  memcpy(r->m_httpOut + r->m_httpOutLen, buf, len);
+  r->m_httpOutLen += len;
+
+  if ((r->m_httpOutLen >= RTMPT_SEND_MAX
+       || RTMP_GetTime() - r->m_httpOutTime >= RTMPT_SEND_DELAY_MS)
+      && !HTTP_FlushOut(r))
     return -1;
-  ptr += 4;
-  r->m_sb.sb_size -= ptr - r->m_sb.sb_start;
-  r->m_sb.sb_start = ptr;
-  r->m_unackd--;
-
-  if (!r->m_clientID.av_val)
-    {
-      r->m_clientID.av_len = hlen;
-      r->m_clientID.av_val = malloc(hlen+1);
-      if (!r->m_clientID.av_val)
-        return -1;
-      r->m_clientID.av_val[0] = '/';
-      memcpy(r->m_clientID.av_val+1, ptr, hlen-1);
-      r->m_clientID.av_val[hlen] = 0;
-      r->m_sb.sb_size = 0;
+  return len;
+}
+
+static int
+HTTP_FlushOut(RTMP *r)
+{
+  int len = r->m_httpOutLen;
+
+  if (!len)
+    return TRUE;
+  r->m_httpOutLen = 0;
+  if (HTTP_Post(r, RTMPT_SEND, r->m_httpOut, len) < 0)
+    {
+      RTMP_Log(RTMP_LOGERROR, "%s, RTMPT send error %d (%d bytes)", __FUNCTION__,
+	  GetSockError(), len);
+      return FALSE;
     }
-  else
+  return TRUE;
+}
+
+/* Parse responses line by line as they arrive; several may be in flight
+ * on the keep-alive connection. Returns 1 once a response header and its
+ * session id or polling byte are consumed, leaving m_resplen bytes of
+ * RTMP data, 0 if more input is needed and -1 on a bad response.
+ */
+static int
+HTTP_Parse(RTMP *r)
+{
+  RTMPSockBuf *sb = &r->m_sb;
+
+  while (1)
     {
-      r->m_polling = *ptr++;
-      r->m_resplen = hlen - 1;
-      r->m_sb.sb_start++;
-      r->m_sb.sb_size--;
+      char *line = sb->sb_start, *eol;
+      int len;
+
+      if (r->m_httpState == RTMPT_BODY)
+	{
+	  int hlen = r->m_httpLength;
+
+	  if (!r->m_clientID.av_val)
+	    {
+	      /* the reply to open is the session id */
+	      if (hlen < 1 || hlen > SockBuf_Capacity(sb))
+		{
+		  RTMP_Log(RTMP_LOGERROR, "%s, bad session id length %d", __FUNCTION__, hlen);
+		  return -1;
+		}
+	      if (sb->sb_size < hlen)
+		return 0;
+	      r->m_clientID.av_len = hlen;
+	      r->m_clientID.av_val = malloc(hlen+1);
+	      if (!r->m_clientID.av_val)
+		return -1;
+	      r->m_clientID.av_val[0] = '/';
+	      memcpy(r->m_clientID.av_val+1, sb->sb_start, hlen-1);
+	      r->m_clientID.av_val[hlen] = 0;
+	      sb->sb_start += hlen;
+	      sb->sb_size -= hlen;
+	    }
+	  else if (hlen > 0)
+	    {
+	      if (sb->sb_size < 1)
+		return 0;
+	      r->m_polling = *sb->sb_start++;
+	      sb->sb_size--;
+	      r->m_resplen = hlen - 1;
+	    }
+	  r->m_unackd--;
+	  r->m_httpState = RTMPT_STATUS;
+	  return 1;
+	}
+
+      eol = sb->sb_size ? memchr(line, '\n', sb->sb_size) : NULL;
+      if (!eol)
+	{
+	  if (sb->sb_size >= SockBuf_Capacity(sb))
+	    {
+	      RTMP_Log(RTMP_LOGERROR, "%s, response header line too long", __FUNCTION__);
+	      return -1;
+	    }
+	  return 0;
+	}
+      len = eol - line;
+      sb->sb_start = eol + 1;
+      sb->sb_size -= len + 1;
+      if (len && line[len - 1] == '\r')
+	len--;
+
+      if (r->m_httpState == RTMPT_STATUS)
+	{
+	  if (len < 12 || strncmp(line, "HTTP/1.", 7) || strncmp(line + 8, " 200", 4))
+	    {
+	      RTMP_Log(RTMP_LOGERROR, "%s, unexpected response: %.*s", __FUNCTION__,
+		  len, line);
+	      return -1;
+	    }
+	  r->m_httpLength = -1;
+	  r->m_httpState = RTMPT_HEADERS;
+	}
+      else if (!len)
+	{
+	  if (r->m_httpLength < 0)
+	    {
+	      RTMP_Log(RTMP_LOGERROR, "%s, response without Content-Length", __FUNCTION__);
+	      return -1;
+	    }
+	  r->m_httpState = RTMPT_BODY;
+	}
+      else if (len > 15 && !strncasecmp(line, "Content-Length:", 15))
+	{
+	  int i = 15, val = 0;
+
+	  while (i < len && (line[i] == ' ' || line[i] == '\t'))
+	    i++;
+	  if (i == len)
+	    return -1;
+	  for (; i < len && line[i] >= '0' && line[i] <= '9'; i++)
+	    {
+	      if (val > (0x7fffffff - 9) / 10)
+		{
+		  RTMP_Log(RTMP_LOGERROR, "%s, Content-Length too large", __FUNCTION__);
+		  return -1;
+		}
+	      val = val * 10 + (line[i] - '0');
+	    }
+	  r->m_httpLength = val;
+	}
     }
-  return 0;
 }
 
+static int
+HTTP_read(RTMP *r, int fill)
+{
+  int ret;
+
+  while ((ret = HTTP_Parse(r)) == 0 && fill)
+    {
+      if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+	return -1;
+    }
+  return ret;
+}
+
+#ifdef __linux__
+/* Take finished responses off the socket without blocking, so they do
+ * not pile up behind a client that mostly writes. Returns 1 when RTMP
+ * data from a response body is waiting, 0 when not, -1 on error.
+ */
+static int
+HTTP_Drain(RTMP *r)
+{
+  while (!r->m_resplen)
+    {
+      int ret = HTTP_read(r, 0);
+
+      if (ret < 0)
+	{
+	  RTMP_Close(r);
+	  return -1;
+	}
+      if (ret > 0)
+	continue;
+      if (SockBuf_WaitReadable(&r->m_sb, 0) <= 0)
+	return 0;
+      if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+	{
+	  if (!r->m_sb.sb_timedout)
+	    RTMP_Close(r);
+	  return -1;
+	}
+    }
+  return 1;
+}
+#endif
+
 #define MAX_IGNORED_FRAMES	50
 
 /* Read from the stream until we get a media packet.
@@ -3772,14 +5487,13 @@ Read_1_Packet(RTMP *r, char *buf, unsigned int buflen)
 	      if (r->m_read.nMetaHeaderSize > 0
 		  && packet.m_packetType == 0x12)
 		{
-		  AMFObject metaObj;
-		  int nRes =
-		    AMF_Decode(&metaObj, packetBody, nPacketLen, FALSE);
-		  if (nRes >= 0)
+		  AMFObjectProperty prop;
+		  /* only the leading name is needed, not the whole tree */
+		  if (AMF_Lookup(packetBody, nPacketLen, 0, NULL, &prop,
+				 &r->m_amfArena))
 		    {
 		      AVal metastring;
-		      AMFProp_GetString(AMF_GetProp(&metaObj, NULL, 0),
-					&metastring);
+		      AMFProp_GetString(&prop, &metastring);
 
 		      if (AVMATCH(&metastring, &av_onMetaData))
 			{
@@ -3792,10 +5506,10 @@ Read_1_Packet(RTMP *r, char *buf, unsigned int buflen)
 			      ret = RTMP_READ_ERROR;
 			    }
 			}
-		      AMF_Reset(&metaObj);
-		      if (ret == RTMP_READ_ERROR)
-			break;
 		    }
+		  AMFArena_Reset(&r->m_amfArena);
+		  if (ret == RTMP_READ_ERROR)
+		    break;
 		}
 
 	      /* check first keyframe to make sure we got the right position
@@ -59,11 +59,28 @@ extern "C"
 #define RTMP_PROTOCOL_RTMFP     RTMP_FEATURE_MFP
 
 #define RTMP_DEFAULT_CHUNKSIZE	128
+/* Set Chunk Size carries 31 bits, but no message is longer than 24 bits */
+#define RTMP_MAX_CHUNKSIZE	0xFFFFFF
 
 /* needs to fit largest number of bytes recv() may return */
 #define RTMP_BUFFER_CACHE_SIZE (16*1024)
 
+/* reads at least this large go straight into the caller's buffer */
+#define RTMP_DIRECT_READ_MIN	2048
+
+/* RTMPT: writes are collected and sent as one request once the oldest
+ * byte has waited this long, this much is collected, or a reply is awaited
+ */
+#define RTMPT_SEND_DELAY_MS	20
+#define RTMPT_SEND_MAX	(64*1024)
+
+/* non-blocking output: most bytes that may be pending, RTMP_Writable()
+ * turns false at half of it */
+#define RTMP_OUT_LIMIT_DEFAULT	(512*1024)
+
 #define	RTMP_CHANNELS	65600
+/* chunk stream ids below this live in a fixed array, the rest are hashed */
+#define	RTMP_CHANNELS_LOW	64
 
   extern const char RTMPProtocolStringsLower[][7];
   extern const AVal RTMP_DefaultFlashVer;
@@ -112,6 +129,16 @@ extern "C"
     char sb_buf[RTMP_BUFFER_CACHE_SIZE];	/* data read from socket */
     int sb_timedout;
     void *sb_ssl;
+    int sb_nonblock;		/* socket is O_NONBLOCK, writes go through sb_out */
+    char *sb_out;		/* bytes accepted but not yet taken by the socket */
+    int sb_outStart;		/* offset of the first pending byte in sb_out */
+    int sb_outLen;		/* number of pending bytes */
+    int sb_outSize;		/* allocated size of sb_out */
+    int sb_outLimit;
+    int sb_epoll;		/* created on first wait, -1 = none */
+    char *sb_rbuf;		/* receive buffer from RTMP_SetReceiveBuffer, NULL = sb_buf */
+    int sb_rbufSize;
+    uint64_t sb_bytesOut;	/* bytes the socket has taken, see RTMP_BytesSent */
   } RTMPSockBuf;
 
   void RTMPPacket_Reset(RTMPPacket *p);
@@ -202,16 +229,48 @@ extern "C"
     uint32_t nIgnoredFlvFrameCounter;
   } RTMP_READ;
 
+  /* Methods whose pending calls are also found by name, because their
+   * reply is an onStatus rather than a _result: connect, createStream,
+   * play, publish, _checkbw and set_playlist.
+   */
+#define RTMP_CALL_KINDS	6
+
   typedef struct RTMP_METHOD
   {
-    AVal name;
-    int num;
+    AVal name;			/* NULL for a free slot */
+    int num;			/* transaction id */
+    int kind;			/* RTMP_CALL_KINDS if not tracked by name */
+    int older, newer;		/* slot + 1 of calls of the same kind, 0 = none */
   } RTMP_METHOD;
 
+  typedef struct RTMPChannel
+  {
+    RTMPPacket *ch_in;		/* header of the last packet received */
+    RTMPPacket *ch_out;		/* header of the last packet sent */
+    int ch_timestamp;		/* abs timestamp of last packet */
+  } RTMPChannel;
+
+  typedef struct RTMPChannelSlot
+  {
+    int cs_id;			/* 0 = empty, hashed ids are always >= 64 */
+    RTMPChannel cs_channel;
+  } RTMPChannelSlot;
+
+  /* onStatus and _error replies, called from RTMP_ClientPacket. The
+   * values point into the packet being handled and are not terminated.
+   * fatal is set for NetStream.Publish.BadName, NetConnection.Connect.Rejected
+   * and _error answers to connect, createStream or publish; other errors,
+   * such as a refused releaseStream or FCPublish, are informational.
+   */
+  typedef void (RTMP_StatusCallback)(void *ctx, const AVal *level,
+				      const AVal *code, const AVal *description,
+				      int fatal);
+
   typedef struct RTMP
   {
     int m_inChunkSize;
     int m_outChunkSize;
+    int m_reqChunkSize;		/* announced after publish starts, 0 = keep default */
     int m_nBWCheckCounter;
     int m_nBytesIn;
     int m_nBytesInSent;
@@ -229,12 +288,19 @@ extern "C"
     uint8_t m_bSendCounter;
 
     int m_numInvokes;
-    int m_numCalls;
-    RTMP_METHOD *m_methodCalls;	/* remote method calls queue */
-
-    RTMPPacket *m_vecChannelsIn[RTMP_CHANNELS];
-    RTMPPacket *m_vecChannelsOut[RTMP_CHANNELS];
-    int m_channelTimestamp[RTMP_CHANNELS];	/* abs timestamp of last packet */
+    int m_numCalls;		/* pending remote method calls */
+    RTMP_METHOD *m_methodCalls;	/* slots for them, RTMP_DropRequest takes an index */
+    int m_callSlots;
+    int m_callFree;		/* slot + 1 of the first free one, linked by newer */
+    int *m_callMap;		/* txn -> slot + 1, open addressing */
+    int m_callMapSize;		/* power of two */
+    int m_callOldest[RTMP_CALL_KINDS];	/* slot + 1, 0 = none pending */
+    int m_callNewest[RTMP_CALL_KINDS];
+
+    RTMPChannel m_channels[RTMP_CHANNELS_LOW];
+    RTMPChannelSlot *m_channelMap;	/* open addressing, ids >= RTMP_CHANNELS_LOW */
+    int m_channelMapSize;	/* power of two */
+    int m_channelMapUsed;
 
     double m_fAudioCodecs;	/* audioCodecs for the connect packet */
     double m_fVideoCodecs;	/* videoCodecs for the connect packet */
@@ -247,6 +313,17 @@ extern "C"
     int m_resplen;
     int m_unackd;
     AVal m_clientID;
+    int m_httpState;		/* response parser: status line, headers or body */
+    int m_httpLength;		/* Content-Length of the response being parsed */
+    AVal m_httpHeader;		/* request header after the URL, up to "Content-length: " */
+    char *m_httpOut;		/* data collected for the next send request */
+    int m_httpOutLen;
+    int m_httpOutSize;
+    uint32_t m_httpOutTime;	/* RTMP_GetTime() when collecting started */
+
+    RTMP_StatusCallback *m_statusCb;
+    void *m_statusCtx;
+    AMFArena m_amfArena;	/* decoded invoke / metadata, reset per message */
 
     RTMP_READ m_read;
     RTMPPacket m_write;
@@ -288,10 +365,57 @@ extern "C"
 
   int RTMP_ReadPacket(RTMP *r, RTMPPacket *packet);
   int RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue);
+  int RTMP_SendPackets(RTMP *r, RTMPPacket **packets, int n, int queue);
+  /* RTMP_SendPackets for more than the non-blocking output limit: sends
+   * what RTMP_SendRoom allows and waits for the socket in between. Fails
+   * if nothing drains for timeoutMs. */
+  int RTMP_SendPacketsPaced(RTMP *r, RTMPPacket **packets, int n, int queue,
+			    int timeoutMs);
   int RTMP_SendChunk(RTMP *r, RTMPChunk *chunk);
   int RTMP_IsConnected(RTMP *r);
   int RTMP_Socket(RTMP *r);
   int RTMP_IsTimedout(RTMP *r);
+
+  /* Non-blocking output. Sends never block: whatever the socket does not
+   * take is kept in order in an internal buffer and written out by
+   * RTMP_Flush or RTMP_WaitWritable, so RTMP_SendPacket can return TRUE
+   * while none of the packet has reached the wire yet. RTMP_Writable
+   * turns false once limit / 2 bytes are pending, so the caller can hold
+   * back new data. RTMP_SendRoom is how many more bytes, counted with
+   * RTMP_PacketSize, can be sent without going over the limit; with
+   * nothing pending one packet of any size can be. A write that would
+   * leave more than limit bytes pending fails and closes the connection.
+   * Not available for RTMPT, RTMPE or TLS connections. On RTMPT the
+   * pending bytes are the ones collected for the next request, which
+   * RTMP_Flush sends and RTMP_WaitWritable sends once they are due.
+   */
+  int RTMP_SetNonBlocking(RTMP *r, int on, int limit);
+  int RTMP_Flush(RTMP *r);	/* returns pending bytes, -1 on error */
+  int RTMP_Pending(RTMP *r);
+  /* bytes actually written to the socket on this connection, including
+   * chunk headers; bytes still pending in the output buffer are not
+   * counted until the socket takes them */
+  uint64_t RTMP_BytesSent(RTMP *r);
+  int RTMP_Writable(RTMP *r);
+  int RTMP_SendRoom(RTMP *r);	/* INT_MAX when sends block */
+  int RTMP_PacketSize(RTMP *r, const RTMPPacket *packet);	/* most bytes on the wire */
+  int RTMP_WaitWritable(RTMP *r, int timeoutMs);	/* same result as RTMP_Flush */
+  int RTMP_Drain(RTMP *r, int timeoutMs);	/* TRUE once nothing is pending */
+
+  /* Size of the socket receive buffer, RTMP_BUFFER_CACHE_SIZE by default.
+   * A larger one means fewer recv calls when many small chunks arrive.
+   * Data already buffered is kept.
+   */
+  int RTMP_SetReceiveBuffer(RTMP *r, int size);
+
+  /* Read whatever the server sent without blocking. Returns TRUE with a
+   * complete packet, FALSE when nothing complete is buffered (check
+   * RTMP_IsConnected for errors). A chunk is only consumed once it has
+   * fully arrived, unless it is larger than the receive buffer; then its
+   * remainder is waited for up to Link.timeout.
+   */
+  int RTMP_ReadAvailable(RTMP *r, RTMPPacket *packet);
+  void RTMP_SetStatusCallback(RTMP *r, RTMP_StatusCallback *cb, void *ctx);
   double RTMP_GetDuration(RTMP *r);
   int RTMP_ToggleStream(RTMP *r);
 
@@ -330,6 +454,7 @@ extern "C"
   int RTMP_SendSeek(RTMP *r, int dTime);
   int RTMP_SendServerBW(RTMP *r);
   int RTMP_SendClientBW(RTMP *r);
+  int RTMP_SendChunkSize(RTMP *r, int chunkSize);
   void RTMP_DropRequest(RTMP *r, int i, int freeit);
   int RTMP_Read(RTMP *r, char *buf, int size);
   int RTMP_Write(RTMP *r, const char *buf, int size);
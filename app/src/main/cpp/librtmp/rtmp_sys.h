@@ -44,10 +44,13 @@
 #define sleep(n)	Sleep(n*1000)
 #define msleep(n)	Sleep(n)
 #define SET_RCVTIMEO(tv,s)	int tv = s*1000
+struct iovec { void *iov_base; size_t iov_len; };	/* gathered, sent via WriteN */
 #else /* !_WIN32 */
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/times.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <unistd.h>
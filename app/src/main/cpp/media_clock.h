@@ -0,0 +1,97 @@
+#ifndef MYRTMP_MEDIA_CLOCK_H
+#define MYRTMP_MEDIA_CLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+// 到达时刻和按样本数推算的时刻相差超过这么多（丢样本、采集停顿）就直接对齐，不再慢慢校正
+#define AUDIO_CLOCK_RESYNC_MS 100
+
+// 每个 AAC 帧只校正偏差的 1/AUDIO_CLOCK_SLEW，滤掉 AudioRecord.read() 返回时刻的抖动
+#define AUDIO_CLOCK_SLEW 32
+
+/**
+ * 采集时刻统一用 CLOCK_MONOTONIC，和 Java 的 System.nanoTime()、librtmp 的 RTMP_GetTime() 是同一个时钟
+ * 编码器把采集时刻换成毫秒、截断成 32 位写进 m_nTimeStamp，推流线程减去开始推流的时刻得到 RTMP 时间戳，
+ * 32 位回绕时无符号减法的结果仍然正确
+ */
+static inline int64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint32_t mediaMs(int64_t ns) {
+    return (uint32_t) (ns / 1000000);
+}
+
+/**
+ * 音频采样时钟：按样本序号推算采集时刻
+ * 采集线程写完 PCM 环后 observe(累计写入的样本数, 当前时刻)，编码线程用 timeOf(帧的第一个样本序号)
+ * 只按样本数计时会因为声卡和系统时钟的频偏越漂越远，只用到达时刻又带着 read() 的抖动，
+ * 所以按样本数走，用到达时刻缓慢校正
+ */
+class SampleClock {
+public:
+    // 编码线程调用：samplesPerSecond 是所有声道加起来的样本率，变了以后重新对齐
+    void reset(int64_t samplesPerSecond) {
+        nsPerSample = samplesPerSecond > 0 ? 1e9 / samplesPerSecond : 0;
+        hasLast = false;
+    }
+
+    // 采集线程调用：第 index 个样本（不含）之前的样本在 ns 时刻已经采集完
+    void observe(uint64_t index, int64_t ns) {
+        seq.fetch_add(1, std::memory_order_acq_rel);
+        obsIndex.store(index, std::memory_order_relaxed);
+        obsNs.store(ns, std::memory_order_relaxed);
+        seq.fetch_add(1, std::memory_order_release);
+    }
+
+    // 编码线程调用：第 index 个样本的采集时刻，严格递增
+    int64_t timeOf(uint64_t index) {
+        uint64_t seenIndex;
+        int64_t seenNs;
+        uint32_t before;
+        do {
+            before = seq.load(std::memory_order_acquire);
+            seenIndex = obsIndex.load(std::memory_order_relaxed);
+            seenNs = obsNs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((before & 1) || seq.load(std::memory_order_relaxed) != before);
+
+        if (!seenNs) {
+            seenNs = monotonicNs();
+            seenIndex = index;
+        }
+        int64_t observed = seenNs - (int64_t) ((int64_t) (seenIndex - index) * nsPerSample);
+        int64_t time = observed;
+        if (hasLast) {
+            int64_t expected = lastNs + (int64_t) ((int64_t) (index - lastIndex) * nsPerSample);
+            int64_t error = observed - expected;
+            if (llabs(error) <= AUDIO_CLOCK_RESYNC_MS * 1000000LL) {
+                time = expected + error / AUDIO_CLOCK_SLEW;
+            }
+            if (time <= lastNs) {
+                time = lastNs + 1;
+            }
+        }
+        lastIndex = index;
+        lastNs = time;
+        hasLast = true;
+        return time;
+    }
+
+private:
+    std::atomic<uint32_t> seq{0}; // 奇数表示 observe 正在写
+    std::atomic<uint64_t> obsIndex{0};
+    std::atomic<int64_t> obsNs{0};
+
+    double nsPerSample = 0;
+    bool hasLast = false;
+    uint64_t lastIndex = 0;
+    int64_t lastNs = 0;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "nal_sink.h"
+#include "packet_pool.h"
+#include "util.h"
+#include <stdlib.h>
+
+static bool isSlice(int type) {
+    return type == NAL_SLICE || type == NAL_SLICE_IDR;
+}
+
+NalSink::NalSink() {
+    pthread_mutex_init(&lock, 0);
+}
+
+NalSink::~NalSink() {
+    end();
+    pthread_mutex_destroy(&lock);
+}
+
+void NalSink::begin(int capacity, int headerSize) {
+    end();
+    packet = PacketPool::obtain(capacity);
+    mCapacity = packet ? capacity : 0;
+    mHeaderSize = headerSize;
+    offset = headerSize;
+    mRequired = headerSize;
+    ordered = true;
+    lastFirstMb = -1;
+    nalCount = 0;
+}
+
+void NalSink::end() {
+    for (int i = 0; i < nalCount; ++i) {
+        if (spilled[i]) {
+            free(nalList[i].p_payload);
+            spilled[i] = false;
+        }
+    }
+    nalCount = 0;
+    if (packet) {
+        PacketPool::recycle(packet);
+        packet = nullptr;
+    }
+}
+
+void NalSink::onNal(x264_t *h, x264_nal_t *nal, void *opaque) {
+    NalSink *sink = static_cast<NalSink *>(opaque);
+    // x264 要求目标内存至少有这么大（防竞争字节 + 长度前缀 + 汇编越界读写的余量）
+    int need = nal->i_payload * 3 / 2 + 5 + 64;
+
+    pthread_mutex_lock(&sink->lock);
+    if (sink->nalCount == MAX_FRAME_NALS) {
+        pthread_mutex_unlock(&sink->lock);
+        LOGE("一帧的 NAL 个数超过 %d，丢弃", MAX_FRAME_NALS);
+        return;
+    }
+    int index = sink->nalCount++;
+    bool inBody = false;
+    uint8_t *dst;
+    if ((nal->i_type == NAL_SPS || nal->i_type == NAL_PPS) && need <= (int) sizeof(sink->header[0])) {
+        dst = sink->header[nal->i_type == NAL_PPS];
+    } else if (nal->i_type != NAL_SPS && nal->i_type != NAL_PPS
+               && sink->packet && sink->offset + need <= sink->mCapacity) {
+        dst = reinterpret_cast<uint8_t *>(sink->packet->m_body) + sink->offset;
+        inBody = true;
+    } else {
+        dst = static_cast<uint8_t *>(malloc(need));
+    }
+    sink->spilled[index] = !inBody && dst != sink->header[0] && dst != sink->header[1];
+
+    if (dst) {
+        // 写完后 nal->p_payload 指向 dst，i_payload 是含 4 字节长度前缀的实际大小
+        x264_nal_encode(h, dst, nal);
+    } else {
+        nal->i_payload = 0;
+    }
+    sink->nalList[index] = *nal;
+
+    if (nal->i_type != NAL_SPS && nal->i_type != NAL_PPS) {
+        sink->mRequired += nal->i_payload;
+        if (inBody) {
+            sink->offset += nal->i_payload;
+        } else {
+            sink->ordered = false;
+        }
+        // 解码顺序：SEI 在前，切片按首个宏块递增
+        if (isSlice(nal->i_type)) {
+            if (nal->i_first_mb < sink->lastFirstMb) {
+                sink->ordered = false;
+            }
+            sink->lastFirstMb = nal->i_first_mb;
+        } else if (sink->lastFirstMb >= 0) {
+            sink->ordered = false;
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+}
+
+bool NalSink::inPlace() {
+    if (ordered) {
+        return true;
+    }
+    // 插入排序：非切片保持回调顺序排在前面，切片按 i_first_mb 排序
+    for (int i = 1; i < nalCount; ++i) {
+        x264_nal_t nal = nalList[i];
+        bool spill = spilled[i];
+        int key = isSlice(nal.i_type) ? nal.i_first_mb : -1;
+        int j = i - 1;
+        while (j >= 0 && (isSlice(nalList[j].i_type) ? nalList[j].i_first_mb : -1) > key) {
+            nalList[j + 1] = nalList[j];
+            spilled[j + 1] = spilled[j];
+            --j;
+        }
+        nalList[j + 1] = nal;
+        spilled[j + 1] = spill;
+    }
+    return false;
+}
+
+RTMPPacket *NalSink::takePacket() {
+    RTMPPacket *taken = packet;
+    packet = nullptr;
+    return taken;
+}
+
+int NalSink::bodySize() {
+    return offset;
+}
+
+int NalSink::count() {
+    return nalCount;
+}
+
+x264_nal_t *NalSink::nals() {
+    return nalList;
+}
+
+int NalSink::capacity() {
+    return mCapacity;
+}
+
+int NalSink::required() {
+    return mRequired;
+}
@@ -0,0 +1,71 @@
+#ifndef MYRTMP_NAL_SINK_H
+#define MYRTMP_NAL_SINK_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <x264.h>
+#include <rtmp.h>
+
+// 一帧最多记录的 NAL 个数（SPS、PPS、SEI 和所有切片）
+#define MAX_FRAME_NALS 64
+
+/**
+ * x264 nalu_process 回调的落点
+ * 每个 NAL 编码完成时由 x264_nal_encode 直接写进池化 RTMPPacket 的 body，
+ * body 前面留好 FLV 视频 tag 头，这样压缩数据从编码到发送不再拷贝
+ * 切片线程会并发回调，追加时加锁保证 body 连续
+ */
+class NalSink {
+public:
+    NalSink();
+
+    ~NalSink();
+
+    /**
+     * 开始一帧：取一个 body 至少 capacity 字节的包，前 headerSize 字节留给调用者写 tag 头
+     */
+    void begin(int capacity, int headerSize);
+
+    /**
+     * 结束一帧，释放溢出的内存，没被 takePacket 取走的包还给对象池
+     */
+    void end();
+
+    // 设置给 x264_param_t::nalu_process，opaque 是输入图像的 opaque（NalSink 本身）
+    static void onNal(x264_t *h, x264_nal_t *nal, void *opaque);
+
+    /**
+     * 除 SPS/PPS 以外的 NAL 是否都按解码顺序连续写进了 packet body
+     * 切片线程乱序完成或者 body 不够大时返回 false，需要调用者按 nals() 重新拼装
+     */
+    bool inPlace();
+
+    RTMPPacket *takePacket();
+
+    int bodySize(); // 已写入 body 的字节数，包括 tag 头
+
+    int count(); // 本帧回调过的 NAL 个数
+
+    // 本帧的 NAL（p_payload 已经是 4 字节长度开头的 AVCC 格式），inPlace 为 false 时切片已按 i_first_mb 排好序
+    x264_nal_t *nals();
+
+    int capacity(); // 本帧 body 的容量
+
+    int required(); // 本帧所有 NAL 实际需要的 body 大小，包括 tag 头
+
+private:
+    pthread_mutex_t lock;
+    RTMPPacket *packet = nullptr;
+    int mCapacity = 0;
+    int mHeaderSize = 0;
+    int offset = 0; // body 已写到的位置
+    int mRequired = 0;
+    bool ordered = true;
+    int lastFirstMb = -1;
+    int nalCount = 0;
+    x264_nal_t nalList[MAX_FRAME_NALS];
+    bool spilled[MAX_FRAME_NALS] = {}; // 这个 NAL 写在了单独 malloc 的内存里
+    uint8_t header[2][512]; // SPS、PPS 不进 body，单独放
+};
+
+#endif
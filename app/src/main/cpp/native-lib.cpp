@@ -2,10 +2,21 @@
 #include <string>
 #include <x264.h>
 #include <rtmp.h>
+#include <log.h>
 #include "VideoChannel.h"
 #include "AudioChannel.h"
 #include "util.h"
 #include "safe_queue.h"
+#include "packet_pool.h"
+#include "send_scheduler.h"
+#include "abr_controller.h"
+#include "gop_cache.h"
+#include "media_clock.h"
+#include <vector>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "client/linux/handler/minidump_descriptor.h"
 #include "client/linux/handler/exception_handler.h"
 
@@ -17,20 +28,234 @@ bool readyPushing;
 SafeQueue<RTMPPacket *> packets;
 uint32_t start_time;
 
+// 每条轨道上一个包的时间戳，保证同一轨道的 DTS 不回退
+std::atomic<uint32_t> lastVideoTime{0};
+std::atomic<uint32_t> lastAudioTime{0};
+
+// 推流线程把服务器的 onStatus 回调给 MyPusher.onStatus
+JavaVM *javaVM = nullptr;
+jobject pusher = nullptr;
+jmethodID onStatusMethod = nullptr;
+
+// 推流时向服务器声明的输出 chunk 大小，默认 128 会把一个关键帧切成几百个 chunk
+// 可以在推流地址后面追加 " chunksize=65536" 覆盖
+const int OUT_CHUNK_SIZE = 4096;
+
+// 推流线程一次最多从队列取出的包数
+const int SEND_BATCH = 16;
+
+// 发送积压超过这个媒体时长就开始丢非关键视频帧
+const uint32_t MAX_SEND_LATENCY_MS = 2000;
+
+// 推流线程每隔多久打印一次发送统计
+const uint32_t SEND_STATS_INTERVAL_MS = 10000;
+
+// 码率控制的采样周期
+const uint32_t ABR_INTERVAL_MS = 1000;
+
+// 非阻塞发送：librtmp 内部缓冲最多存这么多没发出去的字节，超过一半就先不发新包，
+// 包留在调度器里，积压太久会按调度器的规则丢掉；调度器按剩下的余量取包，一批包不会把缓冲撑爆
+// （真超了 librtmp 只能断开连接）
+const int SEND_BUFFER_LIMIT = 512 * 1024;
+
+// 内部缓冲有数据时每次最多等 socket 可写这么久，然后回去把队列里的新包交给调度器
+const int SEND_WAIT_MS = 20;
+
+// 没有包要发的时候最多等这么久就去读一次服务器消息，保证 ping 能及时回应
+const int READ_POLL_MS = 100;
+
+// 推流线程一次最多处理的服务器消息数，避免一直读不去发
+const int READ_BATCH = 8;
+
+// 断线重连的退避时间，从 RECONNECT_MIN_MS 开始每次翻倍，最多 RECONNECT_MAX_MS
+const uint32_t RECONNECT_MIN_MS = 500;
+const uint32_t RECONNECT_MAX_MS = 8000;
+
+// 连接稳定推流超过这么久再断开，退避从头开始
+const uint32_t RECONNECT_STABLE_MS = 10000;
+
+// 重连回放用的 GOP 缓存上限
+const int GOP_CACHE_MAX_BYTES = 4 * 1024 * 1024;
+
+// 连接异常断开时打印 librtmp 跟踪环里最近的记录数
+const int TRACE_DUMP_RECORDS = 64;
+
+SendScheduler scheduler(MAX_SEND_LATENCY_MS);
+GopCache gopCache(GOP_CACHE_MAX_BYTES);
+
+// 断线重连统计
+struct ReconnectStats {
+    uint32_t outages; // 断开次数
+    uint32_t attempts; // 重连尝试次数
+    uint32_t lastOutageMs; // 从断开到重新连上的时长
+    uint32_t maxOutageMs;
+    uint64_t totalOutageMs;
+    uint64_t replayedPackets; // 重连后回放的包数和字节数
+    uint64_t replayedBytes;
+};
+
+ReconnectStats reconnectStats;
+
+// 重连回放的 GOP 和直播接不上，直播的非关键视频帧要丢到下一个关键帧
+bool waitKeyFrame = false;
+
 void releasePackets(RTMPPacket **packet) {
     if (packet) {
-        RTMPPacket_Free(*packet);
-        delete *packet;
+        PacketPool::recycle(*packet); // 还给对象池，不真正释放
         *packet = nullptr;
     }
 }
 
+// 发送端积压丢帧后，让编码器马上出关键帧
+void requestKeyFrame() {
+    if (videoChannel) {
+        videoChannel->requestKeyFrame();
+    }
+}
+
+static bool isSequenceHeader(RTMPPacket *packet) {
+    return packet->m_nBodySize >= 2 && packet->m_body[1] == 0x00;
+}
+
+static bool isVideoFrame(RTMPPacket *packet) {
+    return packet->m_packetType == RTMP_PACKET_TYPE_VIDEO && packet->m_nBodySize >= 2
+           && !isSequenceHeader(packet);
+}
+
+static bool isKeyFrame(RTMPPacket *packet) {
+    return isVideoFrame(packet) && (packet->m_body[0] & 0xF0) == 0x10;
+}
+
+// 发送队列满了丢包：累计次数是 2 的幂时打一次日志，免得刷屏；丢了视频帧就让编码器出关键帧重新接上
+void onPacketDropped(RTMPPacket **packet, uint64_t dropped) {
+    bool video = (*packet)->m_packetType == RTMP_PACKET_TYPE_VIDEO;
+    if (!(dropped & (dropped - 1))) {
+        LOGE("发送队列 丢弃%s包 %uB 累计:%llu", video ? "视频" : "音频", (*packet)->m_nBodySize,
+             (unsigned long long) dropped);
+    }
+    if (video && readyPushing) {
+        requestKeyFrame();
+    }
+}
+
+// 序列头丢了服务器就解不了码，允许用队列预留的格子
+bool keepPacket(RTMPPacket *packet) {
+    return isSequenceHeader(packet);
+}
+
+void logSendStats() {
+    SendScheduler::Stats stats = scheduler.getStats();
+    LOGE("发送 包数:%llu 排队时延 p50:%ums p90:%ums p99:%ums 最大:%ums 积压:%d个/%ums "
+         "丢帧:%llu(%lluB) 请求关键帧:%llu 入队丢弃:%llu",
+         (unsigned long long) stats.sent, stats.p50Ms, stats.p90Ms, stats.p99Ms, stats.maxMs,
+         stats.queued, stats.queuedMs, (unsigned long long) stats.droppedFrames,
+         (unsigned long long) stats.droppedBytes, (unsigned long long) stats.keyFrameRequests,
+         (unsigned long long) packets.dropped());
+}
+
+// librtmp 的跟踪环一直开着，断线时把最近的收发记录打出来，方便定位断线前发生了什么
+void dumpTrace() {
+    RTMP_TraceRecord records[TRACE_DUMP_RECORDS];
+    char line[128];
+    int n = RTMP_TraceSnapshot(records, TRACE_DUMP_RECORDS);
+    for (int i = 0; i < n; ++i) {
+        RTMP_TraceFormat(&records[i], line, sizeof(line));
+        LOGE("rtmp 跟踪 %s", line);
+    }
+}
+
+void logReconnectStats() {
+    GopCache::Stats gop = gopCache.getStats();
+    LOGE("断线重连 断开:%u次 尝试:%u次 断开时长 最近:%ums 最长:%ums 累计:%llums "
+         "回放:%llu个包/%lluB GOP缓存:%d帧/%dB 溢出:%llu次",
+         reconnectStats.outages, reconnectStats.attempts, reconnectStats.lastOutageMs,
+         reconnectStats.maxOutageMs, (unsigned long long) reconnectStats.totalOutageMs,
+         (unsigned long long) reconnectStats.replayedPackets,
+         (unsigned long long) reconnectStats.replayedBytes, gop.frames, gop.bytes,
+         (unsigned long long) gop.overflows);
+}
+
+// 读 socket 的发送缓冲积压（内核的加上 librtmp 内部缓冲的）和 rtt
+void sampleSocket(RTMP *rtmp, AbrController::Sample &sample) {
+    int fd = RTMP_Socket(rtmp);
+    int outq = 0;
+    sample.socketQueued = RTMP_Pending(rtmp);
+    if (ioctl(fd, SIOCOUTQ, &outq) == 0) {
+        sample.socketQueued += outq;
+    }
+    tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        sample.rttMs = info.tcpi_rtt / 1000;
+    }
+}
+
+// 推流线程处理服务器 onStatus / _error 的上下文
+struct StatusContext {
+    JNIEnv *env; // 推流线程 attach 到 JVM 后的 env，attach 失败时为空，只打日志
+    bool failed; // 服务器拒绝了 connect/createStream/publish（或者 BadName、Connect.Rejected），推流不能继续
+};
+
+std::string avalString(const AVal *val) {
+    return val->av_val ? std::string(val->av_val, val->av_len) : std::string();
+}
+
+void onServerStatus(void *ctx, const AVal *level, const AVal *code, const AVal *description,
+                    int fatal) {
+    StatusContext *status = static_cast<StatusContext *>(ctx);
+    std::string levelStr = avalString(level);
+    std::string codeStr = avalString(code);
+    std::string descriptionStr = avalString(description);
+    LOGE("rtmp 服务器状态 %s %s %s", levelStr.c_str(), codeStr.c_str(), descriptionStr.c_str());
+
+    // 其他 error（比如有的服务器拒绝 releaseStream/FCPublish）只打日志，不影响推流和重连
+    if (fatal) {
+        status->failed = true;
+    }
+
+    JNIEnv *env = status->env;
+    if (!env || !pusher || !onStatusMethod) {
+        return;
+    }
+    jstring jLevel = env->NewStringUTF(levelStr.c_str());
+    jstring jCode = env->NewStringUTF(codeStr.c_str());
+    jstring jDescription = env->NewStringUTF(descriptionStr.c_str());
+    env->CallVoidMethod(pusher, onStatusMethod, jLevel, jCode, jDescription);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+    }
+    env->DeleteLocalRef(jLevel);
+    env->DeleteLocalRef(jCode);
+    env->DeleteLocalRef(jDescription);
+}
+
+// 不阻塞地处理服务器已经发来的消息：ping、确认窗口、chunk 大小、onStatus
+// 连接断开时返回 false
+bool pumpServerMessages(RTMP *rtmp) {
+    RTMPPacket packet = {};
+    for (int i = 0; i < READ_BATCH && RTMP_ReadAvailable(rtmp, &packet); ++i) {
+        RTMP_ClientPacket(rtmp, &packet);
+        RTMPPacket_Free(&packet);
+    }
+    return RTMP_IsConnected(rtmp);
+}
+
 // 存放packet到队列
+// 编码器给的是采集时刻（单调时钟毫秒），换成相对开始推流的时间戳；开始推流之前采集的算 0
 void callback(RTMPPacket *packet) {
     if (packet) {
-        if (packet->m_nTimeStamp == -1) {
-            packet->m_nTimeStamp = RTMP_GetTime() - start_time;
+        int32_t elapsed = (int32_t) (packet->m_nTimeStamp - start_time);
+        uint32_t timestamp = elapsed > 0 ? elapsed : 0;
+
+        std::atomic<uint32_t> &last = packet->m_packetType == RTMP_PACKET_TYPE_VIDEO
+                                      ? lastVideoTime : lastAudioTime;
+        uint32_t prev = last.load(std::memory_order_relaxed);
+        while (timestamp > prev && !last.compare_exchange_weak(prev, timestamp)) {
+        }
+        if (timestamp < prev) {
+            timestamp = prev;
         }
+        packet->m_nTimeStamp = timestamp;
         packets.push(packet);
     }
 }
@@ -48,13 +273,39 @@ Java_com_example_myrtmp_MyPusher_native_1init(JNIEnv *env, jobject thiz) {
 
     // 队列的释放工作关联
     packets.setReleaseCallback(releasePackets);
+    packets.setDropCallback(onPacketDropped);
+    packets.setKeepCallback(keepPacket);
+
+    scheduler.setKeyFrameRequest(requestKeyFrame);
+
+    // 服务器状态回调给 Java 层
+    env->GetJavaVM(&javaVM);
+    if (!pusher) {
+        pusher = env->NewGlobalRef(thiz);
+    }
+    onStatusMethod = env->GetMethodID(env->GetObjectClass(thiz), "onStatus",
+                                      "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
 }
 
-void *task_start(void *args) {
-    char *url = static_cast<char *>(args);
+void closeServer(RTMP **rtmp, char **link) {
+    if (*rtmp) {
+        RTMP_Close(*rtmp);
+        RTMP_Free(*rtmp);
+        *rtmp = nullptr;
+    }
+    delete[] *link;
+    *link = nullptr;
+}
+
+// 建立一次 rtmp 连接，失败返回 nullptr
+// librtmp 会改写 url 并且一直引用它，所以每次连接用一份拷贝 link，关闭连接后才能释放
+RTMP *connectServer(const char *url, char **link, StatusContext *status) {
     RTMP *rtmp = nullptr;
     int ret;
 
+    *link = new char[strlen(url) + 1]; // C++的堆区开辟 new -- delete
+    strcpy(*link, url);
+
     do {
         // 1.1，rtmp 分配内存
         rtmp = RTMP_Alloc();
@@ -66,9 +317,11 @@ void *task_start(void *args) {
         // 1.2，rtmp 初始化
         RTMP_Init(rtmp);
         rtmp->Link.timeout = 5; // 设置连接的超时时间（以秒为单位的连接超时）
+        rtmp->m_reqChunkSize = OUT_CHUNK_SIZE; // 连接流成功后发送 Set Chunk Size
+        RTMP_SetStatusCallback(rtmp, onServerStatus, status); // 连接阶段的 onStatus 也要上报
 
         // 2，rtmp 设置流媒体地址
-        ret = RTMP_SetupURL(rtmp, url);
+        ret = RTMP_SetupURL(rtmp, *link);
         if (!ret) { // ret == 0 和 ffmpeg不同，0代表失败
             LOGE("rtmp 设置流媒体地址失败");
             break;
@@ -84,14 +337,142 @@ void *task_start(void *args) {
             break;
         }
 
-        // 5，连接流
+        // 5，连接流（推流模式下成功后会紧接着发送 Set Chunk Size）
         ret = RTMP_ConnectStream(rtmp, 5);
         if (ret == FALSE) { // ret == 0 和 ffmpeg不同，0代表失败
             LOGE("rtmp 连接流失败");
             break;
         }
+        LOGE("rtmp 输出 chunk 大小: %d", rtmp->m_outChunkSize);
 
+        // 6，切到非阻塞发送，对端慢的时候推流线程不会卡在 send 里
+        if (!RTMP_SetNonBlocking(rtmp, TRUE, SEND_BUFFER_LIMIT)) {
+            LOGE("rtmp 非阻塞发送不可用，使用阻塞发送");
+        }
+        return rtmp;
+    } while (false);
+
+    closeServer(&rtmp, link);
+    return nullptr;
+}
+
+// 按这次连接的时间基改写时间戳，发出去之后包都还给对象池，失败返回 false
+// paced 用于一次发超过非阻塞缓冲上限的包（重连回放）：按缓冲余量分批发，中间等 socket 可写
+bool sendRebased(RTMP *rtmp, RTMPPacket **batch, int count, uint32_t timeBase, bool paced = false) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t timestamp = batch[i]->m_nTimeStamp;
+        batch[i]->m_nTimeStamp = timestamp > timeBase ? timestamp - timeBase : 0;
+        batch[i]->m_nInfoField2 = rtmp->m_stream_id;
+    }
+
+    // 合并成一次 writev 发出去，socket 没收下的部分留在 librtmp 内部缓冲
+    int ret = TRUE;
+    if (count && paced) {
+        ret = RTMP_SendPacketsPaced(rtmp, batch, count, 1, rtmp->Link.timeout * 1000);
+    } else if (count) {
+        ret = RTMP_SendPackets(rtmp, batch, count, 1); // 1==true 开启内部缓冲
+    }
+
+    for (int i = 0; i < count; ++i) {
+        releasePackets(&batch[i]);
+    }
+    return ret; // ret == 0 和 ffmpeg不同，0代表失败
+}
+
+// 发送调度器取出的一批包，原始时间戳的包先记进 GOP 缓存
+// 比时间基还早的音视频帧在新连接上接不上，直接丢掉
+bool sendPackets(RTMP *rtmp, RTMPPacket **batch, int count, uint32_t timeBase) {
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        RTMPPacket *packet = batch[i];
+        gopCache.add(packet);
+        if (waitKeyFrame && isKeyFrame(packet)) {
+            waitKeyFrame = false;
+        }
+        if ((packet->m_nTimeStamp < timeBase && !isSequenceHeader(packet))
+            || (waitKeyFrame && isVideoFrame(packet))) {
+            releasePackets(&packet);
+            continue;
+        }
+        batch[n++] = packet;
+    }
+    return sendRebased(rtmp, batch, n, timeBase);
+}
+
+// 新连接上先回放 header 和缓存的 GOP，观众不用等下一个关键帧
+// timeBase 设为回放的关键帧的时间戳，新连接的时间戳从 0 开始；没有 GOP 时从当前时间开始
+bool replayGop(RTMP *rtmp, uint32_t *timeBase) {
+    std::vector<RTMPPacket *> replay;
+    if (!gopCache.replay(replay, timeBase)) {
+        *timeBase = RTMP_GetTime() - start_time;
+        waitKeyFrame = true;
+        requestKeyFrame();
+    } else if (gopCache.isFrozen()) {
+        // 断线后还没等到新的关键帧，回放的是旧 GOP，后面的帧丢到新关键帧为止
+        waitKeyFrame = true;
+    }
+
+    for (size_t i = 0; i < replay.size(); ++i) {
+        reconnectStats.replayedPackets++;
+        reconnectStats.replayedBytes += replay[i]->m_nBodySize;
+    }
+    // 刚切到非阻塞发送，整个 GOP（可能有几 MB）远超缓冲上限，不能一口气交给 librtmp
+    return sendRebased(rtmp, replay.data(), replay.size(), *timeBase, true);
+}
+
+// 断线后按指数退避重连，停止推流或者服务器拒绝推流时返回 nullptr
+// 等待期间继续消费队列，只用来更新 GOP 缓存，重连上时缓存里是最新的 GOP
+RTMP *reconnectServer(const char *url, char **link, StatusContext *status, uint32_t *backoff) {
+    RTMPPacket *batch[SEND_BATCH];
+
+    while (readyPushing) {
+        uint32_t wakeAt = RTMP_GetTime() + *backoff;
+        for (int32_t left = *backoff; readyPushing && left > 0;
+             left = (int32_t) (wakeAt - RTMP_GetTime())) {
+            int count = packets.popBatch(batch, SEND_BATCH, left);
+            for (int i = 0; i < count; ++i) {
+                gopCache.add(batch[i]);
+                releasePackets(&batch[i]);
+            }
+        }
+        if (!readyPushing) {
+            break;
+        }
+
+        *backoff = std::min(*backoff * 2, RECONNECT_MAX_MS);
+        reconnectStats.attempts++;
+        RTMP *rtmp = connectServer(url, link, status);
+        if (rtmp) {
+            return rtmp;
+        }
+        if (status->failed) {
+            break;
+        }
+        LOGE("rtmp 重连失败，%ums 后重试", *backoff);
+    }
+    return nullptr;
+}
+
+void *task_start(void *args) {
+    char *url = static_cast<char *>(args);
+    char *link = nullptr;
+    RTMP *rtmp = nullptr;
+
+    // attach 到 JVM，服务器状态才能回调到 Java 层
+    StatusContext status = {};
+    if (javaVM && javaVM->AttachCurrentThread(&status.env, nullptr) != JNI_OK) {
+        status.env = nullptr;
+    }
+
+    reconnectStats = {};
+    gopCache.clear();
+    waitKeyFrame = false;
+
+    rtmp = connectServer(url, &link, &status);
+    if (rtmp) {
         start_time = RTMP_GetTime();
+        lastVideoTime = 0;
+        lastAudioTime = 0;
 
         readyPushing = true;
 
@@ -101,45 +482,161 @@ void *task_start(void *args) {
         // 发送音频编码器的解码配置信息
         callback(audioChannel->getAudioSeqHeader());
 
-        RTMPPacket *packet = nullptr;
+        RTMPPacket *batch[SEND_BATCH];
 
         LOGE("rtmp 开始推流");
 
-        while (readyPushing) {
-            packets.pop(packet); // 阻塞式
+        uint32_t lastStats = 0;
+
+        // 码率控制，上限是 initVideoEncoder 配置的码率，重连后沿用之前的估计
+        AbrController abr(videoChannel ? videoChannel->getBitrate() : 0);
+        uint32_t lastAbr = 0;
+        // 吞吐量按 socket 真正收下的字节算，留在 librtmp 内部缓冲里的不算
+        uint64_t lastBytesSent = RTMP_BytesSent(rtmp);
+
+        uint32_t timeBase = 0; // 这次连接的时间戳起点，重连后是回放的关键帧的时间戳
+        uint32_t backoff = RECONNECT_MIN_MS;
+        uint32_t connectedAt = RTMP_GetTime();
+
+        while (true) {
+            while (readyPushing) {
+                // 服务器的 ping 不回应、确认窗口不处理，有的服务器会限速甚至断开推流端
+                if (!pumpServerMessages(rtmp)) {
+                    LOGE("rtmp 连接被服务器断开");
+                    break;
+                }
+                if (status.failed) {
+                    LOGE("rtmp 服务器拒绝推流");
+                    break;
+                }
+
+                // 调度器里没有待发的包才阻塞等待，然后把队列里已经排队的包全部交给调度器，
+                // 调度器看到完整的积压才能决定丢哪些帧
+                int count;
+                if (RTMP_Pending(rtmp)) {
+                    // socket 还有没写完的数据，不能在队列上一直阻塞，改成等 socket 可写
+                    if (RTMP_WaitWritable(rtmp, SEND_WAIT_MS) < 0) {
+                        LOGE("rtmp 失败 自动断开服务器");
+                        break;
+                    }
+                    count = packets.tryPopBatch(batch, SEND_BATCH);
+                } else {
+                    count = scheduler.empty() ? packets.popBatch(batch, SEND_BATCH, READ_POLL_MS)
+                                              : packets.tryPopBatch(batch, SEND_BATCH);
+                }
+                uint32_t enqueued = RTMP_GetTime() - start_time;
+                while (count) {
+                    for (int i = 0; i < count; ++i) {
+                        scheduler.push(batch[i], enqueued);
+                    }
+                    count = packets.tryPopBatch(batch, SEND_BATCH);
+                }
+
+                if (!readyPushing) {
+                    break;
+                }
+
+                uint32_t now = RTMP_GetTime() - start_time;
+                // 内部缓冲满了就先不取，让积压留在调度器里；取的时候按缓冲余量取
+                count = RTMP_Writable(rtmp) ? scheduler.take(batch, SEND_BATCH, now, rtmp) : 0;
+                if (count && !sendPackets(rtmp, batch, count, timeBase)) {
+                    LOGE("rtmp 失败 自动断开服务器");
+                    break;
+                }
+
+                if (abr.bitrate() > 0 && now - lastAbr >= ABR_INTERVAL_MS) {
+                    AbrController::Sample sample = {};
+                    sample.intervalMs = now - lastAbr;
+                    sample.queuedMs = scheduler.getStats().queuedMs;
+                    sample.sentBytes = RTMP_BytesSent(rtmp) - lastBytesSent;
+                    sampleSocket(rtmp, sample);
+                    lastAbr = now;
+                    lastBytesSent += sample.sentBytes;
+
+                    AbrController::Decision decision = abr.update(sample);
+                    if (decision.changed && videoChannel) {
+                        videoChannel->setBitrate(decision.bitrate);
+                        videoChannel->setFrameDecimation(decision.decimation);
+                        LOGE("码率控制 码率:%dkbps 每%d帧取1 吞吐:%dkbps 积压:%ums socket:%uB rtt:%ums",
+                             decision.bitrate, decision.decimation, decision.throughput,
+                             sample.queuedMs, sample.socketQueued, sample.rttMs);
+                    }
+                }
+
+                if (now - lastStats >= SEND_STATS_INTERVAL_MS) {
+                    lastStats = now;
+                    logSendStats();
+                }
+            }
+
+            if (readyPushing) {
+                dumpTrace();
+            }
 
-            if (!readyPushing) {
+            // 主动停止或者服务器拒绝推流就结束，否则断线重连
+            if (!readyPushing || status.failed) {
                 break;
             }
 
-            if (!packet) {
-                continue;
+            uint32_t lostAt = RTMP_GetTime();
+            if (lostAt - connectedAt >= RECONNECT_STABLE_MS) {
+                backoff = RECONNECT_MIN_MS;
             }
+            closeServer(&rtmp, &link);
 
-            packet->m_nInfoField2 = rtmp->m_stream_id;
+            // 没发出去的包接不上了，缓存停在最后一个完整的 GOP，等新的关键帧
+            scheduler.clear();
+            gopCache.freeze();
+            requestKeyFrame();
+            reconnectStats.outages++;
+            LOGE("rtmp 连接断开，%ums 后重连", backoff);
 
-            ret = RTMP_SendPacket(rtmp, packet, 1); // 1==true 开启内部缓冲
+            rtmp = reconnectServer(url, &link, &status, &backoff);
+            if (!rtmp) {
+                break;
+            }
 
-            releasePackets(&packet);
+            connectedAt = RTMP_GetTime();
+            uint32_t outage = connectedAt - lostAt;
+            reconnectStats.lastOutageMs = outage;
+            reconnectStats.maxOutageMs = std::max(reconnectStats.maxOutageMs, outage);
+            reconnectStats.totalOutageMs += outage;
 
-            if (!ret) { // ret == 0 和 ffmpeg不同，0代表失败
-                LOGE("rtmp 失败 自动断开服务器");
-                break;
+            lastBytesSent = RTMP_BytesSent(rtmp);
+            if (!replayGop(rtmp, &timeBase)) {
+                LOGE("rtmp 回放 GOP 失败");
             }
+            logReconnectStats();
         }
-    } while (false);
+
+        AbrController::Stats abrStats = abr.getStats();
+        LOGE("码率控制 采样:%llu 降码率:%llu 升码率:%llu 帧率调整:%llu 最低码率:%dkbps",
+             (unsigned long long) abrStats.samples, (unsigned long long) abrStats.decreases,
+             (unsigned long long) abrStats.increases, (unsigned long long) abrStats.fpsSteps,
+             abrStats.minBitrate);
+        logReconnectStats();
+    }
 
     isStart = false;
     readyPushing = false;
     packets.setWork(0);
     packets.clear();
+    logSendStats();
+    scheduler.clear();
+    gopCache.clear();
 
-    if (rtmp) {
-        RTMP_Close(rtmp);
-        RTMP_Free(rtmp);
-    }
+    PacketPool::Stats poolStats = PacketPool::getStats();
+    LOGE("packet 对象池 命中:%llu 新分配:%llu 使用中:%lld 峰值:%lld",
+         (unsigned long long) poolStats.hits, (unsigned long long) poolStats.misses,
+         (long long) poolStats.inUse, (long long) poolStats.highWater);
+
+    closeServer(&rtmp, &link);
     delete[] url;
 
+    if (status.env) {
+        javaVM->DetachCurrentThread();
+    }
+
     return nullptr;
 }
 
@@ -176,6 +673,10 @@ JNIEXPORT void JNICALL
 Java_com_example_myrtmp_MyPusher_native_1release(JNIEnv *env, jobject thiz) {
     DELETE(videoChannel);
     DELETE(audioChannel);
+    if (pusher) {
+        env->DeleteGlobalRef(pusher);
+        pusher = nullptr;
+    }
 }
 
 extern "C"
@@ -192,9 +693,14 @@ JNIEXPORT void JNICALL
 Java_com_example_myrtmp_MyPusher_native_1pushVideo(JNIEnv *env, jobject thiz, jbyteArray data_) {
     // data == nv21数据  编码 加入队列
     if (!videoChannel || !readyPushing) { return; }
-    jbyte *data = env->GetByteArrayElements(data_, nullptr);
-    videoChannel->encodeData(data);
-    env->ReleaseByteArrayElements(data_, data, 0); // 释放byte[]
+    // 只拷贝一份进编码队列就返回，不在相机回调线程上编码
+    jsize size = env->GetArrayLength(data_);
+    void *data = env->GetPrimitiveArrayCritical(data_, nullptr);
+    if (!data) {
+        return;
+    }
+    videoChannel->pushFrame(static_cast<uint8_t *>(data), size);
+    env->ReleasePrimitiveArrayCritical(data_, data, JNI_ABORT); // 只读，不用写回
 }
 
 extern "C"
@@ -217,21 +723,33 @@ Java_com_example_myrtmp_MyPusher_native_1getInputSamples(JNIEnv *env, jobject th
 
 extern "C"
 JNIEXPORT void JNICALL
-Java_com_example_myrtmp_MyPusher_native_1pushAudio(JNIEnv *env, jobject thiz, jbyteArray data_) {
+Java_com_example_myrtmp_MyPusher_native_1pushAudio(JNIEnv *env, jobject thiz, jbyteArray data_,
+                                                   jint len) {
     if (!audioChannel || !readyPushing) {
         return;
     }
-    jbyte *data = env->GetByteArrayElements(data_, nullptr);
-
-    jsize length = env->GetArrayLength(data_);
-    int32_t *intArray = (int32_t *) malloc(length * sizeof(int32_t));
-    for (jsize i = 0; i < length; i++) {
-        intArray[i] = (int32_t) data[i];
+    // 16bit PCM 原样交给 faac，Critical 一般直接拿到 Java 堆上的地址，不拷贝
+    void *data = env->GetPrimitiveArrayCritical(data_, nullptr);
+    if (!data) {
+        return;
     }
+    audioChannel->encodeData(static_cast<int16_t *>(data), len / 2, monotonicNs());
+    env->ReleasePrimitiveArrayCritical(data_, data, JNI_ABORT); // 只读，不用写回
+}
 
-    audioChannel->encodeData(intArray);
-
-    env->ReleaseByteArrayElements(data_, data, 0);
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_example_myrtmp_MyPusher_native_1pushAudioBuffer(JNIEnv *env, jobject thiz, jobject buffer,
+                                                         jint len) {
+    if (!audioChannel || !readyPushing) {
+        return;
+    }
+    // direct ByteBuffer 的内存在 native 堆上，AudioRecord 直接写进来，这里零拷贝
+    void *data = env->GetDirectBufferAddress(buffer);
+    if (!data) {
+        return;
+    }
+    audioChannel->encodeData(static_cast<int16_t *>(data), len / 2, monotonicNs());
 }
 
 bool DumpCallback(const google_breakpad::MinidumpDescriptor &descriptor,
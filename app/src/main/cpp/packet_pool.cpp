@@ -0,0 +1,163 @@
+#include "packet_pool.h"
+#include <atomic>
+#include <pthread.h>
+#include <stdlib.h>
+
+// body 容量分档：256B, 1K, 4K, 16K, 64K, 256K, 1M，更大的包直接 malloc/free
+#define SIZE_CLASSES 7
+#define MIN_CLASS_SHIFT 8
+#define LOCAL_MAX 16 // 线程缓存每档最多留的包数
+#define REFILL_BATCH 8 // 线程缓存空了一次从全局取的包数
+
+struct PooledPacket {
+    RTMPPacket packet; // 必须放在第一个，recycle 时直接强转
+    PooledPacket *next;
+    int sizeClass; // -1 表示超大包不入池
+    // 后面紧跟 RTMP_MAX_HEADER_SIZE + 容量 字节
+};
+
+struct GlobalList {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    PooledPacket *head = nullptr;
+};
+
+static GlobalList globalLists[SIZE_CLASSES];
+static std::atomic<uint64_t> hits{0};
+static std::atomic<uint64_t> misses{0};
+static std::atomic<int64_t> inUse{0};
+static std::atomic<int64_t> highWater{0};
+
+static int classCapacity(int sizeClass) {
+    return 1 << (MIN_CLASS_SHIFT + sizeClass * 2);
+}
+
+static int sizeClassOf(int bodySize) {
+    for (int c = 0; c < SIZE_CLASSES; ++c) {
+        if (bodySize <= classCapacity(c)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// 线程退出时把缓存的包还给全局链表
+struct LocalCache {
+    PooledPacket *head[SIZE_CLASSES] = {};
+    int count[SIZE_CLASSES] = {};
+
+    ~LocalCache() {
+        for (int c = 0; c < SIZE_CLASSES; ++c) {
+            while (count[c]) {
+                flush(c, count[c]);
+            }
+        }
+    }
+
+    // 把本线程缓存的 n 个包挂回全局链表，只加一次锁
+    void flush(int c, int n) {
+        PooledPacket *first = head[c];
+        PooledPacket *last = first;
+        for (int i = 1; i < n; ++i) {
+            last = last->next;
+        }
+        head[c] = last->next;
+        count[c] -= n;
+
+        pthread_mutex_lock(&globalLists[c].mutex);
+        last->next = globalLists[c].head;
+        globalLists[c].head = first;
+        pthread_mutex_unlock(&globalLists[c].mutex);
+    }
+
+    void refill(int c) {
+        pthread_mutex_lock(&globalLists[c].mutex);
+        for (int i = 0; i < REFILL_BATCH && globalLists[c].head; ++i) {
+            PooledPacket *p = globalLists[c].head;
+            globalLists[c].head = p->next;
+            p->next = head[c];
+            head[c] = p;
+            count[c]++;
+        }
+        pthread_mutex_unlock(&globalLists[c].mutex);
+    }
+};
+
+static thread_local LocalCache localCache;
+
+static PooledPacket *allocate(int sizeClass, int bodySize) {
+    int capacity = sizeClass < 0 ? bodySize : classCapacity(sizeClass);
+    PooledPacket *p = static_cast<PooledPacket *>(
+            malloc(sizeof(PooledPacket) + RTMP_MAX_HEADER_SIZE + capacity));
+    if (!p) {
+        return nullptr;
+    }
+    p->sizeClass = sizeClass;
+    p->next = nullptr;
+    return p;
+}
+
+RTMPPacket *PacketPool::obtain(int bodySize) {
+    int c = sizeClassOf(bodySize);
+    PooledPacket *p = nullptr;
+
+    if (c >= 0) {
+        if (!localCache.count[c]) {
+            localCache.refill(c);
+        }
+        if (localCache.count[c]) {
+            p = localCache.head[c];
+            localCache.head[c] = p->next;
+            localCache.count[c]--;
+        }
+    }
+
+    if (p) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        p = allocate(c, bodySize);
+        if (!p) {
+            return nullptr;
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int64_t used = inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t high = highWater.load(std::memory_order_relaxed);
+    while (used > high && !highWater.compare_exchange_weak(high, used, std::memory_order_relaxed)) {
+    }
+
+    RTMPPacket *packet = &p->packet;
+    RTMPPacket_Reset(packet);
+    packet->m_chunk = nullptr;
+    packet->m_body = reinterpret_cast<char *>(p + 1) + RTMP_MAX_HEADER_SIZE;
+    return packet;
+}
+
+void PacketPool::recycle(RTMPPacket *packet) {
+    if (!packet) {
+        return;
+    }
+    PooledPacket *p = reinterpret_cast<PooledPacket *>(packet);
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+
+    int c = p->sizeClass;
+    if (c < 0) {
+        free(p);
+        return;
+    }
+    p->next = localCache.head[c];
+    localCache.head[c] = p;
+    if (++localCache.count[c] > LOCAL_MAX) {
+        // 推流线程只回收不取，缓存满了一半还给全局，供编码线程取用
+        localCache.flush(c, LOCAL_MAX / 2);
+    }
+}
+
+PacketPool::Stats PacketPool::getStats() {
+    Stats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.inUse = inUse.load(std::memory_order_relaxed);
+    stats.highWater = highWater.load(std::memory_order_relaxed);
+    return stats;
+}
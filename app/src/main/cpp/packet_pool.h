@@ -0,0 +1,32 @@
+#ifndef MYRTMP_PACKET_POOL_H
+#define MYRTMP_PACKET_POOL_H
+
+#include <stdint.h>
+#include <rtmp.h>
+
+/**
+ * RTMPPacket 对象池
+ * 编码线程 obtain，推流线程发送完 recycle，稳定推流后不再有堆分配
+ * 按 body 大小分档，每个线程有自己的小缓存，只有批量换入换出时才加锁
+ */
+class PacketPool {
+public:
+    struct Stats {
+        uint64_t hits; // 从池里拿到的次数
+        uint64_t misses; // 池里没有，新分配的次数
+        int64_t inUse; // 当前在外面（队列里/发送中）的包数
+        int64_t highWater; // inUse 的历史最大值
+    };
+
+    /**
+     * 取一个 body 至少 bodySize 字节的包，body 前面预留了 RTMP_MAX_HEADER_SIZE
+     * 不能用 RTMPPacket_Free 释放，必须交还给 recycle
+     */
+    static RTMPPacket *obtain(int bodySize);
+
+    static void recycle(RTMPPacket *packet);
+
+    static Stats getStats();
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef MYRTMP_PCM_RING_H
+#define MYRTMP_PCM_RING_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ * 16bit PCM 环形缓冲（单生产者单消费者，无锁）
+ * AudioRecord 线程 write，音频编码线程按 faac 的一帧读取
+ * 放不下的样本直接丢弃并计数，写入方永远不会等待
+ */
+class PcmRing {
+public:
+    explicit PcmRing(size_t capacity = 1 << 17) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        samples = new int16_t[size];
+    }
+
+    ~PcmRing() {
+        delete[] samples;
+    }
+
+    /**
+     * 写入 n 个样本，返回实际写入的个数，剩下的计入 dropped
+     */
+    size_t write(const int16_t *data, size_t n) {
+        size_t tail = writePos.load(std::memory_order_relaxed);
+        size_t head = readPos.load(std::memory_order_acquire);
+        size_t space = mask + 1 - (tail - head);
+        if (n > space) {
+            dropped.fetch_add(n - space, std::memory_order_relaxed);
+            n = space;
+        }
+        size_t index = tail & mask;
+        size_t first = n < mask + 1 - index ? n : mask + 1 - index;
+        memcpy(samples + index, data, first * sizeof(int16_t));
+        memcpy(samples, data + first, (n - first) * sizeof(int16_t));
+        writePos.store(tail + n, std::memory_order_release);
+
+        size_t fill = tail + n - head;
+        size_t peak = peakFill.load(std::memory_order_relaxed);
+        if (fill > peak) {
+            peakFill.store(fill, std::memory_order_relaxed);
+        }
+        // 和 waitFor 里的 sleeping 配对：要么消费者看到新数据，要么这里看到它在等
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n && sleeping.load(std::memory_order_relaxed)) {
+            wake();
+        }
+        return n;
+    }
+
+    /**
+     * 取出连续的 n 个样本：不跨越环尾时直接返回环里的指针，否则拷到 scratch
+     * 必须先 available() >= n，用完之后调用 consume(n)
+     */
+    const int16_t *peek(size_t n, int16_t *scratch) {
+        size_t index = readPos.load(std::memory_order_relaxed) & mask;
+        if (index + n <= mask + 1) {
+            return samples + index;
+        }
+        size_t first = mask + 1 - index;
+        memcpy(scratch, samples + index, first * sizeof(int16_t));
+        memcpy(scratch + first, samples, (n - first) * sizeof(int16_t));
+        return scratch;
+    }
+
+    void consume(size_t n) {
+        readPos.store(readPos.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    size_t available() {
+        return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * 消费者阻塞直到至少有 n 个样本，或者 stop() 被调用（返回 false）
+     */
+    bool waitFor(size_t n) {
+        while (available() < n) {
+            if (stopped.load(std::memory_order_acquire)) {
+                return false;
+            }
+            int seq = signal.load(std::memory_order_acquire);
+            sleeping.store(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (available() < n && !stopped.load(std::memory_order_acquire)) {
+                syscall(SYS_futex, &signal, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+            }
+            sleeping.store(0, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void stop() {
+        stopped.store(1, std::memory_order_release);
+        wake();
+    }
+
+    size_t capacity() {
+        return mask + 1;
+    }
+
+    uint64_t droppedSamples() {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    size_t peakLevel() {
+        return peakFill.load(std::memory_order_relaxed);
+    }
+
+private:
+    void wake() {
+        signal.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &signal, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    int16_t *samples;
+    size_t mask;
+    // 生产者和消费者各占一条缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> writePos{0};
+    alignas(64) std::atomic<size_t> readPos{0};
+    alignas(64) std::atomic<int> signal{0}; // futex 字
+    std::atomic<int> sleeping{0};
+    std::atomic<int> stopped{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<size_t> peakFill{0};
+};
+
+#endif
@@ -1,109 +1,241 @@
-#ifndef DERRY_SAFE_QUEUE_H
-#define DERRY_SAFE_QUEUE_H
-
-#include <queue>
-#include <pthread.h>
-
-using namespace std;
-
-template<typename T>
-class SafeQueue {
-    typedef void (*ReleaseCallback)(T *);
-
-    typedef void (*SyncHandle)(queue<T> &);
-
-public:
-    SafeQueue() {
-        pthread_mutex_init(&mutex, 0); // 动态初始化互斥锁
-        pthread_cond_init(&cond, 0);
-    }
-
-    ~SafeQueue() {
-        pthread_mutex_destroy(&mutex);
-        pthread_cond_destroy(&cond);
-    }
-
-    void push(T value) {
-        pthread_mutex_lock(&mutex);
-        if (work) {
-            // 工作状态需要push
-            q.push(value);
-            pthread_cond_signal(&cond);
-        } else {
-            // 非工作状态
-            if (releaseCallback) {
-                releaseCallback(&value);
-            }
-        }
-        pthread_mutex_unlock(&mutex);
-    }
-
-    int pop(T &value) {
-        int ret = 0;
-        pthread_mutex_lock(&mutex);
-        while (work && q.empty()) {
-            // 工作状态，说明确实需要pop，但是队列为空，需要等待
-            pthread_cond_wait(&cond, &mutex);
-        }
-        if (!q.empty()) {
-            value = q.front();
-            q.pop();
-            ret = 1;
-        }
-        pthread_mutex_unlock(&mutex);
-        return ret;
-    }
-
-    void setWork(int work) {
-        pthread_mutex_lock(&mutex);
-        this->work = work;
-        pthread_cond_signal(&cond);
-        pthread_mutex_unlock(&mutex);
-    }
-
-    int empty() {
-        return q.empty();
-    }
-
-    int size() {
-        return q.size();
-    }
-
-    void clear() {
-        pthread_mutex_lock(&mutex);
-        unsigned int size = q.size();
-        for (int i = 0; i < size; ++i) {
-            //取出队首元素
-            T value = q.front();
-            if (releaseCallback) {
-                releaseCallback(&value);
-            }
-            q.pop();
-        }
-        pthread_mutex_unlock(&mutex);
-    }
-
-    void setReleaseCallback(ReleaseCallback releaseCallback) {
-        this->releaseCallback = releaseCallback;
-    }
-
-    void setSyncHandle(SyncHandle syncHandle) {
-        this->syncHandle = syncHandle;
-    }
-
-    void sync() {
-        pthread_mutex_lock(&mutex);
-        syncHandle(q);
-        pthread_mutex_unlock(&mutex);
-    }
-
-private:
-    queue<T> q;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int work; // 标记队列是否工作
-    ReleaseCallback releaseCallback;
-    SyncHandle syncHandle;
-};
-
-#endif
+#ifndef DERRY_SAFE_QUEUE_H
+#define DERRY_SAFE_QUEUE_H
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+/**
+ * 有界无锁队列（多生产者多消费者，按 Dmitry Vyukov 的环形数组实现）
+ * 视频编码线程、音频编码线程 push，推流线程 pop，clear 可以在任意线程调用
+ * push/pop 都不加锁，只有消费者空闲等待时才走一次 futex 唤醒
+ */
+template<typename T>
+class SafeQueue {
+    typedef void (*ReleaseCallback)(T *);
+    typedef void (*DropCallback)(T *, uint64_t dropped);
+    typedef bool (*KeepCallback)(T);
+
+    // 给 keepCallback 认定不能丢的元素（比如序列头）预留的格子，普通元素用不到
+    static const size_t KEEP_RESERVE = 16;
+
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+public:
+    explicit SafeQueue(size_t capacity = 2048) {
+        // 容量取 2 的幂，下标用位与代替取模
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        limit = size > 2 * KEEP_RESERVE ? size - KEEP_RESERVE : size;
+        cells = new Cell[size];
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+        enqueuePos.store(0, memory_order_relaxed);
+        dequeuePos.store(0, memory_order_relaxed);
+    }
+
+    ~SafeQueue() {
+        delete[] cells;
+    }
+
+    /**
+     * 非工作状态或者队列已满时丢弃：计数、先交给 dropCallback、再交给 releaseCallback 释放，返回 false
+     * keepCallback 返回 true 的元素可以用预留的格子，普通元素占满时也放得进去
+     */
+    bool push(T value) {
+        bool keep = keepCallback && keepCallback(value);
+        if (!work.load(memory_order_acquire) || !tryPush(value, keep ? mask + 1 : limit)) {
+            uint64_t count = drops.fetch_add(1, memory_order_relaxed) + 1;
+            if (dropCallback) {
+                dropCallback(&value, count);
+            }
+            if (releaseCallback) {
+                releaseCallback(&value);
+            }
+            return false;
+        }
+        // 和 pop 里的 sleepers 配对：要么消费者看到新数据，要么这里看到有人在等
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed)) {
+            wake();
+        }
+        return true;
+    }
+
+    /**
+     * 阻塞式取出一个元素，队列停止工作且为空时返回 0
+     */
+    int pop(T &value) {
+        return popBatch(&value, 1);
+    }
+
+    /**
+     * 阻塞直到至少取到一个元素，然后不再等待，一次最多取 max 个
+     * timeoutMs >= 0 时最多等这么久（被无关唤醒后重新计时），超时返回 0
+     * 返回取到的个数，队列停止工作且为空时返回 0
+     */
+    int popBatch(T *values, int max, int timeoutMs = -1) {
+        timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+        timespec *wait = timeoutMs >= 0 ? &timeout : nullptr;
+        bool timedOut = false;
+        int count = 0;
+        while (count < max && tryPop(values[count])) {
+            ++count;
+        }
+        while (!count && !timedOut && work.load(memory_order_acquire)) {
+            int seq = signal.load(memory_order_acquire);
+            sleepers.fetch_add(1, memory_order_seq_cst);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (tryPop(values[0])) {
+                count = 1;
+            } else if (work.load(memory_order_acquire)) {
+                // signal 在检查之后变过，futex 会立即返回，不会丢唤醒
+                if (syscall(SYS_futex, &signal, FUTEX_WAIT_PRIVATE, seq, wait, nullptr, 0) == -1
+                    && errno == ETIMEDOUT) {
+                    timedOut = true;
+                }
+            }
+            sleepers.fetch_sub(1, memory_order_relaxed);
+        }
+        while (count && count < max && tryPop(values[count])) {
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * 不阻塞，取出已经在队列里的最多 max 个元素
+     */
+    int tryPopBatch(T *values, int max) {
+        int count = 0;
+        while (count < max && tryPop(values[count])) {
+            ++count;
+        }
+        return count;
+    }
+
+    void setWork(int work) {
+        this->work.store(work, memory_order_release);
+        wake();
+    }
+
+    int empty() {
+        return size() == 0;
+    }
+
+    int size() {
+        size_t tail = enqueuePos.load(memory_order_acquire);
+        size_t head = dequeuePos.load(memory_order_acquire);
+        return tail > head ? (int) (tail - head) : 0;
+    }
+
+    void clear() {
+        T value;
+        while (tryPop(value)) {
+            if (releaseCallback) {
+                releaseCallback(&value);
+            }
+        }
+    }
+
+    void setReleaseCallback(ReleaseCallback releaseCallback) {
+        this->releaseCallback = releaseCallback;
+    }
+
+    void setDropCallback(DropCallback dropCallback) {
+        this->dropCallback = dropCallback;
+    }
+
+    void setKeepCallback(KeepCallback keepCallback) {
+        this->keepCallback = keepCallback;
+    }
+
+    /**
+     * push 时丢弃的累计个数（满了或者没在工作）
+     */
+    uint64_t dropped() {
+        return drops.load(memory_order_relaxed);
+    }
+
+private:
+    // 已占用的格子达到 max 也算满
+    bool tryPush(T &value, size_t max) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell *cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                // pos 可能已经过时，被别的生产者用掉又被消费掉时差值为负，交给下面的 CAS 重试
+                if ((intptr_t) (pos - dequeuePos.load(memory_order_acquire)) >= (intptr_t) max) {
+                    return false;
+                }
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell->value = value;
+                    cell->sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // 满了
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T &value) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell *cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    value = cell->value;
+                    cell->sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // 空了
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    void wake() {
+        signal.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, &signal, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    Cell *cells;
+    size_t mask;
+    size_t limit; // 普通元素最多占用的格子数
+    // 生产者和消费者各占一条缓存行，避免伪共享
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) atomic<size_t> dequeuePos;
+    alignas(64) atomic<int> signal{0}; // futex 字
+    atomic<int> sleepers{0}; // 正在等待的消费者个数
+    atomic<int> work{0}; // 标记队列是否工作
+    atomic<uint64_t> drops{0};
+    ReleaseCallback releaseCallback = nullptr;
+    DropCallback dropCallback = nullptr;
+    KeepCallback keepCallback = nullptr;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "send_scheduler.h"
+#include "packet_pool.h"
+#include "util.h"
+#include <algorithm>
+
+// 视频 tag 第一个字节高 4 位是帧类型：1 关键帧，2 普通帧；第二个字节 0 是 sequence header
+static bool isVideo(RTMPPacket *packet) {
+    return packet->m_packetType == RTMP_PACKET_TYPE_VIDEO && packet->m_nBodySize >= 2;
+}
+
+static bool isSequenceHeader(RTMPPacket *packet) {
+    return packet->m_nBodySize >= 2 && packet->m_body[1] == 0x00
+           && (packet->m_packetType == RTMP_PACKET_TYPE_VIDEO
+               || packet->m_packetType == RTMP_PACKET_TYPE_AUDIO);
+}
+
+static bool isKeyFrame(RTMPPacket *packet) {
+    return isVideo(packet) && (packet->m_body[0] & 0xF0) == 0x10;
+}
+
+// 可以丢的帧：非关键、非 sequence header 的视频帧
+static bool isDroppable(RTMPPacket *packet) {
+    return isVideo(packet) && !isKeyFrame(packet) && !isSequenceHeader(packet);
+}
+
+SendScheduler::SendScheduler(uint32_t maxLatencyMs) : maxLatency(maxLatencyMs) {
+}
+
+SendScheduler::~SendScheduler() {
+    clear();
+}
+
+void SendScheduler::setMaxLatency(uint32_t maxLatencyMs) {
+    maxLatency = maxLatencyMs;
+}
+
+void SendScheduler::setKeyFrameRequest(KeyFrameRequest request) {
+    keyFrameRequest = request;
+}
+
+void SendScheduler::push(RTMPPacket *packet, uint32_t now) {
+    if (dropping) {
+        if (isKeyFrame(packet) && !isSequenceHeader(packet)) {
+            dropping = false; // 新的 GOP 开始，后面的帧都能解码了
+        } else if (isDroppable(packet)) {
+            stats.droppedFrames++;
+            stats.droppedBytes += packet->m_nBodySize;
+            PacketPool::recycle(packet);
+            return;
+        }
+    }
+    Entry entry = {packet, now, !isSequenceHeader(packet)};
+    queue.push_back(entry);
+    if (entry.media) {
+        if (!mediaCount++) {
+            firstMedia = packet->m_nTimeStamp;
+        }
+        lastMedia = packet->m_nTimeStamp;
+    }
+}
+
+int SendScheduler::take(RTMPPacket **out, int max, uint32_t now, RTMP *rtmp) {
+    if (maxLatency && queuedDuration() > maxLatency) {
+        dropUntilKeyFrame();
+    }
+
+    int room = rtmp ? RTMP_SendRoom(rtmp) : 0;
+    bool idle = rtmp && !RTMP_Pending(rtmp);
+    int count = 0;
+    bool firstTaken = false;
+    while (count < max && !queue.empty()) {
+        Entry entry = queue.front();
+        if (rtmp) {
+            // 装不下的留在队列里等缓冲发出去；librtmp 没有积压时第一个包多大都能发
+            int size = RTMP_PacketSize(rtmp, entry.packet);
+            if (size > room && (count || !idle)) {
+                break;
+            }
+            room -= size;
+        }
+        queue.pop_front();
+        out[count++] = entry.packet;
+        delays[delayCount++ % SEND_DELAY_SAMPLES] = now > entry.enqueued ? now - entry.enqueued : 0;
+        if (entry.media) {
+            mediaCount--;
+            firstTaken = true;
+        }
+    }
+    if (firstTaken && mediaCount) {
+        // 新的第一个媒体包一般就在队头，前面最多隔几个 sequence header
+        for (std::deque<Entry>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            if (it->media) {
+                firstMedia = it->packet->m_nTimeStamp;
+                break;
+            }
+        }
+    }
+    stats.sent += count;
+    return count;
+}
+
+void SendScheduler::dropUntilKeyFrame() {
+    // 队列里最后一个关键帧之前的非关键帧全部丢掉；队列里没有关键帧就全丢，并且继续丢到下一个关键帧来
+    std::deque<Entry>::iterator lastKey = queue.end();
+    for (std::deque<Entry>::iterator it = queue.begin(); it != queue.end(); ++it) {
+        if (isKeyFrame(it->packet) && it->media) {
+            lastKey = it;
+        }
+    }
+    bool hasKey = lastKey != queue.end();
+
+    std::deque<Entry> kept;
+    bool beforeKey = true;
+    int dropped = 0;
+    for (std::deque<Entry>::iterator it = queue.begin(); it != queue.end(); ++it) {
+        if (it == lastKey) {
+            beforeKey = false;
+        }
+        RTMPPacket *packet = it->packet;
+        // 最后一个关键帧之前的整段视频都没用了（更早的关键帧也丢），之后的原样保留
+        if (beforeKey && (isDroppable(packet) || (hasKey && isKeyFrame(packet) && !isSequenceHeader(packet)))) {
+            stats.droppedFrames++;
+            stats.droppedBytes += packet->m_nBodySize;
+            dropped++;
+            PacketPool::recycle(packet);
+        } else {
+            kept.push_back(*it);
+        }
+    }
+    queue.swap(kept);
+    rescanMedia();
+
+    if (!hasKey) {
+        dropping = true;
+        if (keyFrameRequest) { // 等下一个 keyint 太久，让编码器马上出关键帧
+            keyFrameRequest();
+            stats.keyFrameRequests++;
+        }
+    }
+    if (dropped) {
+        LOGE("发送积压超过 %ums，丢弃 %d 个视频帧", maxLatency, dropped);
+    }
+}
+
+uint32_t SendScheduler::queuedDuration() {
+    // 用最老和最新的媒体包时间戳之差，sequence header 的时间戳是 0，不算
+    return mediaCount && lastMedia > firstMedia ? lastMedia - firstMedia : 0;
+}
+
+void SendScheduler::rescanMedia() {
+    mediaCount = 0;
+    for (std::deque<Entry>::iterator it = queue.begin(); it != queue.end(); ++it) {
+        if (it->media) {
+            if (!mediaCount++) {
+                firstMedia = it->packet->m_nTimeStamp;
+            }
+            lastMedia = it->packet->m_nTimeStamp;
+        }
+    }
+}
+
+bool SendScheduler::empty() {
+    return queue.empty();
+}
+
+void SendScheduler::clear() {
+    while (!queue.empty()) {
+        PacketPool::recycle(queue.front().packet);
+        queue.pop_front();
+    }
+    mediaCount = 0;
+    dropping = false;
+}
+
+SendScheduler::Stats SendScheduler::getStats() {
+    Stats copy = stats;
+    copy.queued = (int) queue.size();
+    copy.queuedMs = queuedDuration();
+
+    uint32_t n = delayCount < SEND_DELAY_SAMPLES ? delayCount : SEND_DELAY_SAMPLES;
+    if (n) {
+        uint32_t sorted[SEND_DELAY_SAMPLES];
+        std::copy(delays, delays + n, sorted);
+        std::sort(sorted, sorted + n);
+        copy.p50Ms = sorted[n * 50 / 100];
+        copy.p90Ms = sorted[n * 90 / 100];
+        copy.p99Ms = sorted[n * 99 / 100];
+        copy.maxMs = sorted[n - 1];
+    }
+    return copy;
+}
@@ -0,0 +1,85 @@
+#ifndef MYRTMP_SEND_SCHEDULER_H
+#define MYRTMP_SEND_SCHEDULER_H
+
+#include <stdint.h>
+#include <deque>
+#include <rtmp.h>
+
+// 统计排队时延分位数用的样本数
+#define SEND_DELAY_SAMPLES 1024
+
+/**
+ * 推流线程的发送调度
+ * 按媒体时间统计积压，积压超过上限时丢掉非关键视频帧直到下一个关键帧，
+ * 音频和 sequence header 一律保留，同时请求编码器尽快出一个关键帧
+ */
+class SendScheduler {
+public:
+    typedef void (*KeyFrameRequest)();
+
+    struct Stats {
+        uint64_t sent; // 取出发送的包数
+        uint64_t droppedFrames; // 丢掉的视频帧数
+        uint64_t droppedBytes;
+        uint64_t keyFrameRequests; // 请求关键帧的次数
+        int queued; // 当前排队的包数
+        uint32_t queuedMs; // 当前积压的媒体时长
+        uint32_t p50Ms; // 最近发送的包从 push 到 take 的排队时延分位数
+        uint32_t p90Ms;
+        uint32_t p99Ms;
+        uint32_t maxMs;
+    };
+
+    explicit SendScheduler(uint32_t maxLatencyMs = 2000);
+
+    ~SendScheduler();
+
+    void setMaxLatency(uint32_t maxLatencyMs);
+
+    void setKeyFrameRequest(KeyFrameRequest request);
+
+    /**
+     * 包的 m_nTimeStamp 必须已经打好，now 是入队时刻（毫秒），和 take 的 now 同一个时间基
+     */
+    void push(RTMPPacket *packet, uint32_t now);
+
+    /**
+     * 按 FIFO 取出最多 max 个包，排队时延 = now - 入队时刻
+     * 给了 rtmp 就只取它非阻塞发送余量(RTMP_SendRoom)装得下的包，一次发出去不会超过缓冲上限
+     */
+    int take(RTMPPacket **out, int max, uint32_t now, RTMP *rtmp = nullptr);
+
+    bool empty();
+
+    // 释放所有排队的包
+    void clear();
+
+    Stats getStats();
+
+private:
+    struct Entry {
+        RTMPPacket *packet;
+        uint32_t enqueued; // push 时的 now
+        bool media; // 不是 sequence header，参与积压时长统计
+    };
+
+    void dropUntilKeyFrame();
+
+    uint32_t queuedDuration();
+
+    // 重新找队列里第一个和最后一个媒体包，只在队列整体变动时调用
+    void rescanMedia();
+
+    std::deque<Entry> queue;
+    int mediaCount = 0; // 队列里的媒体包个数
+    uint32_t firstMedia = 0; // 队列里第一个媒体包的时间戳
+    uint32_t lastMedia = 0; // 队列里最后一个媒体包的时间戳
+    uint32_t maxLatency;
+    bool dropping = false; // 正在丢非关键帧，等下一个关键帧
+    KeyFrameRequest keyFrameRequest = nullptr;
+    uint32_t delays[SEND_DELAY_SAMPLES]; // 最近发送的包的排队时延，环形
+    uint32_t delayCount = 0;
+    Stats stats = {};
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "yuv_convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void deinterleaveVU(const uint8_t *vu, uint8_t *u, uint8_t *v, int count) {
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // vld2q_u8 一次读 32 字节，val[0] 是偶数位(V)，val[1] 是奇数位(U)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t pair = vld2q_u8(vu + i * 2);
+        vst1q_u8(v + i, pair.val[0]);
+        vst1q_u8(u + i, pair.val[1]);
+    }
+#elif defined(__AVX2__)
+    const __m256i lowMask = _mm256_set1_epi16(0x00FF);
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vu + i * 2));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vu + i * 2 + 32));
+        __m256i vv = _mm256_packus_epi16(_mm256_and_si256(a, lowMask), _mm256_and_si256(b, lowMask));
+        __m256i uu = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        // packus 按 128 位分别打包，需要把中间两个 64 位交换回来
+        vv = _mm256_permute4x64_epi64(vv, 0xD8);
+        uu = _mm256_permute4x64_epi64(uu, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + i), vv);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(u + i), uu);
+    }
+#elif defined(__SSE2__)
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(vu + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(vu + i * 2 + 16));
+        __m128i vv = _mm_packus_epi16(_mm_and_si128(a, lowMask), _mm_and_si128(b, lowMask));
+        __m128i uu = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(v + i), vv);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(u + i), uu);
+    }
+#endif
+
+    // 剩下不够一组向量的部分逐个处理
+    for (; i < count; ++i) {
+        v[i] = vu[i * 2];
+        u[i] = vu[i * 2 + 1];
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef MYRTMP_YUV_CONVERT_H
+#define MYRTMP_YUV_CONVERT_H
+
+#include <stdint.h>
+
+/**
+ * 把 NV21 交错排列的 VU 平面拆成 I420 的 U、V 两个平面
+ * count 是 VU 对的个数（不要求是 16 的倍数），w x h 的帧是 ((w+1)/2)*((h+1)/2) 对
+ * arm 上用 NEON，x86 上用 SSE2/AVX2
+ */
+void deinterleaveVU(const uint8_t *vu, uint8_t *u, uint8_t *v, int count);
+
+#endif
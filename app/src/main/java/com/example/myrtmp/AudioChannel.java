@@ -5,28 +5,35 @@ import android.media.AudioFormat;
 import android.media.AudioRecord;
 import android.media.MediaRecorder;
 
+import java.nio.ByteBuffer;
 import java.util.concurrent.ExecutorService;
 import java.util.concurrent.Executors;
 
 public class AudioChannel {
+    // 采集格式，编码器按同样的采样率和声道数初始化，C++层的采样时钟也按它走
+    private static final int SAMPLE_RATE = 44100;
+    private static final int CHANNEL_CONFIG = AudioFormat.CHANNEL_IN_MONO;
+    private static final int CHANNELS = 1;
+
     private final MyPusher mPusher;
     private boolean isLive; // 是否直播：开始直播就是true，停止直播就是false，通过此标记控制是否发送数据给C++层
     private AudioRecord audioRecord; // AudioRecord采集Android麦克风音频数据 --> C++层 --> 编码 --> 封包 --> 加入队列
     private final ExecutorService executorService;
-    int inputSamples; // 样本数 4096
+    int inputSamples; // 每次读的字节数：faac 一帧的样本数（单声道 1024）* 2 字节
 
     @SuppressLint("MissingPermission")
     public AudioChannel(MyPusher pusher) {
         this.mPusher = pusher;
         executorService = Executors.newSingleThreadExecutor();
-        mPusher.native_initAudioEncoder(44100, 2);
+        // 声道数必须和 AudioRecord 的一致，否则编码器和采样时钟都会按错误的速率走
+        mPusher.native_initAudioEncoder(SAMPLE_RATE, CHANNELS);
         inputSamples = mPusher.getInputSamples() * 2;
-        int minBufferSize = AudioRecord.getMinBufferSize(44100,
-                AudioFormat.CHANNEL_IN_MONO,
+        int minBufferSize = AudioRecord.getMinBufferSize(SAMPLE_RATE,
+                CHANNEL_CONFIG,
                 AudioFormat.ENCODING_PCM_16BIT);
         audioRecord = new AudioRecord(MediaRecorder.AudioSource.MIC,
-                44100,
-                AudioFormat.CHANNEL_IN_MONO,
+                SAMPLE_RATE,
+                CHANNEL_CONFIG,
                 AudioFormat.ENCODING_PCM_16BIT,
                 Math.max(inputSamples, minBufferSize));
     }
@@ -54,11 +61,12 @@ public class AudioChannel {
         @Override
         public void run() {
             audioRecord.startRecording();
-            byte[] bytes = new byte[inputSamples];
+            // direct ByteBuffer：AudioRecord 直接写进 native 内存，C++层零拷贝交给 faac
+            ByteBuffer buffer = ByteBuffer.allocateDirect(inputSamples);
             while (isLive) {
-                int len = audioRecord.read(bytes, 0, bytes.length);
+                int len = audioRecord.read(buffer, inputSamples);
                 if (len > 0) {
-                    mPusher.native_pushAudio(bytes);
+                    mPusher.native_pushAudioBuffer(buffer, len);
                 }
             }
             audioRecord.stop();
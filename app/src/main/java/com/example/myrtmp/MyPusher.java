@@ -3,14 +3,28 @@ package com.example.myrtmp;
 import android.app.Activity;
 import android.view.SurfaceHolder;
 
+import java.nio.ByteBuffer;
+
 public class MyPusher {
 
     static {
         System.loadLibrary("myrtmp");
     }
 
+    /**
+     * 服务器的 onStatus / _error，比如 NetStream.Publish.BadName
+     * 在推流线程上回调，只是通知，不要因为 level 是 "error" 就停止推流：
+     * 只有 connect/createStream/publish 被拒绝、NetStream.Publish.BadName、
+     * NetConnection.Connect.Rejected 会让推流线程结束推流；
+     * releaseStream/FCPublish 被拒绝这类 _error 不影响推流，其他原因断开连接会自动重连
+     */
+    public interface OnStatusListener {
+        void onStatus(String level, String code, String description);
+    }
+
     private final VideoChannel videoChannel;
     private final AudioChannel audioChannel;
+    private volatile OnStatusListener onStatusListener;
 
     // ①:初始化native层需要的加载，
     // ②:实例化视频通道并传递基本参数(宽高,fps,码率等)，
@@ -50,6 +64,18 @@ public class MyPusher {
         native_release();
     }
 
+    public void setOnStatusListener(OnStatusListener listener) {
+        onStatusListener = listener;
+    }
+
+    // native 推流线程调用
+    private void onStatus(String level, String code, String description) {
+        OnStatusListener listener = onStatusListener;
+        if (listener != null) {
+            listener.onStatus(level, code, description);
+        }
+    }
+
     // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> 视频通道 >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
     // SurfaceView与中转站里面的Camera绑定
     public void setPreviewDisplay(SurfaceHolder holder) {
@@ -87,5 +113,7 @@ public class MyPusher {
 
     public native int native_getInputSamples(); // 获取facc编码器 样本数
 
-    public native void native_pushAudio(byte[] bytes); // 把audioRecord采集的原始数据，给C++层编码 --> 入队 --> 发给流媒体服务器
+    public native void native_pushAudio(byte[] bytes, int len); // 把audioRecord采集的原始数据，给C++层编码 --> 入队 --> 发给流媒体服务器
+
+    public native void native_pushAudioBuffer(ByteBuffer buffer, int len); // 同上，direct ByteBuffer 零拷贝版本
 }
@@ -0,0 +1,125 @@
+// AbrController 离线回放：按吞吐量曲线模拟 编码器 -> 发送调度器 -> librtmp 缓冲 -> 内核发送缓冲 -> 链路，
+// 每个周期按推流线程的方式喂一次采样，打印码率决定和积压
+// 用法：abr_replay <曲线文件> [配置码率kbps]，曲线文件每行 <从第几秒开始> <kbps>，# 开头是注释
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "abr_controller.h"
+
+// 和 native-lib.cpp 保持一致
+#define ABR_INTERVAL_MS 1000
+#define SEND_BUFFER_LIMIT (512 * 1024)
+#define MAX_LATENCY_MS 2000
+#define AUDIO_KBPS 64
+// 内核发送缓冲（SIOCOUTQ 能看到的最大值）
+#define KERNEL_BUFFER (512 * 1024)
+#define TICK_MS 10
+#define TAIL_MS 30000
+
+struct Step {
+    uint32_t startMs;
+    int kbps;
+};
+
+static bool loadTrace(const char *path, std::vector<Step> &trace) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        double seconds;
+        int kbps;
+        if (line[0] != '#' && sscanf(line, "%lf %d", &seconds, &kbps) == 2) {
+            trace.push_back({(uint32_t) (seconds * 1000), kbps});
+        }
+    }
+    fclose(file);
+    return !trace.empty();
+}
+
+int main(int argc, char **argv) {
+    std::vector<Step> trace;
+    if (argc < 2 || !loadTrace(argv[1], trace)) {
+        fprintf(stderr, "usage: abr_replay <trace> [bitrate-kbps]\n");
+        return 1;
+    }
+    int maxBitrate = argc > 2 ? atoi(argv[2]) : 2500;
+
+    AbrController abr(maxBitrate, AUDIO_KBPS);
+    int bitrate = maxBitrate;
+    int decimation = 1;
+
+    // 各级缓冲里的字节
+    double scheduler = 0, librtmp = 0, kernel = 0;
+    uint64_t sentBytes = 0; // 这个周期内核收下的字节，对应 RTMP_BytesSent 的差值
+    uint64_t delivered = 0, offered = 0, droppedBytes = 0;
+    uint32_t maxQueuedMs = 0, congestedIntervals = 0;
+    size_t step = 0;
+    uint32_t end = trace.back().startMs + TAIL_MS;
+
+    printf("%7s %9s %9s %5s %9s %9s %10s %s\n", "t(s)", "link", "bitrate", "dec", "thruput",
+           "queued", "socket", "");
+    for (uint32_t now = TICK_MS; now <= end; now += TICK_MS) {
+        while (step + 1 < trace.size() && trace[step + 1].startMs <= now) {
+            ++step;
+        }
+        int link = trace[step].kbps;
+        offered += (uint64_t) link * TICK_MS / 8;
+
+        // 降帧率时 x264 按配置的帧率分配每帧大小，实际码率跟着降
+        int produceKbps = bitrate / decimation + AUDIO_KBPS;
+        scheduler += (double) produceKbps * TICK_MS / 8;
+        // librtmp 内部缓冲超过上限的一半就不再从调度器取包
+        double move = std::min(scheduler, std::max(0.0, SEND_BUFFER_LIMIT / 2 - librtmp));
+        scheduler -= move;
+        librtmp += move;
+        move = std::min(librtmp, KERNEL_BUFFER - kernel);
+        librtmp -= move;
+        kernel += move;
+        sentBytes += (uint64_t) move;
+        move = std::min(kernel, (double) link * TICK_MS / 8);
+        kernel -= move;
+        delivered += (uint64_t) move;
+
+        // 调度器积压超过上限丢视频到下一个关键帧，粗略当作清空
+        uint32_t queuedMs = (uint32_t) (scheduler * 8 / produceKbps);
+        if (queuedMs > MAX_LATENCY_MS) {
+            droppedBytes += (uint64_t) scheduler;
+            scheduler = 0;
+        }
+        if (queuedMs > maxQueuedMs) {
+            maxQueuedMs = queuedMs;
+        }
+
+        if (now % ABR_INTERVAL_MS == 0) {
+            AbrController::Sample sample = {};
+            sample.intervalMs = ABR_INTERVAL_MS;
+            sample.queuedMs = queuedMs;
+            sample.socketQueued = (uint32_t) (librtmp + kernel);
+            sample.sentBytes = sentBytes;
+            sentBytes = 0;
+
+            AbrController::Decision decision = abr.update(sample);
+            bitrate = decision.bitrate;
+            decimation = decision.decimation;
+            congestedIntervals += decision.congested;
+            printf("%7.1f %9d %9d %5d %9d %7ums %9uB %s\n", now / 1000.0, link, bitrate, decimation,
+                   decision.throughput, sample.queuedMs, sample.socketQueued,
+                   decision.congested ? "congested" : "");
+        }
+    }
+
+    AbrController::Stats stats = abr.getStats();
+    printf("link utilization %.1f%%, max queued %ums, dropped %lluB, congested %u/%llu intervals, "
+           "decreases %llu increases %llu fps steps %llu min bitrate %dkbps\n",
+           offered ? delivered * 100.0 / offered : 0.0, maxQueuedMs,
+           (unsigned long long) droppedBytes, congestedIntervals,
+           (unsigned long long) stats.samples, (unsigned long long) stats.decreases,
+           (unsigned long long) stats.increases, (unsigned long long) stats.fpsSteps,
+           stats.minBitrate);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Cost of reading an invoke the way HandleInvoke does (method, txn and
+ * the code/level/description of the info object) for each corpus
+ * message: heap tree, arena tree and AMF_Lookup without a tree.
+ *
+ * usage: amf_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "librtmp/amf.h"
+#include "librtmp/log.h"
+#include "amf_corpus.h"
+
+static const AVal av_code = AVC("code");
+static const AVal av_level = AVC("level");
+static const AVal av_description = AVC("description");
+
+static volatile long sink;
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+read_info(AMFObject *obj)
+{
+  AMFObjectProperty *info = AMF_GetProp(obj, NULL, 3);
+  AMFObject members;
+
+  sink += obj->o_num;
+  if (info->p_type != AMF_OBJECT)
+    return;
+  members = info->p_vu.p_object;
+  sink += AMF_GetProp(&members, &av_code, -1)->p_vu.p_aval.av_len
+    + AMF_GetProp(&members, &av_level, -1)->p_vu.p_aval.av_len
+    + AMF_GetProp(&members, &av_description, -1)->p_vu.p_aval.av_len;
+}
+
+static double
+bench_heap(const char *buf, int len, long n)
+{
+  AMFObject obj;
+  double start = now_ns();
+  long i;
+
+  for (i = 0; i < n; i++)
+    {
+      AMF_Decode(&obj, buf, len, FALSE);
+      read_info(&obj);
+      AMF_Reset(&obj);
+    }
+  return (now_ns() - start) / n;
+}
+
+static double
+bench_arena(const char *buf, int len, long n, AMFArena *arena)
+{
+  AMFObject obj;
+  double start = now_ns();
+  long i;
+
+  for (i = 0; i < n; i++)
+    {
+      AMF_DecodeArena(&obj, buf, len, FALSE, arena);
+      read_info(&obj);
+      AMFArena_Reset(arena);
+    }
+  return (now_ns() - start) / n;
+}
+
+static double
+bench_lookup(const char *buf, int len, long n, AMFArena *arena)
+{
+  AMFObjectProperty p;
+  double start = now_ns();
+  long i;
+
+  for (i = 0; i < n; i++)
+    {
+      if (AMF_Lookup(buf, len, 0, NULL, &p, arena))
+	sink += p.p_vu.p_aval.av_len;
+      if (AMF_Lookup(buf, len, 1, NULL, &p, arena))
+	sink += (long)p.p_vu.p_number;
+      if (AMF_Lookup(buf, len, 3, &av_code, &p, arena))
+	sink += p.p_vu.p_aval.av_len;
+      if (AMF_Lookup(buf, len, 3, &av_level, &p, arena))
+	sink += p.p_vu.p_aval.av_len;
+      if (AMF_Lookup(buf, len, 3, &av_description, &p, arena))
+	sink += p.p_vu.p_aval.av_len;
+      AMFArena_Reset(arena);
+    }
+  return (now_ns() - start) / n;
+}
+
+int
+main(int argc, char **argv)
+{
+  static char buf[4096];
+  long n = argc > 1 ? atol(argv[1]) : 2000000;
+  AMFArena arena;
+  int c, len;
+
+  if (n <= 0)
+    return 1;
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  AMFArena_Init(&arena);
+  printf("%-24s %5s %12s %12s %12s\n", "message", "bytes", "heap ns",
+	 "arena ns", "lookup ns");
+  for (c = 0; c < AMF_CORPUS_COUNT; c++)
+    {
+      len = amf_corpus(c, buf);
+      printf("%-24s %5d %12.0f %12.0f %12.0f\n", amf_corpus_names[c], len,
+	     bench_heap(buf, len, n), bench_arena(buf, len, n, &arena),
+	     bench_lookup(buf, len, n, &arena));
+    }
+  AMFArena_Free(&arena);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * AMF0 invoke bodies as servers send them (nginx-rtmp, SRS and FMS
+ * shapes): seeds for amf_fuzz_test and inputs for amf_bench.
+ */
+
+#ifndef AMF_CORPUS_H
+#define AMF_CORPUS_H
+
+#include <string.h>
+
+#include "librtmp/amf.h"
+
+#define AMF_CORPUS_COUNT	5
+
+static const char *amf_corpus_names[AMF_CORPUS_COUNT] = {
+  "onMetaData", "connect _result", "createStream _result",
+  "onStatus Publish.Start", "onBWDone"
+};
+
+static char *
+corpus_name(char *p, const char *s)
+{
+  int n = strlen(s);
+  *p++ = n >> 8;
+  *p++ = n;
+  memcpy(p, s, n);
+  return p + n;
+}
+
+static char *
+corpus_string(char *p, const char *s)
+{
+  *p++ = AMF_STRING;
+  return corpus_name(p, s);
+}
+
+static char *
+corpus_number(char *p, double d)
+{
+  const unsigned char *c = (const unsigned char *)&d;
+  int i;
+
+  *p++ = AMF_NUMBER;
+  for (i = 7; i >= 0; i--)	/* big endian on the wire */
+    *p++ = c[i];
+  return p;
+}
+
+static char *
+corpus_end(char *p)
+{
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = AMF_OBJECT_END;
+  return p;
+}
+
+static char *
+corpus_ecma(char *p, int count)
+{
+  *p++ = AMF_ECMA_ARRAY;
+  *p++ = count >> 24;
+  *p++ = count >> 16;
+  *p++ = count >> 8;
+  *p++ = count;
+  return p;
+}
+
+#define NAMED_STRING(p, n, v)	corpus_string(corpus_name(p, n), v)
+#define NAMED_NUMBER(p, n, v)	corpus_number(corpus_name(p, n), v)
+
+/* writes corpus entry 'which' to buf (4 KiB is plenty), returns its length */
+static int
+amf_corpus(int which, char *buf)
+{
+  char *p = buf;
+
+  switch (which)
+    {
+    case 0:
+      p = corpus_string(p, "onMetaData");
+      p = corpus_ecma(p, 13);
+      p = NAMED_NUMBER(p, "duration", 0);
+      p = NAMED_NUMBER(p, "width", 1280);
+      p = NAMED_NUMBER(p, "height", 720);
+      p = NAMED_NUMBER(p, "videodatarate", 2500);
+      p = NAMED_NUMBER(p, "framerate", 30);
+      p = NAMED_NUMBER(p, "videocodecid", 7);
+      p = NAMED_NUMBER(p, "audiodatarate", 128);
+      p = NAMED_NUMBER(p, "audiosamplerate", 44100);
+      p = NAMED_NUMBER(p, "audiosamplesize", 16);
+      p = corpus_name(p, "stereo");
+      *p++ = AMF_BOOLEAN;
+      *p++ = 1;
+      p = NAMED_NUMBER(p, "audiocodecid", 10);
+      p = NAMED_STRING(p, "encoder", "Lavf58.29.100");
+      p = NAMED_NUMBER(p, "filesize", 0);
+      p = corpus_end(p);
+      break;
+    case 1:
+      p = corpus_string(p, "_result");
+      p = corpus_number(p, 1);
+      *p++ = AMF_OBJECT;
+      p = NAMED_STRING(p, "fmsVer", "FMS/3,5,3,888");
+      p = NAMED_NUMBER(p, "capabilities", 127);
+      p = NAMED_NUMBER(p, "mode", 1);
+      p = corpus_end(p);
+      *p++ = AMF_OBJECT;
+      p = NAMED_STRING(p, "level", "status");
+      p = NAMED_STRING(p, "code", "NetConnection.Connect.Success");
+      p = NAMED_STRING(p, "description", "Connection succeeded.");
+      p = NAMED_NUMBER(p, "objectEncoding", 0);
+      p = corpus_ecma(corpus_name(p, "data"), 1);
+      p = NAMED_STRING(p, "version", "3,5,3,888");
+      p = corpus_end(p);
+      p = corpus_end(p);
+      break;
+    case 2:
+      p = corpus_string(p, "_result");
+      p = corpus_number(p, 4);
+      *p++ = AMF_NULL;
+      p = corpus_number(p, 1);
+      break;
+    case 3:
+      p = corpus_string(p, "onStatus");
+      p = corpus_number(p, 0);
+      *p++ = AMF_NULL;
+      *p++ = AMF_OBJECT;
+      p = NAMED_STRING(p, "level", "status");
+      p = NAMED_STRING(p, "code", "NetStream.Publish.Start");
+      p = NAMED_STRING(p, "description", "Start publishing");
+      p = NAMED_STRING(p, "details", "live/stream");
+      p = NAMED_STRING(p, "clientid", "ASAiBAAA");
+      p = corpus_end(p);
+      break;
+    case 4:
+      p = corpus_string(p, "onBWDone");
+      p = corpus_number(p, 0);
+      *p++ = AMF_NULL;
+      p = corpus_number(p, 8192);
+      *p++ = AMF_STRICT_ARRAY;
+      *p++ = 0, *p++ = 0, *p++ = 0, *p++ = 3;
+      p = corpus_number(p, 1);
+      p = corpus_string(p, "x");
+      *p++ = AMF_UNDEFINED;
+      break;
+    default:
+      return 0;
+    }
+  return p - buf;
+}
+
+#endif
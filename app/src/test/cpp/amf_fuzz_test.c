@@ -0,0 +1,248 @@
+/*
+ * AMF decoding paths agree with each other on the server message corpus
+ * and on mutations of it:
+ *
+ *   - AMF_Decode and AMF_DecodeArena return the same length and tree;
+ *   - AMF_Lookup by index and by member name matches the tree;
+ *   - AMFProp_Skip consumes as many bytes as AMFProp_Decode;
+ *   - AMFProp_EncodedSize is exact, a shorter buffer is refused and the
+ *     encoding decodes back to the same value.
+ *
+ * Mutated inputs are copied to exact-size heap blocks so ASan reports
+ * any read past the end.
+ *
+ * usage: amf_fuzz_test [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "librtmp/amf.h"
+#include "librtmp/log.h"
+#include "amf_corpus.h"
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      exit(1); } } while (0)
+
+static AMFArena arena;
+static long decoded, lookups, encodes;
+
+static int same_object(const AMFObject *a, const AMFObject *b);
+
+static int
+same_aval(const AVal *a, const AVal *b)
+{
+  return a->av_len == b->av_len
+    && (!a->av_len || !memcmp(a->av_val, b->av_val, a->av_len));
+}
+
+static int
+same_prop(const AMFObjectProperty *a, const AMFObjectProperty *b)
+{
+  if (a->p_type != b->p_type || !same_aval(&a->p_name, &b->p_name))
+    return FALSE;
+  switch (a->p_type)
+    {
+    case AMF_NUMBER:
+    case AMF_BOOLEAN:
+      /* NaN from a mutated double never compares equal */
+      return a->p_vu.p_number == b->p_vu.p_number
+	|| a->p_vu.p_number != a->p_vu.p_number;
+    case AMF_STRING:
+      return same_aval(&a->p_vu.p_aval, &b->p_vu.p_aval);
+    case AMF_OBJECT:
+      return same_object(&a->p_vu.p_object, &b->p_vu.p_object);
+    default:
+      return TRUE;
+    }
+}
+
+static int
+same_object(const AMFObject *a, const AMFObject *b)
+{
+  int i;
+
+  if (a->o_num != b->o_num)
+    return FALSE;
+  for (i = 0; i < a->o_num; i++)
+    if (!same_prop(&a->o_props[i], &b->o_props[i]))
+      return FALSE;
+  return TRUE;
+}
+
+/* objects with unnamed members do not survive an encode/decode round trip */
+static int
+has_unnamed(const AMFObjectProperty *prop)
+{
+  int i;
+
+  if (prop->p_type != AMF_OBJECT)
+    return FALSE;
+  for (i = 0; i < prop->p_vu.p_object.o_num; i++)
+    {
+      const AMFObjectProperty *child = &prop->p_vu.p_object.o_props[i];
+      if (!child->p_name.av_len || has_unnamed(child))
+	return TRUE;
+    }
+  return FALSE;
+}
+
+static void
+check_lookup(const char *buf, int len, const AMFObject *tree)
+{
+  AMFObjectProperty found, decodedProp;
+  int i, m, off = 0, skipped, used;
+
+  for (i = 0; i < tree->o_num; i++)
+    {
+      const AMFObjectProperty *want = &tree->o_props[i];
+
+      if (AMF_Lookup(buf, len, i, NULL, &found, &arena))
+	{
+	  CHECK(same_prop(&found, want));
+	  lookups++;
+	  if (want->p_type == AMF_OBJECT)
+	    for (m = 0; m < want->p_vu.p_object.o_num; m++)
+	      {
+		const AVal *name = &want->p_vu.p_object.o_props[m].p_name;
+		AMFObject members = want->p_vu.p_object;
+
+		if (!name->av_len
+		    || !AMF_Lookup(buf, len, i, name, &found, &arena))
+		  continue;
+		/* the first member of that name, as AMF_GetProp finds it */
+		CHECK(same_prop(&found, AMF_GetProp(&members, name, -1)));
+		lookups++;
+	      }
+	}
+
+      skipped = AMFProp_Skip(buf + off, len - off, FALSE);
+      if (skipped < 0)
+	break;		/* AMF3 or resynchronised input, Lookup may refuse too */
+      used = AMFProp_Decode(&decodedProp, buf + off, len - off, FALSE);
+      CHECK(used == skipped);
+      AMFProp_Reset(&decodedProp);
+      off += skipped;
+    }
+}
+
+static void
+check_encode(const AMFObject *tree)
+{
+  AMFObjectProperty back;
+  char *out, *end;
+  int i, size;
+
+  for (i = 0; i < tree->o_num; i++)
+    {
+      const AMFObjectProperty *prop = &tree->o_props[i];
+
+      size = AMFProp_EncodedSize(prop);
+      if (size <= 0)
+	continue;
+      out = malloc(size);
+      end = AMFProp_Encode((AMFObjectProperty *)prop, out, out + size);
+      CHECK(end && end - out == size);
+      CHECK(!AMFProp_Encode((AMFObjectProperty *)prop, out, out + size - 1));
+      if (!has_unnamed(prop))
+	{
+	  CHECK(AMFProp_Decode(&back, out, size, FALSE) == size);
+	  CHECK(same_prop(&back, prop));
+	  AMFProp_Reset(&back);
+	}
+      free(out);
+      encodes++;
+    }
+}
+
+static void
+check(const char *buf, int len)
+{
+  AMFObject heap, pooled;
+  int heapLen, pooledLen;
+
+  heapLen = AMF_Decode(&heap, buf, len, FALSE);
+  pooledLen = AMF_DecodeArena(&pooled, buf, len, FALSE, &arena);
+  CHECK(heapLen == pooledLen);
+  if (heapLen >= 0)
+    {
+      CHECK(same_object(&heap, &pooled));
+      check_lookup(buf, len, &heap);
+      check_encode(&heap);
+      AMF_Reset(&heap);
+      decoded++;
+    }
+  AMFArena_Reset(&arena);
+}
+
+/* corrupt one to four bytes or truncate, biased towards type markers
+ * and zero length fields */
+static int
+mutate(char *m, int len)
+{
+  static const char markers[] = "\0\1\2\3\5\6\10\11\12\13\14\21";
+  int k, n = 1 + rand() % 4, at;
+
+  for (k = 0; k < n; k++)
+    switch (rand() % 4)
+      {
+      case 0:
+	m[rand() % len] = rand();
+	break;
+      case 1:
+	m[rand() % len] = markers[rand() % (sizeof(markers) - 1)];
+	break;
+      case 2:
+	len = 1 + rand() % len;
+	break;
+      case 3:
+	at = rand() % len;
+	m[at] = 0;
+	if (at + 1 < len)
+	  m[at + 1] = rand() % 4 ? 0 : rand();
+	break;
+      }
+  return len;
+}
+
+int
+main(int argc, char **argv)
+{
+  static char seed[4096], m[4096];
+  long iterations = argc > 1 ? atol(argv[1]) : 200000, i;
+  char *exact;
+  int c, len;
+
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  AMFArena_Init(&arena);
+
+  for (c = 0; c < AMF_CORPUS_COUNT; c++)
+    {
+      check(seed, amf_corpus(c, seed));
+      CHECK(decoded == c + 1);
+    }
+  printf("corpus: %ld lookups, %ld encodes\n", lookups, encodes);
+
+  srand(1);
+  for (i = 0; i < iterations; i++)
+    {
+      len = amf_corpus(rand() % AMF_CORPUS_COUNT, seed);
+      memcpy(m, seed, len);
+      len = mutate(m, len);
+
+      /* invokes start with the method name; AMF3 values are not compared */
+      if (m[0] != AMF_STRING || memchr(m, AMF_AVMPLUS, len))
+	continue;
+      exact = malloc(len);
+      memcpy(exact, m, len);
+      check(exact, len);
+      free(exact);
+    }
+
+  AMFArena_Free(&arena);
+  printf("fuzz: %ld iterations, %ld decoded, %ld lookups, %ld encodes\n",
+	 iterations, decoded, lookups, encodes);
+  return 0;
+}
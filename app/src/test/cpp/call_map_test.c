@@ -0,0 +1,188 @@
+/*
+ * Model check of the pending-call map: random CallQueue / CallFind /
+ * CallOldest / CallDrop sequences, duplicate txns included, against a
+ * plain list of the calls that should be outstanding. Also checks that
+ * MethodId knows every InvokeMethods entry after RTMP_Init ran on
+ * several threads at once.
+ *
+ * rtmp.c is compiled into this file to reach its statics.
+ *
+ * usage: call_map_test [operations]
+ */
+
+#include "librtmp/rtmp.c"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      exit(1); } } while (0)
+
+#define MAX_PENDING	100000
+#define INIT_THREADS	8
+
+typedef struct
+{
+  int txn;
+  int kind;
+  const char *name;
+} Pending;
+
+static const char *names[] = {
+  "connect", "createStream", "play", "publish", "_checkbw", "set_playlist",
+  "FCPublish", "releaseStream", "deleteStream"
+};
+#define NAME_COUNT	((int)(sizeof(names) / sizeof(names[0])))
+
+static Pending pending[MAX_PENDING];
+static int npending;
+
+static int
+kind_of(const char *name)
+{
+  int i;
+
+  for (i = 0; i < RTMP_CALL_KINDS; i++)
+    if (!strcmp(name, names[i]))
+      return i;
+  return RTMP_CALL_KINDS;
+}
+
+static void
+forget(int k)
+{
+  memmove(&pending[k], &pending[k + 1], (npending - k - 1) * sizeof(Pending));
+  npending--;
+}
+
+static int
+matches(const RTMP *r, int slot, const Pending *p)
+{
+  const RTMP_METHOD *m = &r->m_methodCalls[slot];
+  return m->num == p->txn && m->kind == p->kind && !strcmp(m->name.av_val, p->name);
+}
+
+static void
+queue_one(RTMP *r)
+{
+  const char *name = names[rand() % NAME_COUNT];
+  AVal method;
+  /* a third of the txns are small so they repeat */
+  int txn = rand() % 3 ? rand() : rand() % 50;
+
+  method.av_val = (char *)name;
+  method.av_len = strlen(name);
+  CHECK(CallQueue(r, &method, txn));
+  pending[npending].txn = txn;
+  pending[npending].kind = kind_of(name);
+  pending[npending].name = name;
+  npending++;
+}
+
+static void
+answer_by_txn(RTMP *r)
+{
+  int txn = pending[rand() % npending].txn, slot, j;
+
+  /* any call with that txn may come back, it must be one we queued */
+  slot = CallFind(r, txn);
+  CHECK(slot >= 0);
+  for (j = 0; j < npending && !matches(r, slot, &pending[j]); j++)
+    ;
+  CHECK(j < npending);
+  forget(j);
+  CallDrop(r, slot, TRUE);
+}
+
+static void
+answer_oldest(RTMP *r)
+{
+  int kind = rand() % RTMP_CALL_KINDS, slot = CallOldest(r, kind), j;
+
+  for (j = 0; j < npending && pending[j].kind != kind; j++)
+    ;
+  if (j == npending)
+    {
+      CHECK(slot < 0);
+      return;
+    }
+  CHECK(slot >= 0 && matches(r, slot, &pending[j]));
+  forget(j);
+  CallDrop(r, slot, TRUE);
+}
+
+static void
+find_unknown(RTMP *r)
+{
+  int txn = rand(), j;
+
+  for (j = 0; j < npending && pending[j].txn != txn; j++)
+    ;
+  CHECK((CallFind(r, txn) >= 0) == (j < npending));
+}
+
+static void *
+init_and_lookup(void *arg)
+{
+  RTMP *r = arg;
+  int i;
+
+  RTMP_Init(r);
+  for (i = 0; i < INVOKE_COUNT; i++)
+    CHECK(MethodId(InvokeMethods[i].name) == i);
+  return NULL;
+}
+
+static void
+check_method_ids(void)
+{
+  static RTMP rs[INIT_THREADS];
+  pthread_t th[INIT_THREADS];
+  AVal unknown = AVC("onStatusX");
+  int i;
+
+  for (i = 0; i < INIT_THREADS; i++)
+    CHECK(pthread_create(&th[i], NULL, init_and_lookup, &rs[i]) == 0);
+  for (i = 0; i < INIT_THREADS; i++)
+    pthread_join(th[i], NULL);
+  CHECK(MethodId(&unknown) < 0);
+}
+
+int
+main(int argc, char **argv)
+{
+  RTMP r;
+  long operations = argc > 1 ? atol(argv[1]) : 2000000, i;
+  int op, j;
+
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  check_method_ids();
+
+  RTMP_Init(&r);
+  srand(7);
+  for (i = 0; i < operations; i++)
+    {
+      op = rand() % 10;
+      if (op < 4 || !npending)
+	{
+	  if (npending < MAX_PENDING)
+	    queue_one(&r);
+	}
+      else if (op < 7)
+	answer_by_txn(&r);
+      else if (op < 9)
+	answer_oldest(&r);
+      else
+	find_unknown(&r);
+      CHECK(r.m_numCalls == npending);
+    }
+  for (j = 0; j < npending; j++)
+    CHECK(CallFind(&r, pending[j].txn) >= 0);
+  printf("call map: %ld operations, %d pending, %d slots, map size %d\n",
+	 operations, npending, r.m_callSlots, r.m_callMapSize);
+
+  RTMP_Close(&r);
+  AMFArena_Free(&r.m_amfArena);
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Wire bytes and sender CPU of RTMP_SendPacket across output chunk sizes.
+ *
+ * Replays a synthetic 1080p30 H.264 (4 Mbit/s, 2 s GOP) plus 44.1 kHz
+ * AAC (128 kbit/s) stream through RTMP_SendPacket into a socketpair whose
+ * other end is drained by a thread that counts bytes.
+ *
+ * usage: chunk_size_bench [media-seconds]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define FPS		30
+#define GOP		(2 * FPS)
+#define VIDEO_BPS	4000000
+#define AUDIO_FRAME	372	/* 128 kbit/s at 1024 samples per frame */
+#define AUDIO_MS_X100	2322	/* 1024 / 44100 s in 1/100 ms */
+
+static int sizes[] = { 128, 1024, 4096, 16384, 65536 };
+
+typedef struct
+{
+  int fd;
+  unsigned long long bytes;
+} Drain;
+
+static void *
+drain(void *arg)
+{
+  Drain *d = arg;
+  char buf[65536];
+  ssize_t n;
+
+  while ((n = read(d->fd, buf, sizeof(buf))) > 0)
+    d->bytes += n;
+  return NULL;
+}
+
+static double
+thread_cpu_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+fill(RTMPPacket *p, char *buf, int type, int channel, int size,
+     uint32_t ts)
+{
+  memset(p, 0, sizeof(*p));
+  p->m_packetType = type;
+  p->m_nChannel = channel;
+  p->m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p->m_nTimeStamp = ts;
+  p->m_nInfoField2 = 1;
+  p->m_nBodySize = size;
+  p->m_body = buf + RTMP_MAX_HEADER_SIZE;
+}
+
+int
+main(int argc, char **argv)
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  int frames = seconds * FPS;
+  int pframe = (VIDEO_BPS / 8 * GOP / FPS) / (GOP + 7);	/* I ~ 8 P */
+  char *buf = calloc(1, RTMP_MAX_HEADER_SIZE + pframe * 8);
+  size_t i;
+
+  if (seconds <= 0 || !buf)
+    return 1;
+
+  RTMP_LogSetLevel(RTMP_LOGERROR);
+  printf("%d s of 1080p30 @ %d kbit/s + AAC 128 kbit/s\n", seconds,
+	 VIDEO_BPS / 1000);
+  printf("%8s %12s %12s %9s %12s\n", "chunk", "payload", "wire",
+	 "overhead", "cpu ms/s");
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      RTMP r;
+      RTMPPacket p;
+      Drain d = { 0, 0 };
+      pthread_t th;
+      int sv[2], v = 0, a = 0;
+      unsigned long long payload = 0;
+      double cpu;
+
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	return 1;
+      d.fd = sv[1];
+      pthread_create(&th, NULL, drain, &d);
+
+      RTMP_Init(&r);
+      r.m_sb.sb_socket = sv[0];
+      r.m_outChunkSize = sizes[i];
+
+      cpu = thread_cpu_ms();
+      while (v < frames)
+	{
+	  uint32_t vts = v * 1000 / FPS;
+	  uint32_t ats = a * AUDIO_MS_X100 / 100;
+	  if (ats < vts)
+	    {
+	      fill(&p, buf, RTMP_PACKET_TYPE_AUDIO, 0x11, AUDIO_FRAME, ats);
+	      a++;
+	    }
+	  else
+	    {
+	      int size = v % GOP ? pframe : pframe * 8;
+	      fill(&p, buf, RTMP_PACKET_TYPE_VIDEO, 0x10, size, vts);
+	      v++;
+	    }
+	  payload += p.m_nBodySize;
+	  if (!RTMP_SendPacket(&r, &p, FALSE))
+	    {
+	      fprintf(stderr, "send failed at chunk size %d\n", sizes[i]);
+	      return 1;
+	    }
+	}
+      cpu = thread_cpu_ms() - cpu;
+
+      shutdown(sv[0], SHUT_WR);
+      pthread_join(th, NULL);
+      close(sv[0]);
+      close(sv[1]);
+
+      printf("%8d %12llu %12llu %8.2f%% %12.3f\n", sizes[i], payload,
+	     d.bytes, (d.bytes - payload) * 100.0 / payload, cpu / seconds);
+    }
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Replaying a cached GOP larger than the non-blocking output limit right
+ * after connecting: fixed 16-packet batches overrun the limit and close
+ * the connection, RTMP_SendPacketsPaced delivers every byte to a slow
+ * reader, and gives up without closing if the reader stops.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define LIMIT	(512 * 1024)	/* the app's SEND_BUFFER_LIMIT */
+#define FRAMES	50
+#define FRAME	40000	/* 8 Mbps 1080p */
+#define BATCH	16
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      exit(1); } } while (0)
+
+typedef struct
+{
+  int fd;
+  long bytes;
+  long stopAfter;	/* stop reading after this many bytes */
+} Reader;
+
+static char bodies[FRAMES][RTMP_MAX_HEADER_SIZE + FRAME];
+static RTMPPacket gop[FRAMES];
+static RTMPPacket *packets[FRAMES];
+
+/* reads 64 KiB every 2 ms, about 32 MB/s */
+static void *
+read_slowly(void *arg)
+{
+  static char buf[65536];
+  Reader *rd = arg;
+  ssize_t n;
+
+  while (rd->bytes < rd->stopAfter
+	 && (n = read(rd->fd, buf, sizeof(buf))) > 0)
+    {
+      rd->bytes += n;
+      usleep(2000);
+    }
+  return NULL;
+}
+
+static void
+connect_pair(RTMP *r, int sv[2])
+{
+  int sndbuf = 64 * 1024, i;
+
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  RTMP_Init(r);
+  r->m_sb.sb_socket = sv[0];
+  r->m_outChunkSize = 4096;
+  CHECK(RTMP_SetNonBlocking(r, TRUE, LIMIT));
+
+  for (i = 0; i < FRAMES; i++)
+    {
+      memset(&gop[i], 0, sizeof(gop[i]));
+      gop[i].m_packetType = RTMP_PACKET_TYPE_VIDEO;
+      gop[i].m_nChannel = 0x04;
+      gop[i].m_headerType = i ? RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+      gop[i].m_nTimeStamp = i * 33;
+      gop[i].m_nInfoField2 = 1;
+      gop[i].m_nBodySize = FRAME;
+      gop[i].m_body = bodies[i] + RTMP_MAX_HEADER_SIZE;
+      packets[i] = &gop[i];
+    }
+}
+
+static void
+test_fixed_batches(void)
+{
+  RTMP r;
+  int sv[2], i, ok = TRUE;
+
+  connect_pair(&r, sv);
+  for (i = 0; ok && i < FRAMES; i += BATCH)
+    ok = RTMP_SendPackets(&r, packets + i, i + BATCH < FRAMES ? BATCH : FRAMES - i,
+			  FALSE);
+  CHECK(!ok && !RTMP_IsConnected(&r));
+  printf("fixed batches: connection closed at packet %d\n", i);
+  close(sv[1]);
+}
+
+static void
+test_paced(void)
+{
+  Reader rd = { 0, 0, 1L << 40 };
+  pthread_t th;
+  RTMP r;
+  int sv[2];
+
+  connect_pair(&r, sv);
+  rd.fd = sv[1];
+  pthread_create(&th, NULL, read_slowly, &rd);
+
+  CHECK(RTMP_SendPacketsPaced(&r, packets, FRAMES, FALSE, 5000));
+  CHECK(RTMP_IsConnected(&r) && RTMP_Pending(&r) <= LIMIT);
+  CHECK(RTMP_Drain(&r, 5000));
+  shutdown(sv[0], SHUT_WR);
+  pthread_join(th, NULL);
+  CHECK(rd.bytes == (long)RTMP_BytesSent(&r));
+  CHECK(rd.bytes > (long)FRAMES * FRAME);
+  printf("paced: %d packets, %ld bytes delivered\n", FRAMES, rd.bytes);
+
+  RTMP_Close(&r);
+  close(sv[1]);
+}
+
+static void
+test_stalled_reader(void)
+{
+  Reader rd = { 0, 0, 256 * 1024 };
+  pthread_t th;
+  RTMP r;
+  int sv[2];
+
+  connect_pair(&r, sv);
+  rd.fd = sv[1];
+  pthread_create(&th, NULL, read_slowly, &rd);
+
+  CHECK(!RTMP_SendPacketsPaced(&r, packets, FRAMES, FALSE, 200));
+  CHECK(RTMP_IsConnected(&r) && RTMP_Pending(&r) <= LIMIT);
+  pthread_join(th, NULL);
+  printf("stalled reader: gave up with %d bytes pending\n", RTMP_Pending(&r));
+
+  /* nobody will read the rest, RTMP_Close fails to send it */
+  close(sv[1]);
+  RTMP_Close(&r);
+}
+
+int
+main(void)
+{
+  signal(SIGPIPE, SIG_IGN);
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  test_fixed_batches();
+  test_paced();
+  test_stalled_reader();
+  return 0;
+}
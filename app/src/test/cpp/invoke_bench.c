@@ -0,0 +1,127 @@
+/*
+ * HandleInvoke cost: onStatus dispatch, and matching a _result against
+ * 4 to 10000 outstanding calls (each answered call is queued again so
+ * the backlog stays the same).
+ *
+ * rtmp.c is compiled into this file to reach HandleInvoke and CallQueue.
+ *
+ * usage: invoke_bench [iterations]
+ */
+
+#include "librtmp/rtmp.c"
+
+#include <stdio.h>
+#include <time.h>
+
+static int backlogs[] = { 4, 100, 1000, 10000 };
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char *
+put_name(char *p, const char *s)
+{
+  int n = strlen(s);
+  *p++ = n >> 8;
+  *p++ = n;
+  memcpy(p, s, n);
+  return p + n;
+}
+
+static char *
+put_string(char *p, const char *s)
+{
+  *p++ = AMF_STRING;
+  return put_name(p, s);
+}
+
+static char *
+put_number(char *p, double d)
+{
+  const unsigned char *c = (const unsigned char *)&d;
+  int i;
+
+  *p++ = AMF_NUMBER;
+  for (i = 7; i >= 0; i--)
+    *p++ = c[i];
+  return p;
+}
+
+static void
+bench_on_status(long n)
+{
+  static char body[512];
+  char *p = body;
+  RTMP r;
+  double start;
+  long i;
+
+  p = put_string(p, "onStatus");
+  p = put_number(p, 0);
+  *p++ = AMF_NULL;
+  *p++ = AMF_OBJECT;
+  p = put_string(put_name(p, "level"), "status");
+  p = put_string(put_name(p, "code"), "NetStream.Data.Start");
+  p = put_string(put_name(p, "description"), "data");
+  *p++ = 0, *p++ = 0, *p++ = AMF_OBJECT_END;
+
+  RTMP_Init(&r);
+  start = now_ns();
+  for (i = 0; i < n; i++)
+    HandleInvoke(&r, body, p - body);
+  printf("onStatus dispatch:          %8.0f ns\n", (now_ns() - start) / n);
+  RTMP_Close(&r);
+  AMFArena_Free(&r.m_amfArena);
+}
+
+static void
+bench_result(int backlog, long n)
+{
+  static char body[64];
+  AVal method = AVC("FCPublish");
+  RTMP r;
+  char *p;
+  double start;
+  long i;
+  int txn;
+
+  RTMP_Init(&r);
+  for (txn = 1; txn <= backlog; txn++)
+    CallQueue(&r, &method, txn);
+  srand(1);
+  start = now_ns();
+  for (i = 0; i < n; i++)
+    {
+      txn = 1 + rand() % backlog;
+      p = put_string(body, "_result");
+      p = put_number(p, txn);
+      *p++ = AMF_NULL;
+      p = put_number(p, 1);
+      HandleInvoke(&r, body, p - body);
+      CallQueue(&r, &method, txn);
+    }
+  printf("_result with %5d pending: %8.0f ns\n", backlog,
+	 (now_ns() - start) / n);
+  RTMP_Close(&r);
+  AMFArena_Free(&r.m_amfArena);
+}
+
+int
+main(int argc, char **argv)
+{
+  long n = argc > 1 ? atol(argv[1]) : 1000000;
+  size_t i;
+
+  if (n <= 0)
+    return 1;
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  bench_on_status(n);
+  for (i = 0; i < sizeof(backlogs) / sizeof(backlogs[0]); i++)
+    bench_result(backlogs[i], n);
+  return 0;
+}
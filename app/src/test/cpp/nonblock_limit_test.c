@@ -0,0 +1,125 @@
+/*
+ * Non-blocking output limits: RTMP_Writable turns false at half the
+ * limit, pending bytes never exceed the limit, and RTMP_BytesSent plus
+ * RTMP_Pending accounts for every byte handed to RTMP_SendPacket.
+ * Batches sized by RTMP_SendRoom keep a slow connection open even when a
+ * whole batch is larger than the limit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define LIMIT	(64 * 1024)
+#define BODY	4000
+#define BATCH	16
+#define FRAME	10000	/* a batch of these is more than twice the limit */
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      return 1; } } while (0)
+
+static void
+fill(RTMPPacket *p, char *buf, int size, uint32_t ts)
+{
+  memset(p, 0, sizeof(*p));
+  p->m_packetType = RTMP_PACKET_TYPE_VIDEO;
+  p->m_nChannel = 0x10;
+  p->m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p->m_nTimeStamp = ts;
+  p->m_nInfoField2 = 1;
+  p->m_nBodySize = size;
+  p->m_body = buf + RTMP_MAX_HEADER_SIZE;
+}
+
+int
+main(void)
+{
+  static char buf[RTMP_MAX_HEADER_SIZE + LIMIT];
+  static char frames[BATCH][RTMP_MAX_HEADER_SIZE + FRAME];
+  RTMP r;
+  RTMPPacket p, batch[BATCH], *packets[BATCH];
+  int sv[2], sndbuf = 4096, n = 0, i;
+  uint64_t wire = 0;
+  char drain[65536];
+  ssize_t got;
+
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  RTMP_Init(&r);
+  r.m_sb.sb_socket = sv[0];
+  r.m_outChunkSize = 4096;
+  CHECK(RTMP_SetNonBlocking(&r, TRUE, LIMIT));
+
+  /* nobody reads: everything past the socket buffer stays pending */
+  while (RTMP_Writable(&r))
+    {
+      fill(&p, buf, BODY, n++ * 33);
+      CHECK(RTMP_SendPacket(&r, &p, FALSE));
+      CHECK(RTMP_Pending(&r) <= LIMIT);
+    }
+  CHECK(RTMP_Pending(&r) >= LIMIT / 2);
+  printf("writable until %d pending bytes, %llu sent\n", RTMP_Pending(&r),
+	 (unsigned long long) RTMP_BytesSent(&r));
+
+  /* once drained, the socket took exactly what the peer read */
+  do
+    {
+      while ((got = recv(sv[1], drain, sizeof(drain), MSG_DONTWAIT)) > 0)
+	wire += got;
+    }
+  while (RTMP_Flush(&r) > 0);
+  while ((got = recv(sv[1], drain, sizeof(drain), MSG_DONTWAIT)) > 0)
+    wire += got;
+  CHECK(RTMP_Pending(&r) == 0);
+  CHECK(RTMP_BytesSent(&r) == wire);
+
+  /* the push loop: batches only while writable and only what fits, the
+   * peer reads a little between batches */
+  for (i = 0; i < 200; i++)
+    {
+      int room = RTMP_SendRoom(&r), idle = !RTMP_Pending(&r), k;
+
+      for (k = 0; k < BATCH && RTMP_Writable(&r); k++)
+	{
+	  fill(&batch[k], frames[k], FRAME, n++ * 33);
+	  if (RTMP_PacketSize(&r, &batch[k]) > room && (k || !idle))
+	    break;
+	  room -= RTMP_PacketSize(&r, &batch[k]);
+	  packets[k] = &batch[k];
+	}
+      if (k)
+	CHECK(RTMP_SendPackets(&r, packets, k, FALSE));
+      CHECK(RTMP_IsConnected(&r) && RTMP_Pending(&r) <= LIMIT);
+      recv(sv[1], drain, 8192, MSG_DONTWAIT);
+      RTMP_Flush(&r);
+    }
+  printf("paced batches: connected, %d pending\n", RTMP_Pending(&r));
+  do
+    {
+      while (recv(sv[1], drain, sizeof(drain), MSG_DONTWAIT) > 0)
+	;
+    }
+  while (RTMP_Flush(&r) > 0);
+  while (recv(sv[1], drain, sizeof(drain), MSG_DONTWAIT) > 0)
+    ;
+  CHECK(RTMP_Pending(&r) == 0);
+
+  /* a packet that cannot fit behind what is pending closes the connection */
+  fill(&p, buf, LIMIT, n * 33);
+  while (RTMP_IsConnected(&r) && RTMP_SendPacket(&r, &p, FALSE))
+    CHECK(RTMP_Pending(&r) <= LIMIT);
+  CHECK(!RTMP_IsConnected(&r));
+  CHECK(RTMP_Pending(&r) == 0);
+  printf("oversized write rejected, connection closed\n");
+
+  close(sv[1]);
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * RTMP_ReadPacket throughput per core across input chunk sizes and
+ * receive buffer sizes.
+ *
+ * A writer thread replays a prebuilt chunk stream (32 KiB video and
+ * 400 byte audio messages, interleaved) over a loopback TCP connection;
+ * the reader thread's CPU time is measured.
+ *
+ * usage: read_bench [megabytes]
+ */
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define VIDEO_LEN	32768
+#define AUDIO_LEN	400
+#define MESSAGES	64
+
+static int chunks[] = { 128, 4096, 65536 };
+static int rbufs[] = { 0, 256 * 1024 };
+
+typedef struct
+{
+  int fd;
+  const char *stream;
+  long len;
+  long total;
+} Writer;
+
+static char *
+put_header(char *p, int fmt, int cs, uint32_t ts, int len, int type)
+{
+  *p++ = (fmt << 6) | cs;
+  if (fmt == 3)
+    return p;
+  *p++ = ts >> 16, *p++ = ts >> 8, *p++ = ts;
+  if (fmt == 2)
+    return p;
+  *p++ = len >> 16, *p++ = len >> 8, *p++ = len, *p++ = type;
+  if (fmt == 1)
+    return p;
+  *p++ = 1, *p++ = 0, *p++ = 0, *p++ = 0;
+  return p;
+}
+
+static char *
+put_message(char *p, int first, int cs, uint32_t ts, int len, int type,
+	    int fill, int chunk)
+{
+  int off;
+
+  p = put_header(p, first ? 0 : 1, cs, ts, len, type);
+  for (off = 0; off < len; off += chunk)
+    {
+      int n = len - off < chunk ? len - off : chunk;
+      if (off)
+	p = put_header(p, 3, cs, 0, 0, 0);
+      memset(p, fill, n);
+      p += n;
+    }
+  return p;
+}
+
+static long
+build(char *stream, int chunk)
+{
+  char *p = stream;
+  int m;
+
+  for (m = 0; m < MESSAGES; m++)
+    {
+      p = put_message(p, !m, 6, m * 33, VIDEO_LEN, RTMP_PACKET_TYPE_VIDEO, m, chunk);
+      p = put_message(p, !m, 4, m * 33, AUDIO_LEN, RTMP_PACKET_TYPE_AUDIO, 7, chunk);
+    }
+  return p - stream;
+}
+
+static void *
+write_stream(void *arg)
+{
+  Writer *w = arg;
+  long sent;
+
+  for (sent = 0; sent < w->total; sent += w->len)
+    {
+      long n = 0;
+      while (n < w->len)
+	{
+	  ssize_t k = write(w->fd, w->stream + n, w->len - n);
+	  if (k <= 0)
+	    return NULL;
+	  n += k;
+	}
+    }
+  shutdown(w->fd, SHUT_WR);
+  return NULL;
+}
+
+static double
+seconds(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+run(int chunk, int rbuf, long total)
+{
+  static char stream[4 << 20];
+  struct sockaddr_in addr;
+  socklen_t alen = sizeof(addr);
+  RTMP r;
+  RTMPPacket p;
+  Writer w;
+  pthread_t th;
+  int ls, c, s;
+  long bytes = 0, msgs = 0;
+  double cpu, wall;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ls = socket(AF_INET, SOCK_STREAM, 0);
+  if (ls < 0 || bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || getsockname(ls, (struct sockaddr *)&addr, &alen) < 0 || listen(ls, 1) < 0)
+    return FALSE;
+  c = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(c, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || (s = accept(ls, NULL, NULL)) < 0)
+    return FALSE;
+  close(ls);
+
+  w.fd = s;
+  w.stream = stream;
+  w.len = build(stream, chunk);
+  w.total = total;
+  pthread_create(&th, NULL, write_stream, &w);
+
+  RTMP_Init(&r);
+  r.m_sb.sb_socket = c;
+  r.m_inChunkSize = chunk;
+  if (rbuf && !RTMP_SetReceiveBuffer(&r, rbuf))
+    return FALSE;
+
+  memset(&p, 0, sizeof(p));
+  cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+  wall = seconds(CLOCK_MONOTONIC);
+  while (RTMP_ReadPacket(&r, &p))
+    {
+      if (RTMPPacket_IsReady(&p))
+	{
+	  bytes += p.m_nBodySize;
+	  msgs++;
+	  RTMPPacket_Free(&p);
+	}
+    }
+  cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  wall = seconds(CLOCK_MONOTONIC) - wall;
+
+  pthread_join(th, NULL);
+  RTMP_Close(&r);
+  close(s);
+
+  printf("%6d %8d %9ld %9.1f %12.0f %12.0f\n", chunk, rbuf, msgs,
+	 bytes / 1048576.0, bytes / 1048576.0 / cpu, bytes / 1048576.0 / wall);
+  return msgs == (total + w.len - 1) / w.len * 2 * MESSAGES;
+}
+
+int
+main(int argc, char **argv)
+{
+  long total = (argc > 1 ? atol(argv[1]) : 512) << 20;
+  size_t i, j;
+
+  if (total <= 0)
+    return 1;
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  printf("%6s %8s %9s %9s %12s %12s\n", "chunk", "rbuf", "messages", "MB",
+	 "MB/s cpu", "MB/s wall");
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    for (j = 0; j < sizeof(rbufs) / sizeof(rbufs[0]); j++)
+      if (!run(chunks[i], rbufs[j], total))
+	{
+	  fprintf(stderr, "read failed at chunk %d rbuf %d\n", chunks[i], rbufs[j]);
+	  return 1;
+	}
+  return 0;
+}
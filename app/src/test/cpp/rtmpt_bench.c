@@ -0,0 +1,134 @@
+/*
+ * Sender CPU and HTTP request count of RTMPT compared with plain RTMP,
+ * for a range of packet sizes, over loopback TCP into a sink thread.
+ *
+ * usage: rtmpt_bench [megabytes]
+ */
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+static int sizes[] = { 400, 4000, 40000 };
+
+static void *
+sink(void *arg)
+{
+  static char buf[1 << 16];
+  int fd = *(int *)arg;
+
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  return NULL;
+}
+
+static double
+seconds(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+run(int http, int size, long total)
+{
+  struct sockaddr_in addr;
+  socklen_t alen = sizeof(addr);
+  RTMP r;
+  RTMPPacket p;
+  pthread_t th;
+  int ls, c, s, i = 0;
+  long sent = 0;
+  char *body;
+  double cpu, wall;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ls = socket(AF_INET, SOCK_STREAM, 0);
+  if (ls < 0 || bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || getsockname(ls, (struct sockaddr *)&addr, &alen) < 0 || listen(ls, 1) < 0)
+    return FALSE;
+  c = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(c, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || (s = accept(ls, NULL, NULL)) < 0)
+    return FALSE;
+  close(ls);
+  pthread_create(&th, NULL, sink, &s);
+
+  RTMP_Init(&r);
+  r.m_sb.sb_socket = c;
+  r.Link.hostname.av_val = "example.com";
+  r.Link.hostname.av_len = 11;
+  r.Link.port = 80;
+  r.m_outChunkSize = 4096;
+  if (http)
+    {
+      r.Link.protocol = RTMP_PROTOCOL_RTMPT;
+      r.m_clientID.av_val = strdup("/abc");
+      r.m_clientID.av_len = 4;
+    }
+
+  body = calloc(1, size);
+  memset(&p, 0, sizeof(p));
+  p.m_nChannel = 6;
+  p.m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p.m_packetType = RTMP_PACKET_TYPE_VIDEO;
+  p.m_nBodySize = size;
+  p.m_body = body;
+
+  cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+  wall = seconds(CLOCK_MONOTONIC);
+  for (; sent < total; sent += size)
+    {
+      p.m_nTimeStamp = i++;
+      if (!RTMP_SendPacket(&r, &p, FALSE))
+	return FALSE;
+    }
+  if (RTMP_Flush(&r) < 0)
+    return FALSE;
+  cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  wall = seconds(CLOCK_MONOTONIC) - wall;
+
+  printf("%-6s %7d %9d %12.0f %12.0f\n", http ? "rtmpt" : "rtmp", size,
+	 r.m_msgCounter, sent / 1048576.0 / cpu, sent / 1048576.0 / wall);
+
+  shutdown(c, SHUT_WR);
+  pthread_join(th, NULL);
+  RTMP_Close(&r);
+  close(s);
+  free(body);
+  return TRUE;
+}
+
+int
+main(int argc, char **argv)
+{
+  long total = (argc > 1 ? atol(argv[1]) : 200) << 20;
+  size_t i;
+
+  if (total <= 0)
+    return 1;
+  /* RTMP_Close still posts to the sink after it stopped reading */
+  signal(SIGPIPE, SIG_IGN);
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  printf("%-6s %7s %9s %12s %12s\n", "proto", "packet", "requests", "MB/s cpu",
+	 "MB/s wall");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    if (!run(0, sizes[i], total) || !run(1, sizes[i], total))
+      {
+	fprintf(stderr, "send failed at packet size %d\n", sizes[i]);
+	return 1;
+      }
+  return 0;
+}
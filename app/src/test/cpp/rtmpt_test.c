@@ -0,0 +1,182 @@
+/*
+ * RTMPT tunnelling: sends are batched into one POST per flush with a
+ * matching Content-Length, pipelined replies are parsed incrementally
+ * even when they arrive a byte at a time, and error replies or
+ * overlong header lines close the connection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      exit(1); } } while (0)
+
+static int sv[2];
+static RTMP r;
+
+static void
+setup(void)
+{
+  if (sv[0])
+    {
+      RTMP_Close(&r);
+      close(sv[1]);
+    }
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  RTMP_Init(&r);
+  r.m_sb.sb_socket = sv[0];
+  r.Link.protocol = RTMP_PROTOCOL_RTMPT;
+  r.Link.hostname.av_val = "example.com";
+  r.Link.hostname.av_len = 11;
+  r.Link.port = 80;
+  r.m_clientID.av_val = strdup("/abc");
+  r.m_clientID.av_len = 4;
+  r.m_outChunkSize = 4096;
+}
+
+/* whatever the client wrote, waiting at most 100 ms for more */
+static int
+read_all(char *buf, int max)
+{
+  struct timeval tv = { 0, 100000 };
+  int n = 0, k;
+
+  setsockopt(sv[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  while (n < max && (k = recv(sv[1], buf + n, max - n, 0)) > 0)
+    n += k;
+  return n;
+}
+
+static void
+send_slowly(const char *s, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+    CHECK(send(sv[1], s + i, 1, 0) == 1);
+}
+
+static void
+test_batched_post(void)
+{
+  static char got[1 << 20];
+  char body[3000];
+  RTMPPacket p;
+  char *headerEnd, *length;
+  int i, n;
+
+  memset(body, 'x', sizeof(body));
+  memset(&p, 0, sizeof(p));
+  p.m_nChannel = 6;
+  p.m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p.m_packetType = RTMP_PACKET_TYPE_VIDEO;
+  p.m_nBodySize = sizeof(body);
+  p.m_body = body;
+  p.m_nInfoField2 = 1;
+
+  /* collected, nothing goes out before the flush */
+  for (i = 0; i < 5; i++)
+    {
+      p.m_nTimeStamp = i * 33;
+      CHECK(RTMP_SendPacket(&r, &p, FALSE));
+    }
+  CHECK(read_all(got, sizeof(got)) == 0);
+  CHECK(RTMP_Pending(&r) > 5 * (int)sizeof(body));
+
+  CHECK(RTMP_Flush(&r) == 0 && RTMP_Pending(&r) == 0);
+  n = read_all(got, sizeof(got) - 1);
+  got[n] = '\0';
+  CHECK(strncmp(got, "POST /send/abc/", 15) == 0);
+  headerEnd = strstr(got, "\r\n\r\n");
+  length = strstr(got, "Content-length: ");
+  CHECK(headerEnd && length);
+  CHECK(atoi(length + 16) == n - (headerEnd + 4 - got));
+  CHECK(!strstr(headerEnd, "POST"));
+  printf("batched post: 5 packets in one %d byte request\n", n);
+}
+
+static void
+test_pipelined_replies(void)
+{
+  static const char empty[] = "HTTP/1.1 200 OK\r\nContent-Type: application/x-fcs\r\n"
+    "content-length: 1\r\n\r\n\x05";
+  /* Window Acknowledgement Size on channel 2 */
+  static const char ack[16] = { 0x02, 0, 0, 0, 0, 0, 4, 0x05, 0, 0, 0, 0, 0, 0x26, 0x25, (char)0xa0 };
+  char third[256];
+  RTMPPacket in;
+  int len, tries = 0, ok = 0;
+
+  len = sprintf(third, "HTTP/1.0 200 OK\r\nContent-Length:  17\r\nConnection: Keep-Alive\r\n\r\n\x01");
+  memcpy(third + len, ack, sizeof(ack));
+  len += sizeof(ack);
+
+  r.m_unackd = 3;
+  send_slowly(empty, sizeof(empty) - 1);
+  send_slowly(empty, sizeof(empty) - 1);
+  send_slowly(third, len);
+
+  memset(&in, 0, sizeof(in));
+  while (tries++ < 1000 && !(ok = RTMP_ReadAvailable(&r, &in)))
+    ;
+  CHECK(ok && in.m_packetType == 0x05 && r.m_unackd == 0);
+  RTMPPacket_Free(&in);
+  CHECK(!RTMP_ReadAvailable(&r, &in) && RTMP_IsConnected(&r));
+  printf("pipelined replies: packet after %d polls\n", tries);
+}
+
+static void
+test_error_reply(void)
+{
+  static const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+  RTMPPacket in;
+
+  memset(&in, 0, sizeof(in));
+  r.m_unackd = 1;
+  CHECK(send(sv[1], notFound, sizeof(notFound) - 1, 0) > 0);
+  CHECK(!RTMP_ReadAvailable(&r, &in));
+  CHECK(!RTMP_IsConnected(&r));
+  printf("404 reply: connection closed\n");
+}
+
+static void
+test_overlong_header(void)
+{
+  char *junk = malloc(20000);
+  RTMPPacket in;
+
+  memset(&in, 0, sizeof(in));
+  memset(junk, 'A', 20000);
+  memcpy(junk, "HTTP/1.1 200 OK\r\nX: ", 20);
+  r.m_unackd = 1;
+  CHECK(send(sv[1], junk, 20000, 0) == 20000);
+  while (RTMP_IsConnected(&r) && !RTMP_ReadAvailable(&r, &in))
+    ;
+  CHECK(!RTMP_IsConnected(&r));
+  free(junk);
+  printf("overlong header line: connection closed\n");
+}
+
+int
+main(void)
+{
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+  setup();
+  test_batched_post();
+  test_pipelined_replies();
+  test_error_reply();
+
+  setup();
+  test_overlong_header();
+
+  RTMP_Close(&r);
+  close(sv[1]);
+  return 0;
+}
@@ -0,0 +1,91 @@
+// SafeQueue 生产者 push 到消费者 popBatch 拿到的交接时延分布
+// paced：每个包之间停一会，消费者每次都睡在 futex 上，测的是唤醒路径
+// burst：两个生产者连续 push，测的是队列本身的开销
+// 用法：safe_queue_bench [每种模式的包数]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "safe_queue.h"
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(const char *mode, int count, int producers, int pauseUs) {
+    SafeQueue<uint64_t> queue(2048);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    queue.setWork(1);
+
+    std::thread consumer([&] {
+        uint64_t batch[64];
+        while ((int) latencies.size() < count) {
+            int n = queue.popBatch(batch, 64);
+            uint64_t now = nowNs();
+            for (int i = 0; i < n; ++i) {
+                latencies.push_back(now - batch[i]);
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (int i = p; i < count; i += producers) {
+                while (!queue.push(nowNs())) {
+                    std::this_thread::yield();
+                }
+                if (pauseUs) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(pauseUs));
+                }
+            }
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    consumer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, (size_t) (latencies.size() * p))] / 1000.0;
+    };
+    printf("%-6s %8d %9.1f %9.1f %9.1f %9.1f  drops:%llu\n", mode, count, pct(0.5), pct(0.9),
+           pct(0.99), pct(0.999), (unsigned long long) queue.dropped());
+}
+
+// 普通元素占满之后，keepCallback 认定的元素还能用预留的格子
+static bool keepOdd(uint64_t value) {
+    return value & 1;
+}
+
+static bool checkReserve() {
+    SafeQueue<uint64_t> queue(64);
+    queue.setKeepCallback(keepOdd);
+    queue.setWork(1);
+    int normal = 0;
+    while (queue.push(2)) {
+        ++normal;
+    }
+    bool ok = normal < 64 && queue.push(1) && queue.dropped() == 1;
+    printf("reserve: %d normal slots, keep push %s\n", normal, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    if (count <= 0 || !checkReserve()) {
+        return 1;
+    }
+    printf("%-6s %8s %9s %9s %9s %9s  (us)\n", "mode", "packets", "p50", "p90", "p99", "p99.9");
+    run("paced", count, 2, 200);
+    run("burst", count * 10, 2, 0);
+    return 0;
+}
@@ -0,0 +1,122 @@
+// SampleClock 漂移测试：模拟一小时采集，声卡时钟相对系统时钟偏 -50/0/+50 ppm，
+// read() 返回时刻带 0~10ms 抖动，中途丢一次长样本（走重新对齐）和一次短样本（走慢慢校正），
+// 检查推算的采集时刻和真实采集时刻的误差上限、时间戳严格递增
+// 用法：sample_clock_drift [模拟分钟数]
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "media_clock.h"
+
+// 和 AudioChannel 保持一致：44.1kHz 单声道，AAC 一帧 1024 个样本
+#define SAMPLE_RATE 44100
+#define FRAME_SAMPLES 1024
+// AudioRecord 一次 read 返回的样本数
+#define READ_SAMPLES 2048
+#define JITTER_MS 10
+
+// 误差上限：稳定时是 read() 抖动，丢样本后 SETTLE_MS 内允许多出丢掉的时长
+#define MAX_ERROR_MS 12
+#define SETTLE_MS 5000
+// 短丢样本的时长，整个过程的误差不超过它加上 MAX_ERROR_MS
+#define SHORT_DROPOUT_MS 40
+
+struct Dropout {
+    int atMinute;
+    int lostMs;
+};
+
+// 300ms 超过 AUDIO_CLOCK_RESYNC_MS 直接对齐，40ms 按 AUDIO_CLOCK_SLEW 慢慢校正
+static const Dropout dropouts[] = {{20, 300}, {40, SHORT_DROPOUT_MS}};
+
+static uint32_t rng = 1;
+
+static int jitterNs() {
+    rng = rng * 1103515245 + 12345;
+    return (int) ((rng >> 8) % (JITTER_MS * 1000000));
+}
+
+// 返回误差最大值（毫秒），出错返回 -1
+static double run(double ppm, int minutes) {
+    SampleClock clock;
+    clock.reset(SAMPLE_RATE);
+
+    // 声卡实际每个样本的系统时钟时长
+    double nsPerSample = 1e9 / SAMPLE_RATE / (1 + ppm / 1e6);
+    int64_t start = 1000000000LL; // 第 0 个样本的真实采集时刻
+    int64_t lostNs = 0; // 已经丢掉的样本时长，丢掉的样本不计数
+    uint64_t written = 0, consumed = 0;
+    int64_t lastNs = 0;
+    uint32_t lastMs = 0;
+    int64_t settleUntil = 0;
+    double maxError = 0, steadyError = 0, finalError = 0;
+    size_t nextDropout = 0;
+    int64_t endNs = start + minutes * 60000000000LL;
+
+    for (;;) {
+        written += READ_SAMPLES;
+        int64_t captured = start + lostNs + (int64_t) (written * nsPerSample);
+        if (captured >= endNs) {
+            break;
+        }
+        clock.observe(written, captured + jitterNs());
+
+        while (consumed + FRAME_SAMPLES <= written) {
+            int64_t truth = start + lostNs + (int64_t) (consumed * nsPerSample);
+            int64_t time = clock.timeOf(consumed);
+            uint32_t ms = mediaMs(time);
+            if (consumed && (time <= lastNs || ms < lastMs)) {
+                fprintf(stderr, "FAIL %+.0fppm: sample %llu stamped %lld after %lld\n", ppm,
+                        (unsigned long long) consumed, (long long) time, (long long) lastNs);
+                return -1;
+            }
+            lastNs = time;
+            lastMs = ms;
+
+            double error = llabs(time - truth) / 1e6;
+            maxError = error > maxError ? error : maxError;
+            finalError = error;
+            if (captured >= settleUntil) {
+                steadyError = error > steadyError ? error : steadyError;
+            }
+            consumed += FRAME_SAMPLES;
+        }
+
+        if (nextDropout < sizeof(dropouts) / sizeof(dropouts[0])
+            && captured - start >= dropouts[nextDropout].atMinute * 60000000000LL) {
+            // 采集线程卡住，环满了丢样本：时间过去了，样本序号没动
+            int64_t lost = dropouts[nextDropout].lostMs * 1000000LL;
+            lostNs += lost;
+            settleUntil = captured + lost + SETTLE_MS * 1000000LL;
+            nextDropout++;
+        }
+    }
+
+    printf("%+5.0f ppm: %llu frames, max error %.1f ms, steady %.1f ms, final %.1f ms, "
+           "uncorrected drift %.0f ms\n", ppm, (unsigned long long) (consumed / FRAME_SAMPLES),
+           maxError, steadyError, finalError, llabs((int64_t) (minutes * 60e9 * ppm / 1e6)) / 1e6);
+    if (steadyError > MAX_ERROR_MS || finalError > MAX_ERROR_MS) {
+        fprintf(stderr, "FAIL %+.0fppm: error above %d ms\n", ppm, MAX_ERROR_MS);
+        return -1;
+    }
+    return maxError;
+}
+
+int main(int argc, char **argv) {
+    int minutes = argc > 1 ? atoi(argv[1]) : 60;
+    if (minutes <= 0) {
+        return 1;
+    }
+    static const double skews[] = {-50, 0, 50};
+    for (double ppm : skews) {
+        double maxError = run(ppm, minutes);
+        // 长丢样本之后直接对齐，短丢样本的误差不会超过丢掉的时长
+        if (maxError < 0 || maxError > SHORT_DROPOUT_MS + MAX_ERROR_MS) {
+            if (maxError >= 0) {
+                fprintf(stderr, "FAIL %+.0fppm: max error %.1f ms\n", ppm, maxError);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
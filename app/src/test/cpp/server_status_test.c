@@ -0,0 +1,182 @@
+/*
+ * RTMP_ReadAvailable never waits for the rest of a partly received
+ * chunk, and only _error answers to connect/createStream/publish or the
+ * BadName / Connect.Rejected status codes are reported as fatal.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define PACKET_TYPE_INVOKE	0x14	/* private to rtmp.c */
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                      exit(1); } } while (0)
+
+static int fatals, statuses;
+
+static void
+on_status(void *ctx, const AVal *level, const AVal *code,
+	  const AVal *description, int fatal)
+{
+  statuses++;
+  fatals += fatal;
+}
+
+static AVal
+av(const char *s)
+{
+  AVal v;
+  v.av_val = (char *)s;
+  v.av_len = strlen(s);
+  return v;
+}
+
+/* chunk stream bytes of an invoke, as a server RTMP would send them */
+static int
+encode_invoke(const char *method, double txn, const char *code,
+	      char *out, int outSize)
+{
+  static char body[RTMP_MAX_HEADER_SIZE + 512];
+  RTMP srv;
+  RTMPPacket p;
+  AVal name = av(method), avCode = av(code), level = av("level"),
+    error = av("error"), key = av("code");
+  char *enc = body + RTMP_MAX_HEADER_SIZE, *end = body + sizeof(body);
+  int sv[2], n = 0, got;
+
+  enc = AMF_EncodeString(enc, end, &name);
+  enc = AMF_EncodeNumber(enc, end, txn);
+  *enc++ = AMF_NULL;
+  *enc++ = AMF_OBJECT;
+  enc = AMF_EncodeNamedString(enc, end, &level, &error);
+  enc = AMF_EncodeNamedString(enc, end, &key, &avCode);
+  *enc++ = 0, *enc++ = 0, *enc++ = AMF_OBJECT_END;
+
+  memset(&p, 0, sizeof(p));
+  p.m_packetType = PACKET_TYPE_INVOKE;
+  p.m_nChannel = 0x03;
+  p.m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p.m_body = body + RTMP_MAX_HEADER_SIZE;
+  p.m_nBodySize = enc - p.m_body;
+
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  RTMP_Init(&srv);
+  srv.m_sb.sb_socket = sv[0];
+  CHECK(RTMP_SendPacket(&srv, &p, FALSE));
+  shutdown(sv[0], SHUT_WR);
+  while ((got = read(sv[1], out + n, outSize - n)) > 0)
+    n += got;
+  RTMP_Close(&srv);
+  close(sv[1]);
+  return n;
+}
+
+/* a call the client made and is waiting for */
+static void
+queue_call(RTMP *r, const char *method, double txn)
+{
+  static char body[RTMP_MAX_HEADER_SIZE + 256];
+  RTMPPacket p;
+  AVal name = av(method);
+  char *enc = body + RTMP_MAX_HEADER_SIZE, *end = body + sizeof(body);
+
+  enc = AMF_EncodeString(enc, end, &name);
+  enc = AMF_EncodeNumber(enc, end, txn);
+  *enc++ = AMF_NULL;
+
+  memset(&p, 0, sizeof(p));
+  p.m_packetType = PACKET_TYPE_INVOKE;
+  p.m_nChannel = 0x03;
+  p.m_headerType = RTMP_PACKET_SIZE_LARGE;
+  p.m_body = body + RTMP_MAX_HEADER_SIZE;
+  p.m_nBodySize = enc - p.m_body;
+  CHECK(RTMP_SendPacket(r, &p, TRUE));
+}
+
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* feed the chunk bytes to the client and handle whatever completes */
+static int
+deliver(RTMP *r, int peer, const char *buf, int len)
+{
+  RTMPPacket packet;
+  int handled = 0;
+
+  CHECK(write(peer, buf, len) == len);
+  memset(&packet, 0, sizeof(packet));
+  while (RTMP_ReadAvailable(r, &packet))
+    {
+      RTMP_ClientPacket(r, &packet);
+      RTMPPacket_Free(&packet);
+      handled++;
+    }
+  CHECK(RTMP_IsConnected(r));
+  return handled;
+}
+
+int
+main(void)
+{
+  char wire[1024], sink[4096];
+  RTMP r;
+  int sv[2], n, half;
+  double start;
+
+  RTMP_LogSetLevel(RTMP_LOGCRIT);
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  RTMP_Init(&r);
+  r.m_sb.sb_socket = sv[0];
+  r.Link.timeout = 5;
+  RTMP_SetStatusCallback(&r, on_status, NULL);
+
+  queue_call(&r, "releaseStream", 2);
+  queue_call(&r, "FCPublish", 3);
+  queue_call(&r, "publish", 5);
+  CHECK(read(sv[1], sink, sizeof(sink)) > 0);
+
+  /* half a chunk is left in the buffer without waiting for the rest */
+  n = encode_invoke("_error", 2, "NetStream.Publish.Denied", wire, sizeof(wire));
+  half = n / 2;
+  start = now_ms();
+  CHECK(deliver(&r, sv[1], wire, half) == 0);
+  CHECK(now_ms() - start < 1000);
+  CHECK(deliver(&r, sv[1], wire + half, n - half) == 1);
+  printf("partial chunk: returned after %.1f ms\n", now_ms() - start);
+
+  /* refused releaseStream / FCPublish are reported but not fatal */
+  n = encode_invoke("_error", 3, "NetStream.Publish.Denied", wire, sizeof(wire));
+  CHECK(deliver(&r, sv[1], wire, n) == 1);
+  CHECK(statuses == 2 && fatals == 0);
+
+  n = encode_invoke("onStatus", 0, "NetStream.Publish.Idle", wire, sizeof(wire));
+  CHECK(deliver(&r, sv[1], wire, n) == 1);
+  CHECK(statuses == 3 && fatals == 0);
+
+  /* a refused publish is */
+  n = encode_invoke("_error", 5, "NetStream.Publish.Denied", wire, sizeof(wire));
+  CHECK(deliver(&r, sv[1], wire, n) == 1);
+  CHECK(statuses == 4 && fatals == 1);
+
+  n = encode_invoke("onStatus", 0, "NetStream.Publish.BadName", wire, sizeof(wire));
+  CHECK(deliver(&r, sv[1], wire, n) == 1);
+  CHECK(statuses == 5 && fatals == 2);
+  printf("status: %d reported, %d fatal\n", statuses, fatals);
+
+  RTMP_Close(&r);
+  close(sv[1]);
+  return 0;
+}
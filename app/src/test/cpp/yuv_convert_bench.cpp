@@ -0,0 +1,64 @@
+// deinterleaveVU 和逐字节拆分每帧的耗时，常见的相机预览尺寸
+// 同一份源码按编译选项测 SSE2/AVX2（x86）或 NEON（arm）那条路径
+// 用法：yuv_convert_bench [每种尺寸的帧数]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "yuv_convert.h"
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 不让编译器把逐字节的循环向量化，才是真正的对照
+#if defined(__clang__)
+__attribute__((noinline))
+#else
+__attribute__((noinline, optimize("no-tree-vectorize")))
+#endif
+static void scalarVU(const uint8_t *vu, uint8_t *u, uint8_t *v, int count) {
+#if defined(__clang__)
+#pragma clang loop vectorize(disable)
+#endif
+    for (int i = 0; i < count; ++i) {
+        v[i] = vu[i * 2];
+        u[i] = vu[i * 2 + 1];
+    }
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    if (frames <= 0) {
+        return 1;
+    }
+    static const int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+    printf("%-10s %12s %12s %8s\n", "size", "scalar us", "simd us", "speedup");
+    for (const int *size : sizes) {
+        int count = ((size[0] + 1) / 2) * ((size[1] + 1) / 2);
+        std::vector<uint8_t> vu(count * 2), u(count), v(count);
+        for (int i = 0; i < count * 2; ++i) {
+            vu[i] = (uint8_t) i;
+        }
+
+        uint64_t start = nowNs();
+        for (int f = 0; f < frames; ++f) {
+            scalarVU(vu.data(), u.data(), v.data(), count);
+        }
+        double scalarUs = (nowNs() - start) / 1e3 / frames;
+
+        start = nowNs();
+        for (int f = 0; f < frames; ++f) {
+            deinterleaveVU(vu.data(), u.data(), v.data(), count);
+        }
+        double simdUs = (nowNs() - start) / 1e3 / frames;
+
+        char name[32];
+        snprintf(name, sizeof(name), "%dx%d", size[0], size[1]);
+        printf("%-10s %12.1f %12.1f %7.1fx\n", name, scalarUs, simdUs, scalarUs / simdUs);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// deinterleaveVU 和逐字节拆分的结果逐字节比较，覆盖奇数宽高和不够一组向量的尾巴，
+// 输出平面前后各留一段哨兵字节，检查没有越界写；输入是刚好大小的堆内存，越界读由 ASan 报出来
+// 同一份源码按编译选项测 SSE2/AVX2（x86）或 NEON（arm）那条路径
+// 用法：yuv_convert_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "yuv_convert.h"
+
+#define GUARD 64
+#define GUARD_BYTE 0xA5
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d %s\n", __FILE__, __LINE__, #cond); \
+                        exit(1); } } while (0)
+
+static const char *path() {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    return "NEON";
+#elif defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+static void check(int count) {
+    // 刚好 count 对，多读一个字节 ASan 就会报
+    uint8_t *vu = static_cast<uint8_t *>(malloc(count * 2 + 1));
+    for (int i = 0; i < count * 2; ++i) {
+        vu[i] = (uint8_t) (i * 7 + count);
+    }
+
+    std::vector<uint8_t> u(count + GUARD * 2, GUARD_BYTE), v(count + GUARD * 2, GUARD_BYTE);
+    deinterleaveVU(vu, &u[GUARD], &v[GUARD], count);
+
+    for (int i = 0; i < count; ++i) {
+        CHECK(v[GUARD + i] == vu[i * 2]);
+        CHECK(u[GUARD + i] == vu[i * 2 + 1]);
+    }
+    for (int i = 0; i < GUARD; ++i) {
+        CHECK(u[i] == GUARD_BYTE && v[i] == GUARD_BYTE);
+        CHECK(u[GUARD + count + i] == GUARD_BYTE && v[GUARD + count + i] == GUARD_BYTE);
+    }
+    free(vu);
+}
+
+int main() {
+    // 所有不够几组向量的长度
+    for (int count = 0; count <= 200; ++count) {
+        check(count);
+    }
+
+    // 奇数宽高的帧，色度向上取整
+    static const int sizes[][2] = {{1, 1}, {3, 3}, {17, 9}, {33, 31}, {63, 65}, {175, 143},
+                                   {641, 479}, {1279, 719}, {1920, 1080}, {1919, 1081}};
+    for (const int *size : sizes) {
+        check(((size[0] + 1) / 2) * ((size[1] + 1) / 2));
+    }
+    printf("deinterleaveVU %s: 201 lengths and %d frame sizes match the scalar loop\n", path(),
+           (int) (sizeof(sizes) / sizeof(sizes[0])));
+    return 0;
+}